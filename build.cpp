@@ -1,6 +1,6 @@
 #include "nobpp.hpp"
 
-int main() {
+int main(int argc, char** argv) {
     nobpp::CommandBuilder builder = nobpp::CommandBuilder();
 
     builder.set_language(nobpp::Language::cpp)
@@ -46,10 +46,10 @@ int main() {
         .set_build_dir("./bin")
         .set_output("test3");
 
-    nobpp::CommandQueue(2)
-        .add_builder(builder1)
-        .add_builder(builder2)
-        .add_builder(builder3);
-
-    return 0;
+    // ./build -j2 test2 builds only test2
+    return nobpp::Cli(argc, argv)
+        .add_target(builder1)
+        .add_target(builder2)
+        .add_target(builder3)
+        .run();
 }
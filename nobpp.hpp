@@ -33,15 +33,36 @@
 
 #pragma once
 #include <algorithm>
+#include <atomic>
+#include <cctype>
 #include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fstream>
 #include <functional>
 #include <initializer_list>
 #include <iostream>
+#include <iterator>
+#include <limits>
+#include <map>
+#include <memory>
 #include <mutex>
 #include <queue>
 #include <random>
+#include <set>
+#include <sstream>
+#include <stdexcept>
 #include <string>
+#if __cplusplus >= 201703L
+    #include <string_view>
+#endif
 #include <thread>
+#include <unordered_map>
 #include <unordered_set>
 #include <vector>
 
@@ -53,7 +74,26 @@
     #include <tchar.h>
     #include <windows.h>
     #pragma comment(lib, "User32.lib")
-#elif __linux__
+#else
+    #include <dirent.h>
+    #include <errno.h>
+    #include <fcntl.h>
+    #include <netdb.h>
+    #include <poll.h>
+    #include <signal.h>
+    #include <sys/mman.h>
+    #include <sys/socket.h>
+    #include <sys/stat.h>
+    #include <sys/types.h>
+    #include <sys/un.h>
+    #include <sys/wait.h>
+    #include <unistd.h>
+    #ifdef __linux__
+        #include <sys/epoll.h>
+        #include <sys/eventfd.h>
+        #include <sys/prctl.h>
+        #include <sys/syscall.h>
+    #endif
 #endif
 
 namespace nobpp {
@@ -217,6 +257,324 @@ inline std::string generate(int size) {
 }
 }  // namespace nanoid
 
+/**
+ * @brief Always-on build metrics
+ *
+ * Counters are relaxed atomics updated on the hot paths of nobpp, so they
+ * cost a few nanoseconds and need no lock. Dump them once the build is done.
+ *
+ * @code
+ * ```cpp
+ * nobpp::CommandQueue(16).add_builder(builder).wait();
+ * nobpp::write_file("build/metrics.json", nobpp::metrics::global().to_json());
+ * ```
+ * @endcode
+ */
+namespace metrics {
+/**
+ * @brief Monotonic counter
+ */
+struct Counter {
+    std::atomic<uint64_t> value{0};
+
+    void add(uint64_t amount = 1) noexcept {
+        value.fetch_add(amount, std::memory_order_relaxed);
+    }
+
+    uint64_t get() const noexcept {
+        return value.load(std::memory_order_relaxed);
+    }
+};
+
+/**
+ * @brief Value that goes up and down, remembering its maximum
+ */
+struct Gauge {
+    std::atomic<int64_t> value{0};
+    std::atomic<int64_t> max{0};
+
+    void set(int64_t to) noexcept {
+        value.store(to, std::memory_order_relaxed);
+
+        int64_t current = max.load(std::memory_order_relaxed);
+        while (to > current && !max.compare_exchange_weak(
+                                   current, to, std::memory_order_relaxed)) {
+        }
+    }
+
+    int64_t get() const noexcept {
+        return value.load(std::memory_order_relaxed);
+    }
+};
+
+using Clock = std::chrono::steady_clock;
+
+inline uint64_t nanoseconds_since(Clock::time_point start) noexcept {
+    return static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(
+            Clock::now() - start)
+            .count());
+}
+
+/**
+ * @brief Adds the time until it is destroyed to a counter
+ */
+class ScopedTimer {
+public:
+    explicit ScopedTimer(Counter& counter) noexcept
+        : counter(counter), start(Clock::now()) {}
+    ScopedTimer(const ScopedTimer&) = delete;
+    ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+    ~ScopedTimer() {
+        self.counter.add(nanoseconds_since(self.start));
+    }
+
+private:
+    ScopedTimer& self = *this;
+
+    Counter& counter;
+    Clock::time_point start;
+};
+
+/**
+ * @brief Every metric of nobpp
+ */
+struct Registry {
+    static constexpr size_t MAX_WORKERS = 256;
+    static constexpr size_t DEPTH_SAMPLES = 4096;
+    /// Minimum time between two samples of the queue depth
+    static constexpr uint64_t DEPTH_SAMPLE_INTERVAL_NS = 100000000;
+
+    Counter processes_spawned;
+    Counter jobs_run;
+    Counter jobs_failed;
+    Counter jobs_skipped;
+    /// Jobs that found their output up to date
+    Counter jobs_up_to_date;
+
+    Counter cache_hits;
+    Counter cache_misses_action;
+    Counter cache_misses_blob;
+    Counter cache_misses_digest;
+    Counter cache_uploads;
+
+    Counter stat_calls;
+    Counter bytes_hashed;
+    /// Depfiles read because the deps log did not have them
+    Counter depfiles_parsed;
+    Counter deps_log_hits;
+
+    /// Nanoseconds spent listing source directories
+    Counter scan_ns;
+    /// Nanoseconds spent turning builders into jobs
+    Counter plan_ns;
+    /// Nanoseconds spent in compile jobs, summed over workers
+    Counter execute_ns;
+    /// Nanoseconds spent in link jobs, summed over workers
+    Counter link_ns;
+
+    /// Number of jobs ready to run
+    Gauge queue_depth;
+
+    Clock::time_point start = Clock::now();
+
+    /**
+     * @brief Get the idle time counter of a worker thread
+     *
+     * Workers above `MAX_WORKERS` share the last counter.
+     */
+    Counter& worker_idle_ns(size_t worker) noexcept {
+        const size_t used = self.workers.load(std::memory_order_relaxed);
+        if (worker >= used) {
+            size_t current = used;
+            const size_t wanted =
+                worker < MAX_WORKERS ? worker + 1 : MAX_WORKERS;
+            while (current < wanted &&
+                   !self.workers.compare_exchange_weak(current, wanted)) {
+            }
+        }
+
+        return self.idle[worker < MAX_WORKERS ? worker : MAX_WORKERS - 1];
+    }
+
+    /**
+     * @brief Get a new id for a worker thread
+     */
+    size_t next_worker() noexcept {
+        return self.worker_ids.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Update the queue depth, sampling it at most every
+     * `DEPTH_SAMPLE_INTERVAL_NS`
+     */
+    void set_queue_depth(int64_t depth) noexcept {
+        self.queue_depth.set(depth);
+
+        const uint64_t now = nanoseconds_since(self.start);
+        uint64_t last = self.last_sample.load(std::memory_order_relaxed);
+
+        if (now - last < DEPTH_SAMPLE_INTERVAL_NS && self.samples.load() > 0) {
+            return;
+        }
+        if (!self.last_sample.compare_exchange_strong(last, now)) {
+            return;
+        }
+
+        const size_t index =
+            self.samples.fetch_add(1, std::memory_order_relaxed);
+        self.depth_samples[index % DEPTH_SAMPLES].store(
+            ((now / 1000000) << 24) | static_cast<uint64_t>(depth & 0xffffff),
+            std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Format every metric as a JSON object
+     */
+    std::string to_json() const {
+        std::ostringstream out;
+        out << "{\n";
+
+        for (const Entry& entry : self.entries()) {
+            out << "  \"" << entry.name << "\": " << entry.value << ",\n";
+        }
+
+        out << "  \"worker_idle_ns\": [";
+        for (size_t i = 0; i < self.workers.load(); ++i) {
+            out << (i == 0 ? "" : ", ") << self.idle[i].get();
+        }
+        out << "],\n";
+
+        // [milliseconds since start, depth] pairs, oldest first
+        out << "  \"queue_depth_samples\": [";
+        const size_t count = self.samples.load();
+        const size_t first = count > DEPTH_SAMPLES ? count - DEPTH_SAMPLES : 0;
+        for (size_t i = first; i < count; ++i) {
+            const uint64_t sample =
+                self.depth_samples[i % DEPTH_SAMPLES].load();
+            out << (i == first ? "" : ", ") << "[" << (sample >> 24) << ", "
+                << (sample & 0xffffff) << "]";
+        }
+        out << "]\n}\n";
+
+        return out.str();
+    }
+
+    /**
+     * @brief Format every metric in the Prometheus text exposition format
+     *
+     * Following its conventions, counters end in `_total` and durations
+     * are exported in seconds, e.g. `scan_ns` as `nobpp_scan_seconds_total`.
+     */
+    std::string to_prometheus() const {
+        std::ostringstream out;
+
+        for (const Entry& entry : self.entries()) {
+            const std::string name = prometheus_name(entry.name, entry.gauge);
+            out << "# TYPE " << name << " "
+                << (entry.gauge ? "gauge" : "counter") << "\n"
+                << name << " "
+                << prometheus_value(entry.name, entry.value) << "\n";
+        }
+
+        out << "# TYPE nobpp_worker_idle_seconds_total counter\n";
+        for (size_t i = 0; i < self.workers.load(); ++i) {
+            out << "nobpp_worker_idle_seconds_total{worker=\"" << i << "\"} "
+                << prometheus_value("idle_ns",
+                       static_cast<int64_t>(self.idle[i].get()))
+                << "\n";
+        }
+
+        return out.str();
+    }
+
+private:
+    struct Entry {
+        const char* name;
+        int64_t value;
+        bool gauge;
+    };
+
+    Registry& self = *this;
+
+    Counter idle[MAX_WORKERS];
+    std::atomic<size_t> workers{0};
+    std::atomic<size_t> worker_ids{0};
+
+    std::atomic<uint64_t> depth_samples[DEPTH_SAMPLES] = {};
+    std::atomic<size_t> samples{0};
+    std::atomic<uint64_t> last_sample{0};
+
+    static bool is_duration(const std::string& name) {
+        return name.size() > 3 &&
+               name.compare(name.size() - 3, 3, "_ns") == 0;
+    }
+
+    static std::string prometheus_name(const std::string& name, bool gauge) {
+        const std::string base =
+            is_duration(name) ? name.substr(0, name.size() - 3) + "_seconds"
+                              : name;
+        return "nobpp_" + base + (gauge ? "" : "_total");
+    }
+
+    // Durations as seconds with all nine decimals, other values unchanged
+    static std::string prometheus_value(
+        const std::string& name, int64_t value) {
+        if (!is_duration(name) || value < 0) {
+            return std::to_string(value);
+        }
+
+        const std::string fraction = std::to_string(value % 1000000000);
+        return std::to_string(value / 1000000000) + "." +
+               std::string(9 - fraction.size(), '0') + fraction;
+    }
+
+    std::vector<Entry> entries() const {
+        const auto counter = [](const char* name, const Counter& counter) {
+            return Entry{name, static_cast<int64_t>(counter.get()), false};
+        };
+
+        return {
+            counter("processes_spawned", self.processes_spawned),
+            counter("jobs_run", self.jobs_run),
+            counter("jobs_failed", self.jobs_failed),
+            counter("jobs_skipped", self.jobs_skipped),
+            counter("jobs_up_to_date", self.jobs_up_to_date),
+            counter("cache_hits", self.cache_hits),
+            counter("cache_misses_action", self.cache_misses_action),
+            counter("cache_misses_blob", self.cache_misses_blob),
+            counter("cache_misses_digest", self.cache_misses_digest),
+            counter("cache_uploads", self.cache_uploads),
+            counter("stat_calls", self.stat_calls),
+            counter("bytes_hashed", self.bytes_hashed),
+            counter("depfiles_parsed", self.depfiles_parsed),
+            counter("deps_log_hits", self.deps_log_hits),
+            counter("scan_ns", self.scan_ns),
+            counter("plan_ns", self.plan_ns),
+            counter("execute_ns", self.execute_ns),
+            counter("link_ns", self.link_ns),
+            Entry{"queue_depth", self.queue_depth.get(), true},
+            Entry{"queue_depth_max", self.queue_depth.max.load(), true},
+            Entry{"wall_ns",
+                static_cast<int64_t>(nanoseconds_since(self.start)), true},
+        };
+    }
+};
+
+/**
+ * @brief Get the registry every part of nobpp reports to
+ */
+inline Registry& global() noexcept {
+    static Registry registry;
+    return registry;
+}
+}  // namespace metrics
+
+/// Exit code of a process killed for running longer than its timeout, the
+/// one reported by coreutils `timeout`
+constexpr int TIMEOUT_EXIT_CODE = 124;
+
 #ifdef _WIN32
 
 constexpr char PATH_SEPARATOR = '\\';
@@ -254,6 +612,7 @@ public:
 
         std::wstring wcommand(self.command.begin(), self.command.end());
 
+        metrics::global().processes_spawned.add();
         BOOL create_result = CreateProcessW(nullptr,
             const_cast<wchar_t*>(wcommand.c_str()), nullptr, nullptr, FALSE, 0,
             nullptr, nullptr, &startup_info, &process_info);
@@ -278,9 +637,14 @@ private:
     std::string command = "";
 };
 
-void create_process(const std::string& command) {
+/**
+ * @brief Run a command and wait for it to finish
+ *
+ * @return exit code of the process, `-1` if it could not be started.
+ */
+int create_process(const std::string& command) {
     if (command == "") {
-        return;
+        return -1;
     }
 
     STARTUPINFOW startup_info;
@@ -293,18 +657,201 @@ void create_process(const std::string& command) {
 
     std::wstring wcommand(command.begin(), command.end());
 
+    metrics::global().processes_spawned.add();
     BOOL create_result =
         CreateProcessW(nullptr, const_cast<wchar_t*>(wcommand.c_str()), nullptr,
             nullptr, FALSE, 0, nullptr, nullptr, &startup_info, &process_info);
 
     if (!create_result) {
-        return;
+        return -1;
     }
 
     WaitForSingleObject(process_info.hProcess, INFINITE);
 
+    DWORD exit_code = 0;
+    if (!GetExitCodeProcess(process_info.hProcess, &exit_code)) {
+        exit_code = static_cast<DWORD>(-1);
+    }
+
+    CloseHandle(process_info.hProcess);
+    CloseHandle(process_info.hThread);
+
+    return static_cast<int>(exit_code);
+}
+
+/**
+ * @brief Run a command, wait for it to finish and capture what it writes to
+ * stdout and stderr
+ *
+ * @param command The command
+ * @param output Receives stdout and stderr of the process
+ * @param timeout The process and the processes it started are terminated
+ * after it, `0` for no limit
+ * @return exit code of the process, `-1` if it could not be started,
+ * `TIMEOUT_EXIT_CODE` if it was terminated
+ */
+int create_process(const std::string& command, std::string& output,
+    std::chrono::milliseconds timeout) {
+    output.clear();
+
+    if (command == "") {
+        return -1;
+    }
+
+    wchar_t temp_dir[MAX_PATH];
+    wchar_t temp_file[MAX_PATH];
+    if (GetTempPathW(MAX_PATH, temp_dir) == 0 ||
+        GetTempFileNameW(temp_dir, L"nob", 0, temp_file) == 0) {
+        return -1;
+    }
+
+    SECURITY_ATTRIBUTES attributes;
+    ZeroMemory(&attributes, sizeof(attributes));
+    attributes.nLength = sizeof(attributes);
+    attributes.bInheritHandle = TRUE;
+
+    HANDLE file = CreateFileW(temp_file, GENERIC_READ | GENERIC_WRITE,
+        FILE_SHARE_READ | FILE_SHARE_WRITE, &attributes, CREATE_ALWAYS,
+        FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE, nullptr);
+
+    if (file == INVALID_HANDLE_VALUE) {
+        return -1;
+    }
+
+    STARTUPINFOW startup_info;
+    PROCESS_INFORMATION process_info;
+
+    ZeroMemory(&startup_info, sizeof(startup_info));
+    ZeroMemory(&process_info, sizeof(process_info));
+
+    startup_info.cb = sizeof(startup_info);
+    startup_info.dwFlags = STARTF_USESTDHANDLES;
+    startup_info.hStdInput = GetStdHandle(STD_INPUT_HANDLE);
+    startup_info.hStdOutput = file;
+    startup_info.hStdError = file;
+
+    std::wstring wcommand(command.begin(), command.end());
+
+    // Terminating the job also ends the processes the command started
+    HANDLE job = CreateJobObjectW(nullptr, nullptr);
+
+    metrics::global().processes_spawned.add();
+    BOOL create_result = CreateProcessW(nullptr,
+        const_cast<wchar_t*>(wcommand.c_str()), nullptr, nullptr, TRUE,
+        CREATE_SUSPENDED, nullptr, nullptr, &startup_info, &process_info);
+
+    if (!create_result) {
+        if (job != nullptr) {
+            CloseHandle(job);
+        }
+        CloseHandle(file);
+        return -1;
+    }
+
+    if (job != nullptr &&
+        !AssignProcessToJobObject(job, process_info.hProcess)) {
+        CloseHandle(job);
+        job = nullptr;
+    }
+    ResumeThread(process_info.hThread);
+
+    const DWORD wait_ms = timeout.count() > 0
+                              ? static_cast<DWORD>(timeout.count())
+                              : INFINITE;
+    const bool timed_out =
+        WaitForSingleObject(process_info.hProcess, wait_ms) == WAIT_TIMEOUT;
+
+    if (timed_out) {
+        if (job != nullptr) {
+            TerminateJobObject(job, TIMEOUT_EXIT_CODE);
+        } else {
+            TerminateProcess(process_info.hProcess, TIMEOUT_EXIT_CODE);
+        }
+        WaitForSingleObject(process_info.hProcess, INFINITE);
+    }
+    if (job != nullptr) {
+        CloseHandle(job);
+    }
+
+    DWORD exit_code = 0;
+    if (timed_out) {
+        exit_code = TIMEOUT_EXIT_CODE;
+    } else if (!GetExitCodeProcess(process_info.hProcess, &exit_code)) {
+        exit_code = static_cast<DWORD>(-1);
+    }
+
     CloseHandle(process_info.hProcess);
     CloseHandle(process_info.hThread);
+
+    SetFilePointer(file, 0, nullptr, FILE_BEGIN);
+
+    char buffer[4096];
+    DWORD read = 0;
+    while (ReadFile(file, buffer, sizeof(buffer), &read, nullptr) && read > 0) {
+        output.append(buffer, read);
+    }
+
+    CloseHandle(file);
+
+    return static_cast<int>(exit_code);
+}
+
+/**
+ * @brief Run a command, wait for it to finish and capture what it writes to
+ * stdout and stderr
+ *
+ * @param command The command
+ * @param output Receives stdout and stderr of the process
+ * @return exit code of the process, `-1` if it could not be started.
+ */
+int create_process(const std::string& command, std::string& output) {
+    return create_process(command, output, std::chrono::milliseconds(0));
+}
+
+/**
+ * @brief Size and modification time of a file
+ */
+struct FileStat {
+    uint64_t size = 0;
+    /// Modification time in nanoseconds since an unspecified epoch
+    int64_t mtime = 0;
+    /// Identifies the file on its file system, `0` where unknown
+    uint64_t inode = 0;
+};
+
+/**
+ * @brief Convert a `FILETIME` to nanoseconds since the Unix epoch
+ *
+ * The 100 ns ticks since 1601 overflow `int64_t` once scaled, so the epoch
+ * is moved first.
+ */
+int64_t filetime_to_ns(const FILETIME& time) {
+    const uint64_t ticks =
+        (static_cast<uint64_t>(time.dwHighDateTime) << 32) |
+        time.dwLowDateTime;
+
+    return (static_cast<int64_t>(ticks) - 116444736000000000LL) * 100;
+}
+
+/**
+ * @brief Get the size and modification time of a file
+ *
+ * @return `false` if the file does not exist
+ */
+bool stat_file(const std::string& path, FileStat& info) {
+    metrics::global().stat_calls.add();
+    const std::wstring wpath(path.begin(), path.end());
+    WIN32_FILE_ATTRIBUTE_DATA data;
+
+    if (!GetFileAttributesExW(wpath.c_str(), GetFileExInfoStandard, &data)) {
+        return false;
+    }
+
+    info.size = (static_cast<uint64_t>(data.nFileSizeHigh) << 32) |
+                data.nFileSizeLow;
+    info.mtime = filetime_to_ns(data.ftLastWriteTime);
+
+    return true;
 }
 
 std::vector<std::string> readdir(const wchar_t* wtarget_dir,
@@ -427,918 +974,10850 @@ void createDirectoryRecursively(const std::string& target_dir) {
         std::wstring(target_dir.begin(), target_dir.end());
     createDirectoryRecursively(wtarget_dir);
 }
+
+/**
+ * @brief Replace `to` with `from` in one step
+ *
+ * @return `false` if the file could not be renamed
+ */
+bool rename_file(const std::string& from, const std::string& to) {
+    const std::wstring wfrom(from.begin(), from.end());
+    const std::wstring wto(to.begin(), to.end());
+
+    return MoveFileExW(wfrom.c_str(), wto.c_str(),
+               MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+}
 #else
 constexpr char PATH_SEPARATOR = '/';
 
-    #include <dirent.h>
-std::vector<std::string> readdir(std::string target) {
-    return {};
-}
+namespace details {
+/**
+ * @brief Process groups of the running children
+ *
+ * Read by the signal handler, so the slots are lock free atomics instead of
+ * a container behind a mutex. Blocks are chained when all slots are taken
+ * and never freed, so the handler can walk them at any time.
+ */
+struct ChildSlots {
+    static constexpr size_t SIZE = 1024;
 
-void run_command_sync(const std::string& command) {}
+    std::atomic<pid_t> slots[SIZE];
+    std::atomic<ChildSlots*> next{nullptr};
+};
 
-void run_command_async(const std::string& command) {}
-#endif
+inline ChildSlots* child_slots() noexcept {
+    static ChildSlots first;
+    return &first;
+}
 
-std::vector<std::string> split(
-    const std::string& str, const char delimiter) noexcept {
-    std::vector<std::string> parts;
-    std::string part;
+inline void track_child(pid_t pid) {
+    ChildSlots* block = child_slots();
 
-    for (const char c : str) {
-        if (c == delimiter) {
-            parts.push_back(part);
-            part = "";
-        } else {
-            part += c;
+    while (true) {
+        for (std::atomic<pid_t>& slot : block->slots) {
+            pid_t empty = 0;
+            if (slot.compare_exchange_strong(empty, pid)) {
+                return;
+            }
+        }
+
+        ChildSlots* next = block->next.load();
+        if (next == nullptr) {
+            ChildSlots* grown = new ChildSlots();
+            if (block->next.compare_exchange_strong(next, grown)) {
+                next = grown;
+            } else {
+                // Another thread grew the table first
+                delete grown;
+            }
         }
+        block = next;
     }
+}
 
-    parts.push_back(part);
+/// Held by a job slot once its job was cancelled, children started for
+/// the job are terminated right away then
+constexpr pid_t CANCELLED_CHILD = -1;
 
-    return parts;
+/**
+ * @brief Slot receiving the pid of the child the calling thread is running
+ *
+ * Set by the workers of `CommandQueue`, which cancels running jobs by
+ * signalling the process groups in their slots.
+ */
+inline std::atomic<pid_t>*& current_job_slot() noexcept {
+    thread_local std::atomic<pid_t>* slot = nullptr;
+    return slot;
 }
 
-std::vector<std::string> split(
-    const std::string& str, const std::string& delimiter) noexcept {
-    std::vector<std::string> parts;
-    std::string part;
-
-    for (const char c : str) {
-        if (c == delimiter[0]) {
-            parts.push_back(part);
-            part = "";
-        } else {
-            part += c;
+inline void untrack_child(pid_t pid) noexcept {
+    for (ChildSlots* block = child_slots(); block != nullptr;
+         block = block->next.load()) {
+        for (std::atomic<pid_t>& slot : block->slots) {
+            pid_t tracked = pid;
+            if (slot.compare_exchange_strong(tracked, 0)) {
+                return;
+            }
         }
     }
+}
 
-    parts.push_back(part);
+/**
+ * @brief Send a signal to the process group of every running child
+ *
+ * Async signal safe.
+ */
+inline void signal_children(int signal) noexcept {
+    for (ChildSlots* block = child_slots(); block != nullptr;
+         block = block->next.load()) {
+        for (std::atomic<pid_t>& slot : block->slots) {
+            const pid_t pid = slot.load();
+            if (pid > 0) {
+                kill(-pid, signal);
+            }
+        }
+    }
+}
 
-    return parts;
+/// Dispositions of the embedding program, indexed by signal
+inline struct sigaction* previous_actions() noexcept {
+    static struct sigaction actions[NSIG];
+    return actions;
 }
 
-std::string join(
-    const std::vector<std::string>& parts, const char delimiter) noexcept {
-    if (parts.size() == 0) {
-        return "";
-    } else if (parts.size() == 1) {
-        return parts[0];
+// Children run in their own process group and do not see the SIGINT of the
+// terminal, so their groups are terminated before the signal is handled
+// like it would have been without nobpp: by the handler of the embedding
+// program, or by dying with the default action. SIGTERM is sent as shells
+// ignore SIGINT in background jobs. Every state file is replaced
+// atomically, so dying here leaves nothing half written behind.
+inline void forward_signal(int signal, siginfo_t* info, void* context) {
+    signal_children(SIGTERM);
+
+    const struct sigaction& previous = previous_actions()[signal];
+    if (previous.sa_flags & SA_SIGINFO) {
+        previous.sa_sigaction(signal, info, context);
+        return;
+    }
+    if (previous.sa_handler != SIG_DFL) {
+        previous.sa_handler(signal);
+        return;
     }
 
-    std::string out = "";
-
-    for (size_t i = 0; i < parts.size(); ++i) {
-        out += parts[i];
+    struct sigaction action;
+    std::memset(&action, 0, sizeof(action));
+    action.sa_handler = SIG_DFL;
+    sigaction(signal, &action, nullptr);
+    raise(signal);
+}
 
-        if (i != parts.size() - 1) {
-            out += delimiter;
+inline void install_signal_handlers() {
+    static std::once_flag once;
+
+    std::call_once(once, []() {
+        struct sigaction action;
+        std::memset(&action, 0, sizeof(action));
+        action.sa_sigaction = forward_signal;
+        action.sa_flags = SA_SIGINFO;
+        sigemptyset(&action.sa_mask);
+
+        for (const int signal : {SIGINT, SIGTERM, SIGHUP}) {
+            struct sigaction& previous = previous_actions()[signal];
+            sigaction(signal, nullptr, &previous);
+
+            // Ignored signals stay ignored, by the children too
+            if (previous.sa_handler != SIG_IGN ||
+                (previous.sa_flags & SA_SIGINFO)) {
+                action.sa_flags = SA_SIGINFO | (previous.sa_flags & SA_RESTART);
+                sigaction(signal, &action, nullptr);
+            }
         }
-    }
-
-    return out;
+    });
 }
 
-std::string join(const std::vector<std::string>& parts,
-    const std::string& delimiter) noexcept {
-    if (parts.size() == 0) {
-        return "";
-    } else if (parts.size() == 1) {
-        return parts[0];
+/**
+ * @brief Directories a sandboxed child may access, everything else is
+ * denied
+ */
+struct SandboxRules {
+    /// Read and execute only
+    std::vector<std::string> read_dirs;
+    std::vector<std::string> write_dirs;
+};
+
+/**
+ * @brief Rules applied to the children spawned by the calling thread,
+ * `nullptr` for none
+ */
+inline const SandboxRules*& current_sandbox() noexcept {
+    thread_local const SandboxRules* rules = nullptr;
+    return rules;
+}
+
+/**
+ * @brief Sandbox the children spawned by the calling thread while in scope
+ */
+class SandboxScope {
+public:
+    explicit SandboxScope(const SandboxRules* rules) noexcept
+        : previous(current_sandbox()) {
+        current_sandbox() = rules;
     }
+    SandboxScope(const SandboxScope&) = delete;
+    SandboxScope& operator=(const SandboxScope&) = delete;
 
-    std::string out = "";
+    ~SandboxScope() {
+        current_sandbox() = previous;
+    }
 
-    for (size_t i = 0; i < parts.size(); ++i) {
-        out += parts[i];
+private:
+    const SandboxRules* previous;
+};
 
-        if (i != parts.size() - 1) {
-            out += delimiter;
+#if defined(__linux__) && defined(SYS_landlock_create_ruleset)
+// From <linux/landlock.h>, which older distributions do not ship
+struct LandlockRuleset {
+    uint64_t handled_access_fs;
+};
+
+struct __attribute__((packed)) LandlockPathBeneath {
+    uint64_t allowed_access;
+    int32_t parent_fd;
+};
+
+constexpr uint32_t LANDLOCK_CREATE_RULESET_VERSION = 1;
+constexpr int LANDLOCK_RULE_PATH_BENEATH = 1;
+/// Execute, read file and read directory
+constexpr uint64_t LANDLOCK_READ = 0x1 | 0x4 | 0x8;
+/// Every file system right of Landlock ABI 1
+constexpr uint64_t LANDLOCK_ALL = (uint64_t(1) << 13) - 1;
+
+/**
+ * @brief Get the Landlock ABI of the kernel, `-1` if Landlock is disabled
+ */
+inline int landlock_abi() noexcept {
+    static const int abi = static_cast<int>(syscall(SYS_landlock_create_ruleset,
+        nullptr, 0, LANDLOCK_CREATE_RULESET_VERSION));
+    return abi;
+}
+
+/**
+ * @brief Create the Landlock ruleset of `rules` before forking, closed on
+ * exec
+ *
+ * Directories that do not exist grant nothing.
+ *
+ * @return the ruleset file descriptor, `-1` on failure
+ */
+inline int create_sandbox(const SandboxRules& rules) noexcept {
+    const LandlockRuleset ruleset = {LANDLOCK_ALL};
+    const int ruleset_fd = static_cast<int>(syscall(
+        SYS_landlock_create_ruleset, &ruleset, sizeof(ruleset), 0));
+
+    if (ruleset_fd < 0) {
+        return -1;
+    }
+
+    const auto allow = [ruleset_fd](const std::string& dir,
+                           uint64_t access) noexcept {
+        const int dir_fd = open(dir.c_str(), O_PATH | O_CLOEXEC);
+
+        if (dir_fd >= 0) {
+            const LandlockPathBeneath rule = {access, dir_fd};
+            syscall(SYS_landlock_add_rule, ruleset_fd,
+                LANDLOCK_RULE_PATH_BENEATH, &rule, 0);
+            close(dir_fd);
         }
+    };
+
+    for (const std::string& dir : rules.read_dirs) {
+        allow(dir, LANDLOCK_READ);
+    }
+    for (const std::string& dir : rules.write_dirs) {
+        allow(dir, LANDLOCK_ALL);
     }
 
-    return out;
+    return ruleset_fd;
 }
 
-bool is_c_file(const std::string& path) noexcept {
-    const std::vector<std::string> parts = split(path, PATH_SEPARATOR);
+/**
+ * @brief Restrict the calling process to a ruleset of `create_sandbox`,
+ * called in the forked child
+ */
+inline bool enter_sandbox(int ruleset_fd) noexcept {
+    return ruleset_fd >= 0 && prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0) == 0 &&
+           syscall(SYS_landlock_restrict_self, ruleset_fd, 0) == 0;
+}
+#else
+inline int landlock_abi() noexcept {
+    return -1;
+}
 
-    if (parts.size() == 0) {
-        return false;
+inline int create_sandbox(const SandboxRules&) noexcept {
+    return -1;
+}
+
+inline bool enter_sandbox(int) noexcept {
+    return false;
+}
+#endif
+
+/**
+ * @brief Start `argv[0]`, looked up in `PATH`, in its own process group
+ *
+ * The child is sandboxed if `current_sandbox()` is set, and exits with
+ * `126` if the sandbox can not be applied.
+ *
+ * @param argv The program and its arguments, passed on without a shell
+ * @param output_fd Receives stdout and stderr of the child, `-1` to inherit
+ * @param slot Holds the pid until the child is reaped, `nullptr` for none.
+ * The child is terminated right away if the slot holds `CANCELLED_CHILD`.
+ * @return pid of the child, `-1` if it could not be started
+ */
+inline pid_t spawn(const std::vector<std::string>& argv, int output_fd,
+    std::atomic<pid_t>* slot = current_job_slot()) {
+    if (argv.empty()) {
+        return -1;
     }
 
-    const std::string file_name = parts[parts.size() - 1];
+    install_signal_handlers();
+    metrics::global().processes_spawned.add();
 
-    return path.find(".c") != std::string::npos;
-}
+    // The child must not allocate, other threads may hold the heap lock
+    std::vector<char*> arguments;
+    arguments.reserve(argv.size() + 1);
+    for (const std::string& argument : argv) {
+        arguments.push_back(const_cast<char*>(argument.c_str()));
+    }
+    arguments.push_back(nullptr);
 
-bool is_c_header_file(const std::string& path) noexcept {
-    const std::vector<std::string> parts = split(path, PATH_SEPARATOR);
+    const bool sandboxed = current_sandbox() != nullptr;
+    const int ruleset_fd =
+        sandboxed ? create_sandbox(*current_sandbox()) : -1;
 
-    if (parts.size() == 0) {
-        return false;
+    pid_t pid = fork();
+
+    if (ruleset_fd >= 0 && pid != 0) {
+        close(ruleset_fd);
     }
 
-    const std::string file_name = parts[parts.size() - 1];
+    if (pid < 0) {
+        return -1;
+    }
+
+    if (pid == 0) {
+        setpgid(0, 0);
+
+        if (output_fd != -1) {
+            dup2(output_fd, STDOUT_FILENO);
+            dup2(output_fd, STDERR_FILENO);
+            close(output_fd);
+        }
+
+        if (sandboxed && !enter_sandbox(ruleset_fd)) {
+            _exit(126);
+        }
+
+        execvp(arguments[0], arguments.data());
+        _exit(127);
+    }
 
-    return path.find(".h") != std::string::npos;
+    // Also set in the parent so the group exists before it is signalled
+    setpgid(pid, pid);
+    track_child(pid);
+
+    pid_t empty = 0;
+    if (slot != nullptr && !slot->compare_exchange_strong(empty, pid) &&
+        empty == CANCELLED_CHILD) {
+        kill(-pid, SIGTERM);
+    }
+
+    return pid;
 }
 
-bool is_cpp_file(const std::string& path) noexcept {
-    static const std::unordered_set<std::string> cpp_extensions = {
-        ".cpp", ".cc", ".c++", ".cxx", ".mpp", ".ipp", ".ixx", ".cppm"};
+/**
+ * @brief Start `sh -c command` in its own process group
+ *
+ * @see spawn(const std::vector<std::string>&, int, std::atomic<pid_t>*)
+ */
+inline pid_t spawn(const std::string& command, int output_fd,
+    std::atomic<pid_t>* slot = current_job_slot()) {
+    return spawn({"/bin/sh", "-c", command}, output_fd, slot);
+}
 
-    const std::vector<std::string> parts = split(path, PATH_SEPARATOR);
+/// Interval in which `collect_output` checks if the child exited
+constexpr int EXIT_POLL_MS = 100;
 
-    if (parts.size() == 0) {
-        return false;
+/**
+ * @brief Check if a child exited, without reaping it
+ */
+inline bool has_exited(pid_t pid) noexcept {
+    siginfo_t info;
+    info.si_pid = 0;
+
+    return waitid(P_PID, pid, &info, WEXITED | WNOHANG | WNOWAIT) == 0 &&
+           info.si_pid != 0;
+}
+
+/**
+ * @brief Forget a child that exited but was not reaped yet
+ *
+ * Its pid can not be reused before it is reaped, so no stale slot makes
+ * nobpp signal an unrelated process group.
+ */
+inline void release_child(pid_t pid, std::atomic<pid_t>* slot) noexcept {
+    untrack_child(pid);
+
+    if (slot != nullptr) {
+        pid_t tracked = pid;
+        slot->compare_exchange_strong(tracked, 0);
+    }
+}
+
+/**
+ * @brief Wait for a child started by `spawn`
+ *
+ * @param slot The slot passed to `spawn`
+ * @return exit code of the child, `-1` if it was killed by a signal
+ */
+inline int wait_for(
+    pid_t pid, std::atomic<pid_t>* slot = current_job_slot()) {
+    siginfo_t info;
+    while (waitid(P_PID, pid, &info, WEXITED | WNOWAIT) < 0 &&
+           errno == EINTR) {
     }
+    release_child(pid, slot);
 
-    const std::string file_name = parts[parts.size() - 1];
+    int status = 0;
+    int result = 0;
+    while ((result = waitpid(pid, &status, 0)) < 0 && errno == EINTR) {
+    }
 
-    size_t pos = file_name.rfind('.');
-    if (pos == std::string::npos)
-        return false;
-    std::string ext = file_name.substr(pos);
-    return cpp_extensions.find(ext) != cpp_extensions.end();
+    if (result < 0 || !WIFEXITED(status)) {
+        return -1;
+    }
+
+    return WEXITSTATUS(status);
 }
 
-bool is_cpp_header_file(const std::string& path) noexcept {
-    static const std::unordered_set<std::string> cpp_header_extensions = {
-        ".h", ".hh", ".hpp", ".hxx", ".h++", ".inl"};
+/**
+ * @brief Start `command` with stdout and stderr going to a pipe
+ *
+ * @param command A shell command, or the program and its arguments
+ * @param output_fd Receives the read end of the pipe
+ * @param slot See `spawn`
+ * @return pid of the child, `-1` if it could not be started
+ */
+template <typename Command>
+inline pid_t spawn_captured(
+    const Command& command, int& output_fd, std::atomic<pid_t>* slot) {
+    int pipe_fds[2];
+    if (pipe(pipe_fds) != 0) {
+        return -1;
+    }
 
-    const std::vector<std::string> parts = split(path, PATH_SEPARATOR);
+    // Children spawned by other threads must not keep the pipe open
+    fcntl(pipe_fds[0], F_SETFD, FD_CLOEXEC);
+    fcntl(pipe_fds[1], F_SETFD, FD_CLOEXEC);
 
-    if (parts.size() == 0) {
-        return false;
+    const pid_t pid = spawn(command, pipe_fds[1], slot);
+    close(pipe_fds[1]);
+
+    if (pid < 0) {
+        close(pipe_fds[0]);
+        return -1;
     }
 
-    const std::string file_name = parts[parts.size() - 1];
+    output_fd = pipe_fds[0];
+    return pid;
+}
 
-    size_t pos = file_name.rfind('.');
-    if (pos == std::string::npos)
-        return false;
-    std::string ext = file_name.substr(pos);
-    return cpp_header_extensions.find(ext) != cpp_header_extensions.end();
+/**
+ * @brief Read what a child started by `spawn_captured` writes until it
+ * closes the pipe, then wait for it
+ *
+ * Closes `output_fd`.
+ *
+ * @param timeout The process group is killed after it, `0` for no limit
+ * @param slot The slot passed to `spawn_captured`
+ * @return exit code of the child, `TIMEOUT_EXIT_CODE` if it was killed
+ */
+inline int collect_output(pid_t pid, int output_fd,
+    std::chrono::milliseconds timeout, std::string& output,
+    std::atomic<pid_t>* slot = current_job_slot()) {
+    const auto deadline = std::chrono::steady_clock::now() + timeout;
+    bool timed_out = false;
+    bool exited = false;
+
+    char buffer[4096];
+    while (true) {
+        // A grandchild that left the process group may keep the pipe open
+        // forever, so reading stops with the child once the pipe is drained
+        exited = exited || has_exited(pid);
+        int wait_ms = exited ? 0 : EXIT_POLL_MS;
+
+        if (timeout.count() > 0 && !timed_out && !exited) {
+            const auto left =
+                std::chrono::duration_cast<std::chrono::milliseconds>(
+                    deadline - std::chrono::steady_clock::now())
+                    .count();
+
+            if (left <= 0) {
+                // The whole group, so children of the command die as well
+                kill(-pid, SIGKILL);
+                timed_out = true;
+            } else if (left < wait_ms) {
+                wait_ms = static_cast<int>(left);
+            }
+        }
+
+        pollfd readable = {output_fd, POLLIN, 0};
+        const int ready = poll(&readable, 1, wait_ms);
+
+        if (ready < 0 && errno == EINTR) {
+            continue;
+        }
+        if (ready == 0) {
+            if (exited) {
+                break;
+            }
+            continue;
+        }
+
+        ssize_t received = read(output_fd, buffer, sizeof(buffer));
+
+        if (received < 0 && errno == EINTR) {
+            continue;
+        }
+        if (received <= 0) {
+            break;
+        }
+        output.append(buffer, static_cast<size_t>(received));
+    }
+
+    close(output_fd);
+
+    const int result = wait_for(pid, slot);
+
+    return timed_out ? TIMEOUT_EXIT_CODE : result;
 }
+}  // namespace details
 
-enum struct Compiler { clang, gcc };
-enum struct Language { c, cpp };
-enum struct TargetOS { windows, linux };
-enum struct OptimizationLevel { o0, o1, o2, o3, os, oz };
-enum struct Mode { debug, release };
+/**
+ * @brief Terminate the process group of every running command
+ *
+ * Children do not see the signals of the terminal. nobpp terminates them
+ * itself before calling the SIGINT, SIGTERM and SIGHUP handlers installed
+ * before its first command. Handlers installed later must call this.
+ * Async signal safe.
+ */
+inline void terminate_children() noexcept {
+    details::signal_children(SIGTERM);
+}
 
 /**
- * @brief Command Builder to create and run build commands
- * @code
- * ```cpp
- * #include "nobpp.hpp"
+ * @brief Run a command and wait for it to finish
  *
- * int main() {
- *      nobpp::CommandBuilder builder = nobpp::CommandBuilder();
+ * The command runs in its own process group, which is signalled as a whole
+ * when nobpp receives SIGINT, SIGTERM or SIGHUP.
  *
- *      builder.set_language(nobpp::Language::cpp)
- *          .set_target_os(nobpp::TargetOS::windows)
- *          .set_optimization_level(nobpp::OptimizationLevel::o3)
- *          .add_options({"-ffast-math"})
- *          .add_file("./test.cpp")
- *          .set_build_dir("./bin")
- *          .set_output("test")
- *          .run();
+ * @return exit code of the process, `-1` if it could not be started.
+ */
+int create_process(const std::string& command) {
+    if (command == "") {
+        return -1;
+    }
+
+    const pid_t pid = details::spawn(command, -1);
+
+    if (pid < 0) {
+        return -1;
+    }
+
+    return details::wait_for(pid);
+}
+
+/**
+ * @brief Run a command, wait for it to finish and capture what it writes to
+ * stdout and stderr
  *
- *      return 0;
- * }
- * ```
- * @endcode
+ * @param command The command
+ * @param output Receives stdout and stderr of the process
+ * @param timeout The process group is killed after it, `0` for no limit
+ * @return exit code of the process, `-1` if it could not be started,
+ * `TIMEOUT_EXIT_CODE` if it was killed
  */
-class CommandBuilder {
-public:
-    /**
-     * @brief Construct a new Command Builder object
-     * @return `nobpp::CommandBuilder`
-     * @code
-     * ```cpp
-     * nobpp::CommandBuilder builder = nobpp::CommandBuilder();
-     * ```
-     * @endcode
-     */
-    CommandBuilder() = default;
+int create_process(const std::string& command, std::string& output,
+    std::chrono::milliseconds timeout) {
+    output.clear();
 
-    /**
-     * @brief Set the project name
-     *
-     * @param project_name `const std::string&`
-     * @return `CommandBuilder&`
-     * @code
-     * ```cpp
-     * builder.set_project_name("Hello Project");
-     * ```
-     * @endcode
-     */
-    CommandBuilder& set_project_name(const std::string& project_name) noexcept {
-        self.project_name = project_name;
-        return self;
+    if (command == "") {
+        return -1;
     }
 
-    /**
-     * @brief Set the project name
-     *
-     * @param project_name `const char*`
-     * @return `CommandBuilder&`
-     * @code
-     * ```cpp
-     * builder.set_project_name("Hello Project");
-     * ```
-     * @endcode
-     */
-    CommandBuilder& set_project_name(const char* project_name) noexcept {
-        self.project_name = project_name;
-        return self;
+    int output_fd = -1;
+    const pid_t pid = details::spawn_captured(
+        command, output_fd, details::current_job_slot());
+
+    if (pid < 0) {
+        return -1;
     }
 
+    return details::collect_output(pid, output_fd, timeout, output);
+}
+
+/**
+ * @brief Run a command, wait for it to finish and capture what it writes to
+ * stdout and stderr
+ *
+ * @param command The command
+ * @param output Receives stdout and stderr of the process
+ * @return exit code of the process, `-1` if it could not be started.
+ */
+int create_process(const std::string& command, std::string& output) {
+    return create_process(command, output, std::chrono::milliseconds(0));
+}
+
+/// Receives the exit code and the output of a command started by
+/// `create_process_async`
+using ProcessCallback = std::function<void(int, std::string)>;
+
+namespace details {
+#ifdef __linux__
+/**
+ * @brief One thread waiting for every asynchronous child at once
+ *
+ * epoll watches the pidfd and the output pipe of each child, and wakes up
+ * for the earliest deadline. Kernels before 5.3 have no `pidfd_open`, the
+ * children are then checked every 10 ms. Like `collect_output`, reading
+ * stops once the child exited and the pipe is drained, even if a grandchild
+ * keeps it open.
+ */
+class ProcessLoop {
+public:
     /**
-     * @brief Set the compiler
-     *
-     * @param compiler `nobpp::Compiler`
-     * @return `CommandBuilder&`
-     * @code
-     * ```cpp
-     * builder.set_compiler(nobpp::Compiler::clang);
-     * ```
-     * @endcode
+     * @brief Get the loop, its thread starts on first use
      */
-    CommandBuilder& set_compiler(Compiler compiler) noexcept {
-        self.compiler = compiler;
-        return self;
+    static ProcessLoop& get() {
+        // Never destroyed, children may still finish during static
+        // destruction
+        static ProcessLoop* loop = new ProcessLoop();
+        return *loop;
     }
 
     /**
-     * @brief Set the language of the source files
-     *
-     * @param language `nobpp::Language::cpp` or `nobpp::Language::c`
-     * @return `nobpp::CommandBuilder&`
-     * @code
-     * ```cpp
-     * builder.set_language(nobpp::Language::cpp);
-     * ```
-     * @endcode
+     * @brief `false` if epoll could not be set up or failed
      */
-    CommandBuilder& set_language(Language language) noexcept {
-        self.language = language;
-        return self;
+    bool usable() const noexcept {
+        return self.epoll_fd >= 0 && self.wake_fd >= 0 && !self.stopped;
     }
 
     /**
-     * @brief Set the target operating system
+     * @brief Collect the output of a child started by `spawn_captured` and
+     * call `done` on the loop thread once it exited
      *
-     * @param os `nobpp::TargetOS::windows` or `nobpp::TargetOS::linux`
-     * @return `nobpp::CommandBuilder&`
-     * @code
+     * @return `false` if the loop stopped, the child is not watched then
+     */
+    bool watch(pid_t pid, int output_fd, std::chrono::milliseconds timeout,
+        ProcessCallback done, std::atomic<pid_t>* slot) {
+        std::shared_ptr<Child> child(new Child());
+        child->pid = pid;
+        child->slot = slot;
+        child->output_fd = output_fd;
+#ifdef SYS_pidfd_open
+        child->pidfd = static_cast<int>(syscall(SYS_pidfd_open, pid, 0));
+#endif
+        child->has_deadline = timeout.count() > 0;
+        child->deadline = std::chrono::steady_clock::now() + timeout;
+        child->done = std::move(done);
+
+        {
+            std::lock_guard<std::mutex> lock(self.mutex);
+            if (self.stopped) {
+                if (child->pidfd >= 0) {
+                    close(child->pidfd);
+                }
+                return false;
+            }
+
+            fcntl(output_fd, F_SETFL, fcntl(output_fd, F_GETFL) | O_NONBLOCK);
+            self.children.push_back(child);
+            self.add_fd(output_fd, child);
+            if (child->pidfd >= 0) {
+                fcntl(child->pidfd, F_SETFD, FD_CLOEXEC);
+                self.add_fd(child->pidfd, child);
+            }
+        }
+
+        // The loop may be sleeping past the new deadline
+        const uint64_t one = 1;
+        while (write(self.wake_fd, &one, sizeof(one)) < 0 && errno == EINTR) {
+        }
+        return true;
+    }
+
+private:
+    struct Child {
+        pid_t pid = 0;
+        std::atomic<pid_t>* slot = nullptr;
+        int output_fd = -1;
+        int pidfd = -1;
+        bool has_deadline = false;
+        bool timed_out = false;
+        bool exited = false;
+        int exit_code = -1;
+        std::chrono::steady_clock::time_point deadline;
+        std::string output;
+        ProcessCallback done;
+    };
+
+    static constexpr int MAX_EVENTS = 64;
+    static constexpr int NO_PIDFD_POLL_MS = 10;
+
+    ProcessLoop& self = *this;
+
+    int epoll_fd = -1;
+    int wake_fd = -1;
+    /// `epoll_wait` failed, set with `mutex` held
+    std::atomic<bool> stopped{false};
+    std::mutex mutex;
+    std::vector<std::shared_ptr<Child>> children;
+    std::unordered_map<int, std::shared_ptr<Child>> by_fd;
+
+    ProcessLoop() {
+        self.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        self.wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+
+        if (!self.usable()) {
+            return;
+        }
+
+        epoll_event event = {};
+        event.events = EPOLLIN;
+        event.data.fd = self.wake_fd;
+        epoll_ctl(self.epoll_fd, EPOLL_CTL_ADD, self.wake_fd, &event);
+
+        std::thread([this]() { this->run(); }).detach();
+    }
+
+    /// `mutex` must be held
+    void add_fd(int fd, const std::shared_ptr<Child>& child) {
+        epoll_event event = {};
+        event.events = EPOLLIN;
+        event.data.fd = fd;
+        epoll_ctl(self.epoll_fd, EPOLL_CTL_ADD, fd, &event);
+        self.by_fd[fd] = child;
+    }
+
+    /// `mutex` must be held
+    void remove_fd(int& fd) {
+        epoll_ctl(self.epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+        self.by_fd.erase(fd);
+        close(fd);
+        fd = -1;
+    }
+
+    /// Read what is available, `mutex` must be held
+    void read_output(Child& child) {
+        char buffer[4096];
+
+        while (true) {
+            const ssize_t received =
+                read(child.output_fd, buffer, sizeof(buffer));
+
+            if (received > 0) {
+                child.output.append(buffer, static_cast<size_t>(received));
+            } else if (received < 0 && errno == EINTR) {
+                continue;
+            } else if (received < 0 && errno == EAGAIN) {
+                return;
+            } else {
+                self.remove_fd(child.output_fd);
+                return;
+            }
+        }
+    }
+
+    /// Reap the child if it exited, `mutex` must be held
+    void reap(Child& child) {
+        siginfo_t info;
+        info.si_pid = 0;
+        int result = 0;
+
+        while ((result = waitid(P_PID, child.pid, &info,
+                    WEXITED | WNOHANG | WNOWAIT)) < 0 &&
+               errno == EINTR) {
+        }
+
+        if (result == 0 && info.si_pid == 0) {
+            return;
+        }
+        release_child(child.pid, child.slot);
+
+        int status = 0;
+        while ((result = waitpid(child.pid, &status, 0)) < 0 &&
+               errno == EINTR) {
+        }
+
+        child.exited = true;
+        child.exit_code =
+            result > 0 && WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+
+        if (child.pidfd >= 0) {
+            self.remove_fd(child.pidfd);
+        }
+
+        // A grandchild that left the process group may keep the pipe open
+        // forever, what the child wrote is already in it
+        if (child.output_fd >= 0) {
+            self.read_output(child);
+        }
+        if (child.output_fd >= 0) {
+            self.remove_fd(child.output_fd);
+        }
+    }
+
+    /// Milliseconds until something has to be checked, `mutex` must be held
+    int next_wait_ms() const {
+        const auto now = std::chrono::steady_clock::now();
+        int64_t wait_ms = -1;
+
+        for (const std::shared_ptr<Child>& child : self.children) {
+            int64_t child_ms = -1;
+
+            if (child->pidfd < 0) {
+                child_ms = NO_PIDFD_POLL_MS;
+            } else if (child->has_deadline && !child->timed_out) {
+                child_ms = std::max<int64_t>(0,
+                    std::chrono::duration_cast<std::chrono::milliseconds>(
+                        child->deadline - now)
+                            .count() +
+                        1);
+            }
+
+            if (child_ms >= 0 && (wait_ms < 0 || child_ms < wait_ms)) {
+                wait_ms = child_ms;
+            }
+        }
+
+        return static_cast<int>(std::min<int64_t>(wait_ms, 60000));
+    }
+
+    void run() {
+        epoll_event events[MAX_EVENTS];
+        int wait_ms = -1;
+
+        while (true) {
+            const int count =
+                epoll_wait(self.epoll_fd, events, MAX_EVENTS, wait_ms);
+
+            if (count < 0 && errno != EINTR) {
+                self.stop(errno);
+                return;
+            }
+
+            std::vector<std::shared_ptr<Child>> finished;
+            {
+                std::lock_guard<std::mutex> lock(self.mutex);
+
+                for (int i = 0; i < count; ++i) {
+                    const int fd = events[i].data.fd;
+
+                    if (fd == self.wake_fd) {
+                        uint64_t wakes = 0;
+                        while (read(fd, &wakes, sizeof(wakes)) > 0) {
+                        }
+                        continue;
+                    }
+
+                    auto found = self.by_fd.find(fd);
+                    if (found == self.by_fd.end()) {
+                        continue;
+                    }
+
+                    const std::shared_ptr<Child> child = found->second;
+                    if (fd == child->output_fd) {
+                        self.read_output(*child);
+                    } else {
+                        self.reap(*child);
+                    }
+                }
+
+                const auto now = std::chrono::steady_clock::now();
+                for (size_t i = 0; i < self.children.size();) {
+                    Child& child = *self.children[i];
+
+                    if (child.has_deadline && !child.timed_out &&
+                        !child.exited && now >= child.deadline) {
+                        // The whole group, so children of the command die
+                        // as well
+                        kill(-child.pid, SIGKILL);
+                        child.timed_out = true;
+                    }
+
+                    if (!child.exited && child.pidfd < 0) {
+                        self.reap(child);
+                    }
+
+                    if (child.exited && child.output_fd < 0) {
+                        finished.push_back(self.children[i]);
+                        self.children[i] = self.children.back();
+                        self.children.pop_back();
+                    } else {
+                        ++i;
+                    }
+                }
+
+                wait_ms = self.next_wait_ms();
+            }
+
+            for (const std::shared_ptr<Child>& child : finished) {
+                child->done(child->timed_out ? TIMEOUT_EXIT_CODE
+                                             : child->exit_code,
+                    std::move(child->output));
+            }
+        }
+    }
+
+    /**
+     * @brief Kill and fail every watched child after `epoll_wait` failed,
+     * later children get a thread each
+     */
+    void stop(int error) {
+        std::vector<std::shared_ptr<Child>> pending;
+        {
+            std::lock_guard<std::mutex> lock(self.mutex);
+            self.stopped = true;
+            pending.swap(self.children);
+
+            for (const std::shared_ptr<Child>& child : pending) {
+                if (child->output_fd >= 0) {
+                    self.remove_fd(child->output_fd);
+                }
+                if (child->pidfd >= 0) {
+                    self.remove_fd(child->pidfd);
+                }
+            }
+        }
+
+        const std::string message =
+            std::string("Waiting for the command failed: ") +
+            std::strerror(error) + "\n";
+
+        for (const std::shared_ptr<Child>& child : pending) {
+            if (!child->exited) {
+                kill(-child->pid, SIGKILL);
+                wait_for(child->pid, child->slot);
+            }
+            child->done(-1, child->output + message);
+        }
+    }
+};
+#endif
+
+/**
+ * @brief `create_process_async` keeping the pid in `slot` until the child
+ * is reaped, see `spawn`
+ */
+inline pid_t start_process_async(const std::string& command,
+    std::chrono::milliseconds timeout, ProcessCallback done,
+    std::atomic<pid_t>* slot) {
+    if (command == "") {
+        return -1;
+    }
+
+    int output_fd = -1;
+    const pid_t pid = spawn_captured(command, output_fd, slot);
+
+    if (pid < 0) {
+        return -1;
+    }
+
+#ifdef __linux__
+    ProcessLoop& loop = ProcessLoop::get();
+    if (loop.usable() && loop.watch(pid, output_fd, timeout, done, slot)) {
+        return pid;
+    }
+#endif
+
+    std::thread([pid, output_fd, timeout, done, slot]() {
+        std::string output;
+        const int result =
+            collect_output(pid, output_fd, timeout, output, slot);
+        done(result, std::move(output));
+    }).detach();
+
+    return pid;
+}
+}  // namespace details
+
+/**
+ * @brief Start a command without waiting for it
+ *
+ * What the command writes to stdout and stderr is captured. On Linux one
+ * thread waits for every such command through epoll, elsewhere each
+ * command gets a thread. `done` runs on that thread, so it should return
+ * quickly and must not throw.
+ *
+ * @param command The command
+ * @param timeout The process group is killed after it, `0` for no limit
+ * @param done Receives the exit code, `-1` if the command was killed by a
+ * signal and `TIMEOUT_EXIT_CODE` if it timed out, and the output
+ * @return process group of the command, `-1` if it could not be started,
+ * `done` is not called then
+ * @code
+ * ```cpp
+ * nobpp::create_process_async("./bin/tests", std::chrono::seconds(60),
+ *     [](int exit_code, std::string output) {
+ *         std::cout << "tests exited with " << exit_code << "\n" << output;
+ *     });
+ * ```
+ * @endcode
+ */
+pid_t create_process_async(const std::string& command,
+    std::chrono::milliseconds timeout, ProcessCallback done) {
+    return details::start_process_async(
+        command, timeout, std::move(done), nullptr);
+}
+
+/**
+ * @brief Replace `to` with `from` in one step
+ *
+ * @return `false` if the file could not be renamed
+ */
+bool rename_file(const std::string& from, const std::string& to) {
+    return std::rename(from.c_str(), to.c_str()) == 0;
+}
+
+/**
+ * @brief Size and modification time of a file
+ */
+struct FileStat {
+    uint64_t size = 0;
+    /// Modification time in nanoseconds since an unspecified epoch
+    int64_t mtime = 0;
+    /// Identifies the file on its file system, `0` where unknown
+    uint64_t inode = 0;
+};
+
+/**
+ * @brief Get the size and modification time of a file
+ *
+ * @return `false` if the file does not exist
+ */
+bool stat_file(const std::string& path, FileStat& info) {
+    metrics::global().stat_calls.add();
+    struct stat data;
+
+    if (stat(path.c_str(), &data) != 0) {
+        return false;
+    }
+
+    info.size = static_cast<uint64_t>(data.st_size);
+    info.mtime = static_cast<int64_t>(data.st_mtim.tv_sec) * 1000000000 +
+                 data.st_mtim.tv_nsec;
+    info.inode = static_cast<uint64_t>(data.st_ino);
+
+    return true;
+}
+
+class Process {
+public:
+    Process() = default;
+    Process(const char* command) : command(command) {}
+    Process(const std::string& command) : command(command) {}
+    Process(const Process&) = delete;
+    Process& operator=(const Process&) = delete;
+
+    void set_command(const std::string& command) noexcept {
+        self.command = command;
+    }
+
+    /**
+     * @brief run process
+     *
+     * @return `false` if error occured.
+     * @return `true` if successfully ran the command.
+     */
+    bool run() {
+        if (self.command == "") {
+            return false;
+        }
+
+        const int exit_code = create_process(self.command);
+        self.command = "";
+
+        return exit_code != -1;
+    }
+
+private:
+    Process& self = *this;
+
+    std::string command = "";
+};
+
+namespace details {
+/// Directories listed so far by device and inode, so symlink loops end
+using VisitedDirs = std::set<std::pair<dev_t, ino_t>>;
+
+void readdir(const std::string& target_dir,
+    const std::function<bool(const std::string&)>& file_predicate,
+    bool recursive, VisitedDirs& visited, std::vector<std::string>& files) {
+    DIR* dir = opendir(target_dir.c_str());
+
+    if (dir == nullptr) {
+        std::cerr << "Could not open directory " << target_dir << ": "
+                  << std::strerror(errno) << "\n";
+        return;
+    }
+
+    while (struct dirent* entry = ::readdir(dir)) {
+        const std::string name = entry->d_name;
+
+        if (name == "." || name == "..") {
+            continue;
+        }
+
+        const std::string path = target_dir + PATH_SEPARATOR + name;
+
+        struct stat info;
+        metrics::global().stat_calls.add();
+        if (stat(path.c_str(), &info) != 0) {
+            continue;
+        }
+
+        if (S_ISDIR(info.st_mode)) {
+            if (recursive &&
+                visited.insert({info.st_dev, info.st_ino}).second) {
+                readdir(path, file_predicate, recursive, visited, files);
+            }
+            continue;
+        }
+
+        if (file_predicate(name)) {
+            files.push_back(path);
+        }
+    }
+
+    closedir(dir);
+}
+}  // namespace details
+
+/**
+ * @brief List the files of a directory
+ *
+ * Symlinked directories are followed, each directory is listed once so
+ * symlink loops end.
+ *
+ * @param target_dir The directory
+ * @param file_predicate Selects files by name
+ * @param recursive List subdirectories too
+ * @return the paths of the selected files
+ */
+std::vector<std::string> readdir(const std::string& target_dir,
+    std::function<bool(const std::string&)> file_predicate, bool recursive) {
+    std::vector<std::string> files;
+    details::VisitedDirs visited;
+
+    struct stat info;
+    metrics::global().stat_calls.add();
+    if (stat(target_dir.c_str(), &info) == 0) {
+        visited.insert({info.st_dev, info.st_ino});
+    }
+
+    details::readdir(target_dir, file_predicate, recursive, visited, files);
+
+    return files;
+}
+
+bool dir_exists(const std::string& target_dir) {
+    struct stat info;
+
+    return stat(target_dir.c_str(), &info) == 0 && S_ISDIR(info.st_mode);
+}
+
+void createDirectoryRecursively(const std::string& target_dir) {
+    struct stat info;
+
+    if (stat(target_dir.c_str(), &info) == 0) {
+        if (!S_ISDIR(info.st_mode)) {
+            throw std::runtime_error(
+                "Could not create directory because a file with the same name "
+                "exists");
+        }
+        return;
+    }
+
+    std::size_t slashIndex = target_dir.find_last_of('/');
+    if (slashIndex != std::string::npos && slashIndex != 0) {
+        createDirectoryRecursively(target_dir.substr(0, slashIndex));
+    }
+
+    if (mkdir(target_dir.c_str(), 0755) != 0 && errno != EEXIST) {
+        throw std::runtime_error("Could not create directory");
+    }
+}
+#endif
+
+/**
+ * @brief Read a whole file into `content`
+ *
+ * @return `false` if the file could not be opened.
+ */
+bool read_file(const std::string& path, std::string& content) {
+    std::ifstream file(path, std::ios::binary);
+
+    if (!file) {
+        return false;
+    }
+
+    std::ostringstream stream;
+    stream << file.rdbuf();
+    content = stream.str();
+
+    return true;
+}
+
+/**
+ * @brief Read only view of a whole file
+ *
+ * The file is mapped into memory on POSIX, so reading it does not copy it.
+ * On Windows it is read into a buffer.
+ */
+class MappedFile {
+public:
+    /**
+     * @brief Open and map a file, see `is_open`
+     */
+    explicit MappedFile(const std::string& path) {
+#ifdef _WIN32
+        self.opened = read_file(path, self.buffer);
+        self.bytes = self.buffer.data();
+        self.length = self.buffer.size();
+#else
+        const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            return;
+        }
+
+        struct stat info;
+        if (fstat(fd, &info) == 0) {
+            self.opened = true;
+            self.length = static_cast<size_t>(info.st_size);
+        }
+
+        // Empty files can not be mapped
+        if (self.opened && self.length > 0) {
+            void* mapping =
+                mmap(nullptr, self.length, PROT_READ, MAP_PRIVATE, fd, 0);
+
+            if (mapping == MAP_FAILED) {
+                self.opened = false;
+                self.length = 0;
+            } else {
+                self.mapping = mapping;
+                self.bytes = static_cast<const char*>(mapping);
+            }
+        }
+
+        close(fd);
+#endif
+    }
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile() {
+#ifndef _WIN32
+        if (self.mapping != nullptr) {
+            munmap(self.mapping, self.length);
+        }
+#endif
+    }
+
+    /**
+     * @brief `false` if the file could not be read
+     */
+    bool is_open() const noexcept {
+        return self.opened;
+    }
+
+    const char* data() const noexcept {
+        return self.bytes;
+    }
+
+    size_t size() const noexcept {
+        return self.length;
+    }
+
+private:
+    MappedFile& self = *this;
+
+    bool opened = false;
+    const char* bytes = "";
+    size_t length = 0;
+#ifdef _WIN32
+    std::string buffer;
+#else
+    void* mapping = nullptr;
+#endif
+};
+
+/**
+ * @brief Get a unique temporary path next to `path`, so it can be renamed
+ * over `path` without crossing file systems
+ */
+std::string temporary_path(const std::string& path) {
+    return path + "." + nanoid::generate(8) + ".tmp";
+}
+
+/**
+ * @brief Replace `path` with `temporary` if `ok`, remove `temporary`
+ * otherwise
+ *
+ * @return `true` if `path` was replaced
+ */
+bool commit_file(bool ok, const std::string& temporary,
+    const std::string& path) {
+    if (ok && rename_file(temporary, path)) {
+        return true;
+    }
+
+    std::remove(temporary.c_str());
+    return false;
+}
+
+/**
+ * @brief Write `content` to a file, replacing it if it exists
+ *
+ * The content is written to a temporary file that is renamed over `path`,
+ * so readers and interrupted builds never see a partially written file.
+ *
+ * @return `false` if the file could not be written.
+ */
+bool write_file(const std::string& path, const std::string& content) {
+    const std::string temporary = temporary_path(path);
+    bool ok = false;
+    {
+        std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+
+        if (!file) {
+            return false;
+        }
+
+        file.write(
+            content.data(), static_cast<std::streamsize>(content.size()));
+        file.close();
+        ok = static_cast<bool>(file);
+    }
+
+    return commit_file(ok, temporary, path);
+}
+
+/**
+ * @brief Write `content` to a file unless it already has exactly this
+ * content, so its modification time only changes with its content
+ *
+ * @return `false` if the file could not be written.
+ */
+bool write_file_if_changed(
+    const std::string& path, const std::string& content) {
+    std::string current;
+
+    if (read_file(path, current) && current == content) {
+        return true;
+    }
+
+    return write_file(path, content);
+}
+
+/**
+ * @brief Create the parent directory of `path` if it does not exist
+ */
+void create_parent_dir(const std::string& path) {
+    std::size_t slash = path.find_last_of("/\\");
+
+    if (slash == std::string::npos || slash == 0) {
+        return;
+    }
+
+    const std::string parent = path.substr(0, slash);
+
+    if (!dir_exists(parent)) {
+        createDirectoryRecursively(parent);
+    }
+}
+
+/**
+ * @brief Get the size of a file
+ *
+ * @return size in bytes, `0` if the file does not exist
+ */
+uint64_t file_size(const std::string& path) {
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+
+    if (!file) {
+        return 0;
+    }
+
+    return static_cast<uint64_t>(file.tellg());
+}
+
+/**
+ * @brief Remembers `stat_file` results, so headers shared by many
+ * translation units are only looked up once
+ *
+ * Not thread safe, and only valid while no file changes.
+ */
+class StatCache {
+public:
+    StatCache() = default;
+    StatCache(const StatCache&) = delete;
+    StatCache& operator=(const StatCache&) = delete;
+
+    /**
+     * @brief Like `stat_file`
+     *
+     * @return `false` if the file does not exist
+     */
+    bool stat(const std::string& path, FileStat& info) {
+        auto found = self.entries.find(path);
+
+        if (found == self.entries.end()) {
+            Entry entry;
+            entry.exists = stat_file(path, entry.info);
+            found = self.entries.emplace(path, entry).first;
+        }
+
+        info = found->second.info;
+        return found->second.exists;
+    }
+
+private:
+    struct Entry {
+        bool exists = false;
+        FileStat info;
+    };
+
+    StatCache& self = *this;
+
+    std::unordered_map<std::string, Entry> entries;
+};
+
+/**
+ * @brief Non owning view of a part of a string
+ *
+ * Returned by the allocation free helpers below. The viewed string must
+ * outlive the slice.
+ */
+struct Slice {
+    const char* data = nullptr;
+    size_t size = 0;
+
+    std::string to_string() const {
+        return std::string(data, size);
+    }
+
+    bool operator==(const Slice& other) const noexcept {
+        return size == other.size &&
+               (size == 0 || std::memcmp(data, other.data, size) == 0);
+    }
+
+    bool operator!=(const Slice& other) const noexcept {
+        return !(*this == other);
+    }
+
+#if __cplusplus >= 201703L
+    operator std::string_view() const noexcept {
+        return std::string_view(data, size);
+    }
+#endif
+};
+
+/**
+ * @brief Iterator over the parts of a string separated by a delimiter,
+ * never allocates
+ */
+class SplitIterator {
+public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = Slice;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const Slice*;
+    using reference = const Slice&;
+
+    /**
+     * @brief Construct the end iterator
+     */
+    SplitIterator() = default;
+
+    SplitIterator(const char* str, size_t size, char delimiter) noexcept
+        : end(str + size), delimiter(delimiter) {
+        self.find_part(str);
+    }
+
+    SplitIterator(const SplitIterator& other) noexcept
+        : part(other.part), end(other.end), delimiter(other.delimiter) {}
+
+    SplitIterator& operator=(const SplitIterator& other) noexcept {
+        self.part = other.part;
+        self.end = other.end;
+        self.delimiter = other.delimiter;
+        return self;
+    }
+
+    reference operator*() const noexcept {
+        return self.part;
+    }
+
+    pointer operator->() const noexcept {
+        return &self.part;
+    }
+
+    SplitIterator& operator++() noexcept {
+        const char* part_end = self.part.data + self.part.size;
+
+        if (part_end == self.end) {
+            self.part = Slice();
+        } else {
+            self.find_part(part_end + 1);
+        }
+
+        return self;
+    }
+
+    SplitIterator operator++(int) noexcept {
+        SplitIterator previous(self);
+        ++self;
+        return previous;
+    }
+
+    bool operator==(const SplitIterator& other) const noexcept {
+        return self.part.data == other.part.data &&
+               self.part.size == other.part.size;
+    }
+
+    bool operator!=(const SplitIterator& other) const noexcept {
+        return !(self == other);
+    }
+
+private:
+    SplitIterator& self = *this;
+
+    Slice part;
+    const char* end = nullptr;
+    char delimiter = '\0';
+
+    void find_part(const char* begin) noexcept {
+        const void* found = std::memchr(begin, self.delimiter,
+            static_cast<size_t>(self.end - begin));
+        const char* part_end =
+            found == nullptr ? self.end : static_cast<const char*>(found);
+
+        self.part.data = begin;
+        self.part.size = static_cast<size_t>(part_end - begin);
+    }
+};
+
+/**
+ * @brief Range of the parts of a string, see `split_view`
+ */
+struct SplitRange {
+    SplitIterator first;
+
+    SplitIterator begin() const noexcept {
+        return first;
+    }
+
+    SplitIterator end() const noexcept {
+        return SplitIterator();
+    }
+};
+
+/**
+ * @brief Split a string without allocating, yields the same parts as
+ * `split`, including empty ones
+ *
+ * @param str The string, must outlive the range
+ * @param delimiter The delimiter
+ * @return `SplitRange`
+ * @code
+ * ```cpp
+ * for (nobpp::Slice part : nobpp::split_view(path, '/')) {
+ *     // ...
+ * }
+ * ```
+ * @endcode
+ */
+SplitRange split_view(const std::string& str, const char delimiter) noexcept {
+    return SplitRange{SplitIterator(str.data(), str.size(), delimiter)};
+}
+
+std::vector<std::string> split(
+    const std::string& str, const char delimiter) noexcept {
+    std::vector<std::string> parts;
+
+    for (const Slice part : split_view(str, delimiter)) {
+        parts.emplace_back(part.data, part.size);
+    }
+
+    return parts;
+}
+
+std::vector<std::string> split(
+    const std::string& str, const std::string& delimiter) noexcept {
+    return split(str, delimiter[0]);
+}
+
+std::string join(const std::vector<std::string>& parts,
+    const std::string& delimiter) noexcept {
+    if (parts.size() == 0) {
+        return "";
+    } else if (parts.size() == 1) {
+        return parts[0];
+    }
+
+    size_t size = delimiter.size() * (parts.size() - 1);
+    for (const std::string& part : parts) {
+        size += part.size();
+    }
+
+    std::string out;
+    out.reserve(size);
+
+    for (size_t i = 0; i < parts.size(); ++i) {
+        out += parts[i];
+
+        if (i != parts.size() - 1) {
+            out += delimiter;
+        }
+    }
+
+    return out;
+}
+
+std::string join(
+    const std::vector<std::string>& parts, const char delimiter) noexcept {
+    return join(parts, std::string(1, delimiter));
+}
+
+/**
+ * @brief Get the current working directory, empty if it can not be read
+ */
+std::string current_dir() {
+    char buffer[4096];
+
+#ifdef _WIN32
+    const DWORD size = GetCurrentDirectoryA(sizeof(buffer), buffer);
+    if (size == 0 || size >= sizeof(buffer)) {
+        return "";
+    }
+    std::string dir(buffer, size);
+    std::replace(dir.begin(), dir.end(), '\\', '/');
+    return dir;
+#else
+    return getcwd(buffer, sizeof(buffer)) != nullptr ? buffer : "";
+#endif
+}
+
+/**
+ * @brief Make a path absolute and remove `.`, `..` and repeated separators
+ * without touching the file system
+ *
+ * @param path The path, `\` is accepted as separator
+ * @param base The directory relative paths are relative to
+ * @return the path with `/` as separator
+ * @code
+ * ```cpp
+ * nobpp::absolute_path("../include/./a.h", "/src/app"); // /src/include/a.h
+ * ```
+ * @endcode
+ */
+std::string absolute_path(const std::string& path, const std::string& base) {
+    std::string full = path;
+    std::replace(full.begin(), full.end(), '\\', '/');
+
+    const bool absolute = (!full.empty() && full[0] == '/') ||
+                          (full.size() > 1 && full[1] == ':');
+    if (!absolute) {
+        full = base + "/" + full;
+        std::replace(full.begin(), full.end(), '\\', '/');
+    }
+
+    std::vector<std::string> parts;
+    for (const std::string& part : split(full, '/')) {
+        if (part == "" || part == ".") {
+            continue;
+        }
+        if (part == "..") {
+            if (!parts.empty() && parts.back().find(':') == std::string::npos) {
+                parts.pop_back();
+            }
+            continue;
+        }
+        parts.push_back(part);
+    }
+
+    const bool drive = !parts.empty() && parts[0].size() == 2 &&
+                       parts[0][1] == ':';
+    return (drive ? "" : "/") + join(parts, '/');
+}
+
+/**
+ * @brief Get the directory of a path with `/` as separator
+ *
+ * @return `/` for files in the root directory, `.` for bare file names
+ */
+std::string parent_dir(const std::string& path) {
+    const size_t slash = path.find_last_of('/');
+
+    if (slash == std::string::npos) {
+        return ".";
+    }
+
+    return slash == 0 ? "/" : path.substr(0, slash);
+}
+
+/**
+ * @brief Get the file name of a path, accepts both `/` and `\` as separator
+ *
+ * @return `Slice` into `path`
+ */
+Slice file_name_of(const char* path, size_t size) noexcept {
+    size_t begin = size;
+
+    while (begin > 0 && path[begin - 1] != '/' && path[begin - 1] != '\\') {
+        --begin;
+    }
+
+    return Slice{path + begin, size - begin};
+}
+
+/**
+ * @brief Get the extension of the file name of a path, including the dot
+ *
+ * @return `Slice` into `path`, empty if the file name has no extension
+ */
+Slice extension_of(const char* path, size_t size) noexcept {
+    const Slice name = file_name_of(path, size);
+    size_t dot = name.size;
+
+    while (dot > 0 && name.data[dot - 1] != '.') {
+        --dot;
+    }
+
+    if (dot == 0) {
+        return Slice{name.data + name.size, 0};
+    }
+
+    return Slice{name.data + dot - 1, name.size - dot + 1};
+}
+
+namespace details {
+/**
+ * @brief Pack an extension of up to 8 characters into an integer so it can
+ * be used as a `case` label, longer extensions give `0`
+ */
+constexpr uint64_t extension_key(const char* ext, size_t size) noexcept {
+    uint64_t key = 0;
+
+    if (size > 8) {
+        return 0;
+    }
+
+    for (size_t i = 0; i < size; ++i) {
+        key |= static_cast<uint64_t>(static_cast<unsigned char>(ext[i]))
+               << (i * 8);
+    }
+
+    return key;
+}
+
+template <size_t N>
+constexpr uint64_t extension_key(const char (&ext)[N]) noexcept {
+    return extension_key(ext, N - 1);
+}
+
+inline uint64_t extension_key(const std::string& path) noexcept {
+    const Slice ext = extension_of(path.data(), path.size());
+    return extension_key(ext.data, ext.size);
+}
+}  // namespace details
+
+bool is_c_file(const std::string& path) noexcept {
+    return details::extension_key(path) == details::extension_key(".c");
+}
+
+bool is_c_header_file(const std::string& path) noexcept {
+    return details::extension_key(path) == details::extension_key(".h");
+}
+
+bool is_cpp_file(const std::string& path) noexcept {
+    switch (details::extension_key(path)) {
+        case details::extension_key(".cpp"):
+        case details::extension_key(".cc"):
+        case details::extension_key(".c++"):
+        case details::extension_key(".cxx"):
+        case details::extension_key(".mpp"):
+        case details::extension_key(".ipp"):
+        case details::extension_key(".ixx"):
+        case details::extension_key(".cppm"):
+            return true;
+        default:
+            return false;
+    }
+}
+
+bool is_cpp_header_file(const std::string& path) noexcept {
+    switch (details::extension_key(path)) {
+        case details::extension_key(".h"):
+        case details::extension_key(".hh"):
+        case details::extension_key(".hpp"):
+        case details::extension_key(".hxx"):
+        case details::extension_key(".h++"):
+        case details::extension_key(".inl"):
+            return true;
+        default:
+            return false;
+    }
+}
+
+/**
+ * @brief Quote an argument so that a compiler reading it back from a
+ * response file sees it unchanged
+ *
+ * Windows tools tokenize response files like `CreateProcessW` does, where
+ * backslashes are literal unless they come before a quote. Runs of
+ * backslashes before a quote, or before the closing quote, are doubled
+ * there, so `C:\SDK\` does not escape the quote that ends it.
+ */
+std::string quote_response_argument(const std::string& argument) {
+    if (argument != "" &&
+        argument.find_first_of(" \t\r\n\"'\\") == std::string::npos) {
+        return argument;
+    }
+
+    std::string out = "\"";
+#ifdef _WIN32
+    size_t backslashes = 0;
+    for (const char c : argument) {
+        if (c == '\\') {
+            ++backslashes;
+        } else {
+            if (c == '"') {
+                out.append(backslashes + 1, '\\');
+            }
+            backslashes = 0;
+        }
+        out += c;
+    }
+    out.append(backslashes, '\\');
+#else
+    for (const char c : argument) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+        }
+        out += c;
+    }
+#endif
+    out += '"';
+
+    return out;
+}
+
+/**
+ * @brief Quote an argument so that the shell running a command line passes
+ * it unchanged, like `quote_response_argument` does for response files
+ */
+std::string quote_shell_argument(const std::string& argument) {
+#ifdef _WIN32
+    return quote_response_argument(argument);
+#else
+    if (argument != "" &&
+        argument.find_first_not_of("abcdefghijklmnopqrstuvwxyz"
+                                   "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+                                   "0123456789-_./=+,:@%") ==
+            std::string::npos) {
+        return argument;
+    }
+
+    std::string out = "'";
+    for (const char c : argument) {
+        if (c == '\'') {
+            out += "'\\''";
+        } else {
+            out += c;
+        }
+    }
+    out += '\'';
+
+    return out;
+#endif
+}
+
+/**
+ * @brief Join a command into a line for `create_process`
+ *
+ * The program is kept as is, since toolchains may name commands with
+ * arguments such as `zig c++`; every other argument is quoted.
+ */
+std::string create_command_line(const std::vector<std::string>& command) {
+    std::string out;
+
+    for (size_t i = 0; i < command.size(); ++i) {
+        if (i != 0) {
+            out += ' ';
+        }
+        out += i == 0 ? command[i] : quote_shell_argument(command[i]);
+    }
+
+    return out;
+}
+
+/**
+ * @brief Create the content of the response file holding the arguments of
+ * a command from `first` on, one per line
+ *
+ * @param first Number of leading arguments kept on the command line, at
+ * least the program
+ */
+std::string create_response_file(
+    const std::vector<std::string>& command, size_t first = 1) {
+    std::string out;
+
+    for (size_t i = first; i < command.size(); ++i) {
+        out += quote_response_argument(command[i]);
+        out += '\n';
+    }
+
+    return out;
+}
+
+/**
+ * @brief Find an executable in `PATH`
+ *
+ * @param name Name of the executable, returned as is if it contains a path
+ * separator
+ * @return full path of the executable, empty if it was not found
+ */
+std::string find_executable(const std::string& name) {
+    FileStat info;
+
+    if (name.find_first_of("/\\") != std::string::npos) {
+        return stat_file(name, info) ? name : "";
+    }
+
+#ifdef _WIN32
+    const char list_separator = ';';
+    const std::vector<std::string> suffixes = {"", ".exe", ".cmd", ".bat"};
+#else
+    const char list_separator = ':';
+    const std::vector<std::string> suffixes = {""};
+#endif
+
+    const char* path = std::getenv("PATH");
+    if (path == nullptr) {
+        return "";
+    }
+
+    const std::string paths = path;
+    for (const Slice dir : split_view(paths, list_separator)) {
+        if (dir.size == 0) {
+            continue;
+        }
+
+        for (const std::string& suffix : suffixes) {
+            const std::string candidate =
+                dir.to_string() + PATH_SEPARATOR + name + suffix;
+            if (stat_file(candidate, info)) {
+                return candidate;
+            }
+        }
+    }
+
+    return "";
+}
+
+namespace sha256 {
+namespace details {
+constexpr uint32_t ROUND_CONSTANTS[64] = {0x428a2f98, 0x71374491, 0xb5c0fbcf,
+    0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5, 0xd807aa98,
+    0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7,
+    0xc19bf174, 0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f,
+    0x4a7484aa, 0x5cb0a9dc, 0x76f988da, 0x983e5152, 0xa831c66d, 0xb00327c8,
+    0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967, 0x27b70a85,
+    0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e,
+    0x92722c85, 0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819,
+    0xd6990624, 0xf40e3585, 0x106aa070, 0x19a4c116, 0x1e376c08, 0x2748774c,
+    0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3, 0x748f82ee,
+    0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7,
+    0xc67178f2};
+
+inline uint32_t rotate_right(uint32_t value, int bits) {
+    return (value >> bits) | (value << (32 - bits));
+}
+
+inline void transform(uint32_t state[8], const unsigned char* block) {
+    uint32_t w[64];
+
+    for (int i = 0; i < 16; ++i) {
+        w[i] = (static_cast<uint32_t>(block[i * 4]) << 24) |
+               (static_cast<uint32_t>(block[i * 4 + 1]) << 16) |
+               (static_cast<uint32_t>(block[i * 4 + 2]) << 8) |
+               static_cast<uint32_t>(block[i * 4 + 3]);
+    }
+
+    for (int i = 16; i < 64; ++i) {
+        uint32_t s0 = rotate_right(w[i - 15], 7) ^
+                      rotate_right(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = rotate_right(w[i - 2], 17) ^
+                      rotate_right(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+    uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+
+    for (int i = 0; i < 64; ++i) {
+        uint32_t s1 =
+            rotate_right(e, 6) ^ rotate_right(e, 11) ^ rotate_right(e, 25);
+        uint32_t choice = (e & f) ^ (~e & g);
+        uint32_t temp1 = h + s1 + choice + ROUND_CONSTANTS[i] + w[i];
+        uint32_t s0 =
+            rotate_right(a, 2) ^ rotate_right(a, 13) ^ rotate_right(a, 22);
+        uint32_t majority = (a & b) ^ (a & c) ^ (b & c);
+        uint32_t temp2 = s0 + majority;
+
+        h = g;
+        g = f;
+        f = e;
+        e = d + temp1;
+        d = c;
+        c = b;
+        b = a;
+        a = temp1 + temp2;
+    }
+
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+    state[5] += f;
+    state[6] += g;
+    state[7] += h;
+}
+}  // namespace details
+
+/**
+ * @brief Incremental SHA-256 hasher
+ * @code
+ * ```cpp
+ * nobpp::sha256::Hasher hasher;
+ * hasher.update("hello ");
+ * hasher.update("world");
+ * std::string digest = hasher.hex_digest();
+ * ```
+ * @endcode
+ */
+class Hasher {
+public:
+    Hasher& update(const char* data, size_t size) {
+        const unsigned char* bytes =
+            reinterpret_cast<const unsigned char*>(data);
+        self.length += size;
+
+        while (size > 0) {
+            size_t take = std::min(size, 64 - self.buffered);
+            std::memcpy(self.buffer + self.buffered, bytes, take);
+            self.buffered += take;
+            bytes += take;
+            size -= take;
+
+            if (self.buffered == 64) {
+                details::transform(self.state, self.buffer);
+                self.buffered = 0;
+            }
+        }
+
+        return self;
+    }
+
+    Hasher& update(const std::string& data) {
+        return self.update(data.data(), data.size());
+    }
+
+    /**
+     * @brief Finish hashing, the hasher must not be updated afterwards
+     *
+     * @return lowercase hex encoded digest
+     */
+    std::string hex_digest() {
+        metrics::global().bytes_hashed.add(self.length);
+        const uint64_t bit_length = self.length * 8;
+        const unsigned char padding = 0x80;
+        self.update(reinterpret_cast<const char*>(&padding), 1);
+
+        const char zero = 0;
+        while (self.buffered != 56) {
+            self.update(&zero, 1);
+        }
+
+        unsigned char length_bytes[8];
+        for (int i = 0; i < 8; ++i) {
+            length_bytes[i] =
+                static_cast<unsigned char>(bit_length >> (56 - i * 8));
+        }
+        self.update(reinterpret_cast<const char*>(length_bytes), 8);
+
+        static const char* digits = "0123456789abcdef";
+        std::string digest;
+        digest.reserve(64);
+
+        for (uint32_t word : self.state) {
+            for (int shift = 28; shift >= 0; shift -= 4) {
+                digest.push_back(digits[(word >> shift) & 0xf]);
+            }
+        }
+
+        return digest;
+    }
+
+private:
+    Hasher& self = *this;
+
+    uint32_t state[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+        0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+    unsigned char buffer[64];
+    size_t buffered = 0;
+    uint64_t length = 0;
+};
+
+/**
+ * @brief Hash a string
+ *
+ * @return lowercase hex encoded digest
+ */
+inline std::string hex_digest(const std::string& data) {
+    return Hasher().update(data).hex_digest();
+}
+}  // namespace sha256
+
+/**
+ * @brief XXH64, a fast non cryptographic hash identifying file contents
+ *
+ * Hashes several gigabytes per second on one core without SIMD, so hashing
+ * the inputs of a build is bound by reading them. Keys that have to resist
+ * deliberate collisions use `sha256` instead.
+ *
+ * @code
+ * ```cpp
+ * std::string digest = nobpp::xxh64::hex_digest(content); // 16 hex digits
+ * ```
+ * @endcode
+ */
+namespace xxh64 {
+namespace details {
+constexpr uint64_t PRIME_1 = 0x9E3779B185EBCA87ull;
+constexpr uint64_t PRIME_2 = 0xC2B2AE3D27D4EB4Full;
+constexpr uint64_t PRIME_3 = 0x165667B19E3779F9ull;
+constexpr uint64_t PRIME_4 = 0x85EBCA77C2B2AE63ull;
+constexpr uint64_t PRIME_5 = 0x27D4EB2F165667C5ull;
+
+inline uint64_t rotate_left(uint64_t value, int bits) noexcept {
+    return (value << bits) | (value >> (64 - bits));
+}
+
+// Little endian, the loads compile to single instructions
+inline uint64_t read_u64(const unsigned char* data) noexcept {
+    uint64_t value = 0;
+    std::memcpy(&value, data, 8);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    value = __builtin_bswap64(value);
+#endif
+    return value;
+}
+
+inline uint64_t read_u32(const unsigned char* data) noexcept {
+    uint32_t value = 0;
+    std::memcpy(&value, data, 4);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    value = __builtin_bswap32(value);
+#endif
+    return value;
+}
+
+inline uint64_t round(uint64_t accumulator, uint64_t input) noexcept {
+    accumulator += input * PRIME_2;
+    return rotate_left(accumulator, 31) * PRIME_1;
+}
+
+inline uint64_t merge_round(uint64_t hash, uint64_t accumulator) noexcept {
+    hash ^= round(0, accumulator);
+    return hash * PRIME_1 + PRIME_4;
+}
+}  // namespace details
+
+/**
+ * @brief Hash `size` bytes at `data`
+ */
+inline uint64_t hash(
+    const char* data, size_t size, uint64_t seed = 0) noexcept {
+    using namespace details;
+
+    const unsigned char* position =
+        reinterpret_cast<const unsigned char*>(data);
+    const unsigned char* const end = position + size;
+    uint64_t hash = 0;
+
+    if (size >= 32) {
+        // Four independent lanes keep the multipliers of the CPU busy
+        uint64_t lanes[4] = {seed + PRIME_1 + PRIME_2, seed + PRIME_2, seed,
+            seed - PRIME_1};
+
+        for (; end - position >= 32; position += 32) {
+            lanes[0] = round(lanes[0], read_u64(position));
+            lanes[1] = round(lanes[1], read_u64(position + 8));
+            lanes[2] = round(lanes[2], read_u64(position + 16));
+            lanes[3] = round(lanes[3], read_u64(position + 24));
+        }
+
+        hash = rotate_left(lanes[0], 1) + rotate_left(lanes[1], 7) +
+               rotate_left(lanes[2], 12) + rotate_left(lanes[3], 18);
+        for (const uint64_t lane : lanes) {
+            hash = merge_round(hash, lane);
+        }
+    } else {
+        hash = seed + PRIME_5;
+    }
+
+    hash += static_cast<uint64_t>(size);
+
+    for (; end - position >= 8; position += 8) {
+        hash ^= round(0, read_u64(position));
+        hash = rotate_left(hash, 27) * PRIME_1 + PRIME_4;
+    }
+    if (end - position >= 4) {
+        hash ^= read_u32(position) * PRIME_1;
+        hash = rotate_left(hash, 23) * PRIME_2 + PRIME_3;
+        position += 4;
+    }
+    for (; position < end; ++position) {
+        hash ^= *position * PRIME_5;
+        hash = rotate_left(hash, 11) * PRIME_1;
+    }
+
+    hash ^= hash >> 33;
+    hash *= PRIME_2;
+    hash ^= hash >> 29;
+    hash *= PRIME_3;
+    hash ^= hash >> 32;
+
+    metrics::global().bytes_hashed.add(size);
+    return hash;
+}
+
+/**
+ * @brief Hash `size` bytes at `data`
+ *
+ * @return the hash as 16 lowercase hex digits
+ */
+inline std::string hex_digest(const char* data, size_t size) {
+    const uint64_t value = hash(data, size);
+    const char* digits = "0123456789abcdef";
+    std::string hex(16, '0');
+
+    for (int i = 0; i < 16; ++i) {
+        hex[i] = digits[(value >> (60 - i * 4)) & 0xf];
+    }
+
+    return hex;
+}
+
+inline std::string hex_digest(const std::string& data) {
+    return hex_digest(data.data(), data.size());
+}
+}  // namespace xxh64
+
+/**
+ * @brief Content addressed build cache shared between machines
+ *
+ * The layout follows the Bazel remote cache HTTP API: `/cas/<sha256>` stores
+ * blobs by the hash of their content and `/ac/<sha256>` maps the hash of a
+ * compile action (compiler, flags and preprocessed source) to an
+ * `ActionResult` message naming the digest of the object file it produced.
+ */
+namespace cache {
+
+enum struct Store { ac, cas };
+
+inline const char* store_name(Store store) noexcept {
+    return store == Store::ac ? "ac" : "cas";
+}
+
+namespace details {
+inline void put_varint(std::string& out, uint64_t value) {
+    while (value >= 0x80) {
+        out.push_back(static_cast<char>((value & 0x7f) | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<char>(value));
+}
+
+inline void put_bytes(
+    std::string& out, uint32_t field, const std::string& bytes) {
+    put_varint(out, (field << 3) | 2);
+    put_varint(out, bytes.size());
+    out += bytes;
+}
+
+/**
+ * @brief Reader over the fields of a protocol buffer message
+ */
+class ProtoReader {
+public:
+    ProtoReader(const std::string& data) : data(data) {}
+
+    bool done() const noexcept {
+        return self.position == self.data.size();
+    }
+
+    /**
+     * @brief Read the next field, skipping over its value unless it is a
+     * varint or length delimited
+     *
+     * @param bytes Receives the value of a length delimited field
+     * @param varint Receives the value of a varint field
+     * @return `false` if the message is malformed
+     */
+    bool next(uint32_t& field, uint32_t& wire_type, std::string& bytes,
+        uint64_t& varint) {
+        uint64_t key = 0;
+        if (!self.get_varint(key)) {
+            return false;
+        }
+
+        field = static_cast<uint32_t>(key >> 3);
+        wire_type = static_cast<uint32_t>(key & 7);
+
+        switch (wire_type) {
+            case 0:
+                return self.get_varint(varint);
+            case 1:
+                return self.skip(8);
+            case 2: {
+                uint64_t size = 0;
+                if (!self.get_varint(size) ||
+                    size > self.data.size() - self.position) {
+                    return false;
+                }
+                bytes = self.data.substr(self.position, size);
+                self.position += size;
+                return true;
+            }
+            case 5:
+                return self.skip(4);
+        }
+
+        return false;
+    }
+
+private:
+    ProtoReader& self = *this;
+
+    const std::string& data;
+    size_t position = 0;
+
+    bool get_varint(uint64_t& value) {
+        value = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            if (self.position == self.data.size()) {
+                return false;
+            }
+
+            const unsigned char byte =
+                static_cast<unsigned char>(self.data[self.position++]);
+            value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+
+            if ((byte & 0x80) == 0) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool skip(size_t size) {
+        if (size > self.data.size() - self.position) {
+            return false;
+        }
+        self.position += size;
+        return true;
+    }
+};
+}  // namespace details
+
+/**
+ * @brief Encode an `ActionResult` with a single output file
+ *
+ * Only `output_files` is set, with the path and digest of the file. This is
+ * what `bazel-remote` checks action cache entries against.
+ *
+ * @param path Path of the output, relative to the working directory
+ * @param hash Hex sha256 of the output
+ * @param size Size of the output in bytes
+ * @return the serialized message
+ */
+inline std::string encode_action_result(
+    const std::string& path, const std::string& hash, uint64_t size) {
+    std::string digest;
+    details::put_bytes(digest, 1, hash);
+    details::put_varint(digest, (2 << 3) | 0);
+    details::put_varint(digest, size);
+
+    std::string output_file;
+    details::put_bytes(output_file, 1, path);
+    details::put_bytes(output_file, 2, digest);
+
+    std::string action_result;
+    details::put_bytes(action_result, 2, output_file);
+
+    return action_result;
+}
+
+/**
+ * @brief Decode the digest of the first output file of an `ActionResult`
+ *
+ * @param message The serialized message
+ * @param hash Receives the hex sha256 of the output
+ * @param size Receives the size of the output in bytes
+ * @return `false` if the message is malformed or has no output file
+ */
+inline bool decode_action_result(
+    const std::string& message, std::string& hash, uint64_t& size) {
+    uint32_t field = 0;
+    uint32_t wire_type = 0;
+    std::string bytes;
+    uint64_t varint = 0;
+
+    const auto find = [&](const std::string& data, uint32_t wanted,
+                          std::string& value) {
+        details::ProtoReader reader(data);
+        while (!reader.done()) {
+            if (!reader.next(field, wire_type, bytes, varint)) {
+                return false;
+            }
+            if (field == wanted && wire_type == 2) {
+                value = bytes;
+                return true;
+            }
+        }
+        return false;
+    };
+
+    std::string output_file;
+    std::string digest;
+    if (!find(message, 2, output_file) || !find(output_file, 2, digest)) {
+        return false;
+    }
+
+    hash.clear();
+    size = 0;
+
+    details::ProtoReader reader(digest);
+    while (!reader.done()) {
+        if (!reader.next(field, wire_type, bytes, varint)) {
+            return false;
+        }
+        if (field == 1 && wire_type == 2) {
+            hash = bytes;
+        } else if (field == 2 && wire_type == 0) {
+            size = varint;
+        }
+    }
+
+    return hash != "";
+}
+
+/**
+ * @brief Storage a `cache::Client` reads from and writes to
+ */
+class Backend {
+public:
+    virtual ~Backend() = default;
+
+    /**
+     * @brief Look up a blob
+     *
+     * @return `false` if the blob does not exist or could not be read
+     */
+    virtual bool get(
+        Store store, const std::string& hash, std::string& data) = 0;
+
+    /**
+     * @brief Store a blob
+     *
+     * @return `false` if the blob could not be stored
+     */
+    virtual bool put(
+        Store store, const std::string& hash, const std::string& data) = 0;
+};
+
+/**
+ * @brief Cache stored in a local or network mounted directory
+ * @code
+ * ```cpp
+ * nobpp::cache::DirectoryBackend backend("/mnt/build-cache");
+ * ```
+ * @endcode
+ */
+class DirectoryBackend : public Backend {
+public:
+    DirectoryBackend(const std::string& root) : root(root) {}
+
+    bool get(
+        Store store, const std::string& hash, std::string& data) override {
+        return read_file(self.path(store, hash), data);
+    }
+
+    bool put(Store store, const std::string& hash,
+        const std::string& data) override {
+        const std::string target = self.path(store, hash);
+        create_parent_dir(target);
+
+        // Concurrent readers never see a partially written blob, as
+        // `write_file` renames a complete temporary file over the target
+        return write_file(target, data);
+    }
+
+private:
+    DirectoryBackend& self = *this;
+
+    std::string root;
+
+    std::string path(Store store, const std::string& hash) const {
+        return self.root + "/" + store_name(store) + "/" + hash;
+    }
+};
+
+#ifndef _WIN32
+/**
+ * @brief Cache served over HTTP/1.1, e.g. by `bazel-remote` or nginx with
+ * WebDAV `PUT` enabled
+ * @code
+ * ```cpp
+ * nobpp::cache::HttpBackend backend("cache.local", 8080, "/nobpp");
+ * ```
+ * @endcode
+ */
+class HttpBackend : public Backend {
+public:
+    /**
+     * @brief Construct a new Http Backend object
+     *
+     * @param host Host name of the server
+     * @param port Port of the server
+     * @param prefix Path prepended to `/ac/<hash>` and `/cas/<hash>`
+     */
+    HttpBackend(const std::string& host, uint16_t port = 80,
+        const std::string& prefix = "")
+        : host(host), port(port), prefix(prefix) {}
+
+    /**
+     * @brief Upload blobs with `Transfer-Encoding: chunked`
+     *
+     * By default uploads send a `Content-Length`, which `bazel-remote`
+     * requires. Servers and proxies that accept chunked requests can start
+     * storing a large blob before all of it arrived.
+     *
+     * @param chunk_size Bytes per chunk, `0` to send a `Content-Length`
+     * @return `HttpBackend&`
+     */
+    HttpBackend& set_chunk_size(size_t chunk_size) noexcept {
+        self.chunk_size = chunk_size;
+        return self;
+    }
+
+    bool get(
+        Store store, const std::string& hash, std::string& data) override {
+        return self.request("GET", self.path(store, hash), "", data) == 200;
+    }
+
+    bool put(Store store, const std::string& hash,
+        const std::string& data) override {
+        std::string body;
+        const int status =
+            self.request("PUT", self.path(store, hash), data, body);
+        return status >= 200 && status < 300;
+    }
+
+private:
+    HttpBackend& self = *this;
+
+    std::string host;
+    uint16_t port;
+    std::string prefix;
+    size_t chunk_size = 0;
+
+    std::string path(Store store, const std::string& hash) const {
+        return self.prefix + "/" + store_name(store) + "/" + hash;
+    }
+
+    int connect() const {
+        addrinfo hints;
+        std::memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+
+        addrinfo* addresses = nullptr;
+        if (getaddrinfo(self.host.c_str(), std::to_string(self.port).c_str(),
+                &hints, &addresses) != 0) {
+            return -1;
+        }
+
+        int fd = -1;
+        for (addrinfo* address = addresses; address != nullptr;
+             address = address->ai_next) {
+            fd = ::socket(address->ai_family, address->ai_socktype,
+                address->ai_protocol);
+            if (fd < 0) {
+                continue;
+            }
+            if (::connect(fd, address->ai_addr, address->ai_addrlen) == 0) {
+                break;
+            }
+            ::close(fd);
+            fd = -1;
+        }
+
+        freeaddrinfo(addresses);
+
+        return fd;
+    }
+
+    /**
+     * @brief Send a request and read the response body
+     *
+     * @return HTTP status code, `-1` on connection errors
+     */
+    int request(const std::string& method, const std::string& path,
+        const std::string& payload, std::string& body) const {
+        int fd = self.connect();
+
+        if (fd < 0) {
+            return -1;
+        }
+
+        const bool chunked = method == "PUT" && self.chunk_size > 0;
+
+        std::string head = method + " " + path + " HTTP/1.1\r\nHost: " +
+                           self.host + "\r\nConnection: close\r\n";
+        if (method == "PUT") {
+            head += "Content-Type: application/octet-stream\r\n";
+            head += chunked ? std::string("Transfer-Encoding: chunked\r\n")
+                            : "Content-Length: " +
+                                  std::to_string(payload.size()) + "\r\n";
+        }
+        head += "\r\n";
+
+        std::string response;
+        bool sent = send_all(fd, head) &&
+                    (chunked ? self.send_chunked(fd, payload)
+                             : send_all(fd, payload));
+
+        char chunk[65536];
+        while (sent) {
+            ssize_t received = ::recv(fd, chunk, sizeof(chunk), 0);
+
+            if (received < 0 && errno == EINTR) {
+                continue;
+            }
+            if (received <= 0) {
+                break;
+            }
+            response.append(chunk, static_cast<size_t>(received));
+        }
+
+        ::close(fd);
+
+        const size_t header_end = response.find("\r\n\r\n");
+        if (!sent || header_end == std::string::npos ||
+            response.compare(0, 5, "HTTP/") != 0) {
+            return -1;
+        }
+
+        const size_t status_begin = response.find(' ');
+        if (status_begin == std::string::npos || status_begin > header_end) {
+            return -1;
+        }
+
+        const int status = std::atoi(response.c_str() + status_begin + 1);
+        body = response.substr(header_end + 4);
+
+        std::string headers = response.substr(0, header_end);
+        std::transform(headers.begin(), headers.end(), headers.begin(),
+            [](char c) { return static_cast<char>(std::tolower(c)); });
+
+        if (headers.find("\r\ntransfer-encoding: chunked") !=
+            std::string::npos) {
+            return decode_chunked(body) ? status : -1;
+        }
+
+        // Trust Content-Length over the connection close if the server sent
+        // it, a truncated blob must not end up in the build directory
+        const size_t length = headers.find("\r\ncontent-length:");
+        if (length != std::string::npos) {
+            const size_t expected = static_cast<size_t>(
+                std::atoll(headers.c_str() + length + 17));
+            if (expected != body.size()) {
+                return -1;
+            }
+        }
+
+        return status;
+    }
+
+    static bool send_all(int fd, const std::string& data) {
+        const char* cursor = data.data();
+        size_t size = data.size();
+
+        while (size > 0) {
+            ssize_t written = ::send(fd, cursor, size, MSG_NOSIGNAL);
+
+            if (written < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return false;
+            }
+
+            cursor += written;
+            size -= static_cast<size_t>(written);
+        }
+
+        return true;
+    }
+
+    bool send_chunked(int fd, const std::string& payload) const {
+        char size_line[32];
+
+        for (size_t offset = 0; offset < payload.size();
+             offset += self.chunk_size) {
+            const size_t size =
+                std::min(self.chunk_size, payload.size() - offset);
+            std::snprintf(size_line, sizeof(size_line), "%zx\r\n", size);
+
+            if (!send_all(fd, size_line) ||
+                !send_all(fd, payload.substr(offset, size)) ||
+                !send_all(fd, "\r\n")) {
+                return false;
+            }
+        }
+
+        return send_all(fd, "0\r\n\r\n");
+    }
+
+    /**
+     * @brief Replace a `Transfer-Encoding: chunked` body by its content
+     *
+     * @return `false` if the body is malformed or truncated
+     */
+    static bool decode_chunked(std::string& body) {
+        std::string content;
+        size_t position = 0;
+
+        while (true) {
+            const size_t line_end = body.find("\r\n", position);
+            if (line_end == std::string::npos) {
+                return false;
+            }
+
+            char* end = nullptr;
+            const unsigned long long size =
+                std::strtoull(body.c_str() + position, &end, 16);
+            if (end == body.c_str() + position) {
+                return false;
+            }
+
+            position = line_end + 2;
+            if (size == 0) {
+                break;
+            }
+            if (size > body.size() - position ||
+                body.size() - position - size < 2) {
+                return false;
+            }
+
+            content.append(body, position, static_cast<size_t>(size));
+            position += static_cast<size_t>(size) + 2;
+        }
+
+        body = std::move(content);
+        return true;
+    }
+};
+#endif
+
+/**
+ * @brief Cache client consulted by `CommandBuilder` before compiling
+ *
+ * Lookups are synchronous, uploads are handed to a background thread so a
+ * slow cache server never delays the build. Pending uploads are finished
+ * when the client is destroyed.
+ *
+ * @code
+ * ```cpp
+ * auto cache = std::make_shared<nobpp::cache::Client>(
+ *     std::make_shared<nobpp::cache::DirectoryBackend>("/mnt/build-cache"));
+ * builder.set_cache(cache);
+ * ```
+ * @endcode
+ */
+class Client {
+public:
+    Client(std::shared_ptr<Backend> backend) : backend(std::move(backend)) {
+        self.uploader = std::thread([this]() { this->upload_loop(); });
+    }
+    Client(const Client&) = delete;
+    Client& operator=(const Client&) = delete;
+
+    ~Client() {
+        {
+            std::lock_guard<std::mutex> lock(self.upload_mutex);
+            self.stopping = true;
+        }
+        self.upload_cv.notify_one();
+        self.uploader.join();
+    }
+
+    /**
+     * @brief Fetch the output of an action
+     *
+     * @param action_hash Hash of the action
+     * @param output Receives the output on a hit
+     * @return `true` on a cache hit
+     */
+    bool fetch(const std::string& action_hash, std::string& output) {
+        std::string action_result;
+        std::string digest;
+        uint64_t size = 0;
+
+        metrics::Registry& counters = metrics::global();
+
+        if (!self.backend->get(Store::ac, action_hash, action_result) ||
+            !decode_action_result(action_result, digest, size)) {
+            counters.cache_misses_action.add();
+            return false;
+        }
+
+        if (!self.backend->get(Store::cas, digest, output)) {
+            counters.cache_misses_blob.add();
+            return false;
+        }
+
+        // Never trust a blob that does not match its address
+        if (output.size() != size || sha256::hex_digest(output) != digest) {
+            counters.cache_misses_digest.add();
+            return false;
+        }
+
+        counters.cache_hits.add();
+        return true;
+    }
+
+    /**
+     * @brief Queue the output of an action for upload without waiting
+     *
+     * @param action_hash Hash of the action
+     * @param output The output of the action
+     */
+    void store_async(const std::string& action_hash, std::string output) {
+        metrics::global().cache_uploads.add();
+        {
+            std::lock_guard<std::mutex> lock(self.upload_mutex);
+            self.uploads.emplace(action_hash, std::move(output));
+        }
+        self.upload_cv.notify_one();
+    }
+
+private:
+    Client& self = *this;
+
+    std::shared_ptr<Backend> backend;
+
+    std::thread uploader;
+    std::queue<std::pair<std::string, std::string>> uploads;
+    std::mutex upload_mutex;
+    std::condition_variable upload_cv;
+    bool stopping = false;
+
+private:
+    void upload_loop() {
+        while (true) {
+            std::unique_lock<std::mutex> lock(self.upload_mutex);
+
+            self.upload_cv.wait(lock,
+                [this]() { return !this->uploads.empty() || this->stopping; });
+
+            if (self.uploads.empty()) {
+                return;
+            }
+
+            std::pair<std::string, std::string> upload =
+                std::move(self.uploads.front());
+            self.uploads.pop();
+            lock.unlock();
+
+            // The blob has to exist before the action entry points at it
+            const std::string digest = sha256::hex_digest(upload.second);
+            if (self.backend->put(Store::cas, digest, upload.second)) {
+                self.backend->put(Store::ac, upload.first,
+                    encode_action_result(
+                        "output", digest, upload.second.size()));
+            }
+        }
+    }
+};
+
+}  // namespace cache
+
+/**
+ * @brief Parse the prerequisites of a Makefile style depfile written by
+ * `-MD` without copying them
+ *
+ * Handles line continuations and escaped spaces. The target before the
+ * first unescaped `:` is skipped. Prerequisites without escapes are passed
+ * as views into `data`, the others as views into a buffer that is reused
+ * for the next one.
+ *
+ * @param data The content of the depfile
+ * @param size Size of the content
+ * @param callback Called with `(const char* data, size_t size)` for every
+ * prerequisite in order
+ * @code
+ * ```cpp
+ * nobpp::MappedFile file("./build/main.d");
+ * nobpp::parse_depfile(file.data(), file.size(),
+ *     [](const char* data, size_t size) {
+ *         std::cout.write(data, size) << "\n";
+ *     });
+ * ```
+ * @endcode
+ */
+template <typename Callback>
+void parse_depfile(const char* data, size_t size, Callback&& callback) {
+    std::string unescaped;
+    const char* start = nullptr;
+    size_t length = 0;
+    bool copied = false;
+    bool in_target = true;
+
+    // Plain characters of a prerequisite are contiguous in `data` until
+    // the first escape, which moves the prerequisite into `unescaped`
+    const auto add_escaped = [&](char c) {
+        if (!copied) {
+            unescaped.clear();
+            unescaped.append(start != nullptr ? start : "", length);
+            copied = true;
+        }
+        unescaped += c;
+    };
+    const auto add_plain = [&](size_t i) {
+        if (copied) {
+            unescaped += data[i];
+        } else {
+            start = length == 0 ? data + i : start;
+            ++length;
+        }
+    };
+    const auto clear = [&]() {
+        length = 0;
+        copied = false;
+    };
+    const auto flush = [&]() {
+        if (!in_target && copied) {
+            callback(static_cast<const char*>(unescaped.data()),
+                unescaped.size());
+        } else if (!in_target && length > 0) {
+            callback(start, length);
+        }
+        clear();
+    };
+
+    for (size_t i = 0; i < size; ++i) {
+        char c = data[i];
+
+        if (c == '\\' && i + 1 < size) {
+            const char next = data[i + 1];
+
+            if (next == ' ' || next == '#') {
+                add_escaped(next);
+                ++i;
+                continue;
+            }
+
+            if (next == '\n') {
+                c = ' ';
+                ++i;
+            } else if (next == '\r' && i + 2 < size && data[i + 2] == '\n') {
+                c = ' ';
+                i += 2;
+            }
+        } else if (c == '$' && i + 1 < size && data[i + 1] == '$') {
+            add_escaped('$');
+            ++i;
+            continue;
+        } else if (in_target && c == ':' &&
+                   (i + 1 == size || data[i + 1] == ' ' ||
+                       data[i + 1] == '\n' || data[i + 1] == '\r')) {
+            clear();
+            in_target = false;
+            continue;
+        }
+
+        if (c != ' ' && c != '\t' && c != '\n' && c != '\r') {
+            add_plain(i);
+            continue;
+        }
+
+        flush();
+
+        if (c == '\n') {
+            in_target = true;
+        }
+    }
+
+    flush();
+}
+
+/**
+ * @brief Parse the prerequisites of a Makefile style depfile written by
+ * `-MD`
+ *
+ * Handles line continuations and escaped spaces. The target before the
+ * first unescaped `:` is skipped.
+ *
+ * @param content The content of the depfile
+ * @return `std::vector<std::string>` the prerequisites in order
+ */
+std::vector<std::string> parse_depfile(const std::string& content) {
+    std::vector<std::string> prerequisites;
+
+    parse_depfile(content.data(), content.size(),
+        [&prerequisites](const char* data, size_t size) {
+            prerequisites.emplace_back(data, size);
+        });
+
+    return prerequisites;
+}
+
+/**
+ * @brief Strings numbered in the order they were first added
+ *
+ * Interning a string that is already in the table neither allocates nor
+ * copies it. Strings are never removed, references to them stay valid.
+ * Not thread safe.
+ */
+class StringTable {
+public:
+    /**
+     * @brief Get the id of a string, adding it if it is new
+     *
+     * @return `uint32_t` ids count up from 0
+     */
+    uint32_t intern(const char* data, size_t size) {
+        if ((self.strings.size() + 1) * 2 > self.slots.size()) {
+            self.grow();
+        }
+
+        size_t slot = self.find(data, size);
+        if (self.slots[slot] == 0) {
+            self.strings.emplace_back(data, size);
+            self.slots[slot] = static_cast<uint32_t>(self.strings.size());
+        }
+
+        return self.slots[slot] - 1;
+    }
+
+    uint32_t intern(const std::string& string) {
+        return self.intern(string.data(), string.size());
+    }
+
+    /**
+     * @brief Get the string of an id returned by `intern`
+     */
+    const std::string& get(uint32_t id) const {
+        return self.strings[id];
+    }
+
+    size_t size() const noexcept {
+        return self.strings.size();
+    }
+
+    /**
+     * @brief Remove every string, invalidates references to them
+     */
+    void clear() {
+        self.strings.clear();
+        self.slots.clear();
+    }
+
+private:
+    StringTable& self = *this;
+
+    std::deque<std::string> strings;
+    /// Open addressing, `id + 1` of the string or `0` if empty
+    std::vector<uint32_t> slots;
+
+    static uint64_t hash(const char* data, size_t size) noexcept {
+        // FNV-1a
+        uint64_t hash = 14695981039346656037ull;
+        for (size_t i = 0; i < size; ++i) {
+            hash = (hash ^ static_cast<unsigned char>(data[i])) *
+                   1099511628211ull;
+        }
+        return hash;
+    }
+
+    /// Slot of the string, or the empty slot it belongs in
+    size_t find(const char* data, size_t size) const noexcept {
+        const size_t mask = self.slots.size() - 1;
+        size_t slot = static_cast<size_t>(hash(data, size)) & mask;
+
+        while (self.slots[slot] != 0) {
+            const std::string& string = self.strings[self.slots[slot] - 1];
+            if (string.size() == size &&
+                (size == 0 || std::memcmp(string.data(), data, size) == 0)) {
+                break;
+            }
+            slot = (slot + 1) & mask;
+        }
+
+        return slot;
+    }
+
+    void grow() {
+        self.slots.assign(self.slots.empty() ? 64 : self.slots.size() * 2, 0);
+
+        for (size_t id = 0; id < self.strings.size(); ++id) {
+            const std::string& string = self.strings[id];
+            self.slots[self.find(string.data(), string.size())] =
+                static_cast<uint32_t>(id + 1);
+        }
+    }
+};
+
+/**
+ * @brief Prerequisites of every depfile of a build directory in one binary
+ * file, like the `.ninja_deps` of Ninja
+ *
+ * The log is read with a single read when it is first opened. A depfile is
+ * only parsed when its size or modification time differ from the ones
+ * logged with it, and the result is then appended to the log. Paths are
+ * interned, every path is written once and referred to by its id. Once
+ * outdated records outnumber the current ones, the next process to load
+ * the log rewrites it without them and without paths no depfile lists
+ * anymore. It uses the native byte order.
+ *
+ * @code
+ * ```cpp
+ * std::vector<const std::string*> headers;
+ * nobpp::DepsLog::open("./build/.nobpp/deps").get("./build/main.d", headers);
+ * ```
+ * @endcode
+ */
+class DepsLog {
+public:
+    /**
+     * @brief Get the log stored at `path`, loaded once per process
+     *
+     * Thread safe, every call with the same path returns the same log.
+     */
+    static DepsLog& open(const std::string& path) {
+        static std::mutex mutex;
+        // Never destroyed, like the depfiles it refers to
+        static auto* logs =
+            new std::map<std::string, std::unique_ptr<DepsLog>>();
+
+        std::lock_guard<std::mutex> lock(mutex);
+        std::unique_ptr<DepsLog>& log = (*logs)[path];
+        if (!log) {
+            log.reset(new DepsLog(path));
+        }
+
+        return *log;
+    }
+
+    DepsLog(const DepsLog&) = delete;
+    DepsLog& operator=(const DepsLog&) = delete;
+
+    /**
+     * @brief Get the prerequisites listed in a depfile
+     *
+     * Thread safe. The depfile is parsed without holding the lock of the
+     * log, so other threads only wait for the paths to be interned.
+     *
+     * @param depfile The depfile
+     * @param prerequisites Receives the prerequisites in order, valid as
+     * long as the process
+     * @param log Append a depfile that changed to the log, `false` for
+     * lookups that must not write to the build directory
+     * @return `false` if the depfile could not be read
+     */
+    bool get(const std::string& depfile,
+        std::vector<const std::string*>& prerequisites, bool log = true) {
+        prerequisites.clear();
+
+        // Before reading it, so a depfile written meanwhile is parsed again
+        FileStat stat;
+        if (!stat_file(depfile, stat)) {
+            return false;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(self.mutex);
+            const uint32_t id = self.paths.intern(depfile);
+
+            if (id < self.entries.size() && self.entries[id].logged &&
+                self.entries[id].size == stat.size &&
+                self.entries[id].mtime == stat.mtime) {
+                metrics::global().deps_log_hits.add();
+                self.resolve(self.entries[id], prerequisites);
+                return true;
+            }
+        }
+
+        // One buffer for every path, ended by their offsets
+        std::string names;
+        std::vector<size_t> ends;
+        {
+            MappedFile file(depfile);
+            if (!file.is_open()) {
+                return false;
+            }
+            metrics::global().depfiles_parsed.add();
+
+            parse_depfile(file.data(), file.size(),
+                [&names, &ends](const char* data, size_t size) {
+                    names.append(data, size);
+                    ends.push_back(names.size());
+                });
+        }
+
+        std::lock_guard<std::mutex> lock(self.mutex);
+        Entry entry;
+        entry.logged = true;
+        entry.size = stat.size;
+        entry.mtime = stat.mtime;
+
+        size_t begin = 0;
+        for (const size_t end : ends) {
+            entry.prerequisites.push_back(
+                self.paths.intern(names.data() + begin, end - begin));
+            begin = end;
+        }
+        self.resolve(entry, prerequisites);
+
+        if (log) {
+            const uint32_t id = self.paths.intern(depfile);
+            self.set(id, std::move(entry));
+            self.append(id);
+        }
+
+        return true;
+    }
+
+private:
+    struct Entry {
+        bool logged = false;
+        uint64_t size = 0;
+        int64_t mtime = 0;
+        std::vector<uint32_t> prerequisites;
+    };
+
+    static const char* magic() noexcept {
+        return "nobpp deps 1\n";
+    }
+    static constexpr size_t MAGIC_SIZE = 13;
+    /// Set in the header of a record of a depfile, clear for a path
+    static constexpr uint32_t DEPS_RECORD = uint32_t(1) << 31;
+    /// Depfile id, size and modification time
+    static constexpr size_t DEPS_HEADER_SIZE = 4 + 8 + 8;
+
+    DepsLog& self = *this;
+
+    std::string path;
+    std::mutex mutex;
+    StringTable paths;
+    /// Indexed by the id of the depfile
+    std::vector<Entry> entries;
+    /// Paths in the file, the others are written with the next record
+    size_t written_paths = 0;
+    /// Depfiles with a record
+    size_t logged = 0;
+    /// Records of depfiles that were logged again since
+    size_t outdated = 0;
+    bool rewrite = true;
+
+    explicit DepsLog(const std::string& path) : path(path) {
+        MappedFile file(path);
+
+        if (!file.is_open() || file.size() < MAGIC_SIZE ||
+            std::memcmp(file.data(), magic(), MAGIC_SIZE) != 0) {
+            return;
+        }
+
+        const char* const end = file.data() + file.size();
+        const char* position = file.data() + MAGIC_SIZE;
+
+        // An interrupted build may have left a partial record at the end,
+        // everything before it is kept
+        while (end - position >= 4) {
+            uint32_t header = 0;
+            std::memcpy(&header, position, 4);
+            const size_t size = header & ~DEPS_RECORD;
+
+            if (static_cast<size_t>(end - position - 4) < size) {
+                break;
+            }
+            position += 4;
+
+            if ((header & DEPS_RECORD) == 0) {
+                // Every path is only written once
+                const size_t count = self.paths.size();
+                if (self.paths.intern(position, size) != count) {
+                    break;
+                }
+            } else if (!self.load_deps(position, size)) {
+                break;
+            }
+            position += size;
+        }
+
+        self.written_paths = self.paths.size();
+        self.rewrite = position != end || self.outdated > self.logged;
+
+        if (self.outdated > self.logged) {
+            self.drop_unused_paths();
+        }
+    }
+
+    /**
+     * @brief Renumber the paths the logged depfiles refer to and forget
+     * the others, before any was handed out
+     */
+    void drop_unused_paths() {
+        StringTable used;
+        std::vector<Entry> entries;
+
+        for (uint32_t id = 0; id < self.entries.size(); ++id) {
+            Entry& entry = self.entries[id];
+            if (!entry.logged) {
+                continue;
+            }
+
+            const uint32_t used_id = used.intern(self.paths.get(id));
+            for (uint32_t& prerequisite : entry.prerequisites) {
+                prerequisite = used.intern(self.paths.get(prerequisite));
+            }
+
+            if (used_id >= entries.size()) {
+                entries.resize(used_id + 1);
+            }
+            entries[used_id] = std::move(entry);
+        }
+
+        self.paths.clear();
+        for (uint32_t id = 0; id < used.size(); ++id) {
+            self.paths.intern(used.get(id));
+        }
+        self.entries = std::move(entries);
+        self.written_paths = 0;
+        self.outdated = 0;
+    }
+
+    /// `mutex` must be held
+    void resolve(const Entry& entry,
+        std::vector<const std::string*>& prerequisites) const {
+        for (const uint32_t prerequisite : entry.prerequisites) {
+            prerequisites.push_back(&self.paths.get(prerequisite));
+        }
+    }
+
+    bool load_deps(const char* data, size_t size) {
+        if (size < DEPS_HEADER_SIZE || (size - DEPS_HEADER_SIZE) % 4 != 0) {
+            return false;
+        }
+
+        uint32_t id = 0;
+        Entry entry;
+        entry.logged = true;
+        std::memcpy(&id, data, 4);
+        std::memcpy(&entry.size, data + 4, 8);
+        std::memcpy(&entry.mtime, data + 12, 8);
+
+        entry.prerequisites.resize((size - DEPS_HEADER_SIZE) / 4);
+        if (!entry.prerequisites.empty()) {
+            std::memcpy(&entry.prerequisites[0], data + DEPS_HEADER_SIZE,
+                size - DEPS_HEADER_SIZE);
+        }
+
+        for (const uint32_t prerequisite : entry.prerequisites) {
+            if (prerequisite >= self.paths.size()) {
+                return false;
+            }
+        }
+        if (id >= self.paths.size()) {
+            return false;
+        }
+
+        self.set(id, std::move(entry));
+
+        return true;
+    }
+
+    void set(uint32_t id, Entry entry) {
+        if (id >= self.entries.size()) {
+            self.entries.resize(id + 1);
+        }
+
+        if (self.entries[id].logged) {
+            ++self.outdated;
+        } else {
+            ++self.logged;
+        }
+        self.entries[id] = std::move(entry);
+    }
+
+    static void put_u32(std::string& out, uint32_t value) {
+        out.append(reinterpret_cast<const char*>(&value), 4);
+    }
+
+    /// Paths that are not in the file yet, then the record of `id`
+    void write_records(std::string& out, uint32_t id) {
+        for (; self.written_paths < self.paths.size(); ++self.written_paths) {
+            const std::string& path =
+                self.paths.get(static_cast<uint32_t>(self.written_paths));
+            put_u32(out, static_cast<uint32_t>(path.size()));
+            out += path;
+        }
+
+        const Entry& entry = self.entries[id];
+        put_u32(out, static_cast<uint32_t>(DEPS_HEADER_SIZE +
+                                           entry.prerequisites.size() * 4) |
+                         DEPS_RECORD);
+        put_u32(out, id);
+        out.append(reinterpret_cast<const char*>(&entry.size), 8);
+        out.append(reinterpret_cast<const char*>(&entry.mtime), 8);
+        if (!entry.prerequisites.empty()) {
+            out.append(reinterpret_cast<const char*>(&entry.prerequisites[0]),
+                entry.prerequisites.size() * 4);
+        }
+    }
+
+    /// Write the record of `id`, `mutex` must be held
+    void append(uint32_t id) {
+        create_parent_dir(self.path);
+
+        // Also if the log was removed since it was loaded
+        FileStat stat;
+        if (self.rewrite || !stat_file(self.path, stat)) {
+            std::string content(magic(), MAGIC_SIZE);
+            self.written_paths = 0;
+            for (uint32_t i = 0; i < self.entries.size(); ++i) {
+                if (self.entries[i].logged) {
+                    self.write_records(content, i);
+                }
+            }
+            self.rewrite = !write_file(self.path, content);
+            self.outdated = 0;
+            return;
+        }
+
+        std::string record;
+        const size_t written_paths = self.written_paths;
+        self.write_records(record, id);
+
+        std::ofstream file(self.path, std::ios::binary | std::ios::app);
+        file.write(record.data(), static_cast<std::streamsize>(record.size()));
+        file.close();
+
+        if (!file) {
+            // Not in the file, written with the next record
+            self.written_paths = written_paths;
+            self.rewrite = true;
+        }
+    }
+};
+
+/**
+ * @brief Hash function of a `HashCache`
+ */
+enum struct Digest {
+    /// Fast, for checks that stay on the machine
+    xxh64,
+    /// For keys shared with other machines through a cache
+    sha256
+};
+
+/**
+ * @brief Content hashes of files, memoised by inode, modification time and
+ * size
+ *
+ * Files are read through `MappedFile` and hashed with XXH64 or SHA-256, a
+ * file is only read again once its inode, modification time or size
+ * changed. The hashes are kept as `<hash>\t<inode>\t<mtime>\t<size>\t<path>`
+ * lines, appended as files are hashed. A file modified in the last two
+ * seconds is hashed but not memoised, as a change in the same timestamp
+ * would go unnoticed.
+ *
+ * @code
+ * ```cpp
+ * nobpp::HashCache& hashes = nobpp::HashCache::open("./build/.nobpp/hashes");
+ * std::vector<std::string> digests = hashes.hash(builder.get_files());
+ * ```
+ * @endcode
+ */
+class HashCache {
+public:
+    /**
+     * @brief Get the cache stored at `path`, loaded once per process
+     *
+     * Thread safe, every call with the same path returns the same cache.
+     *
+     * @param digest Hash function of the cache
+     * @throws std::invalid_argument if the cache was opened with another
+     * digest
+     */
+    static HashCache& open(
+        const std::string& path, Digest digest = Digest::xxh64) {
+        static std::mutex mutex;
+        // Never destroyed, like `DepsLog`
+        static auto* caches =
+            new std::map<std::string, std::unique_ptr<HashCache>>();
+
+        std::lock_guard<std::mutex> lock(mutex);
+        std::unique_ptr<HashCache>& cache = (*caches)[path];
+        if (!cache) {
+            cache.reset(new HashCache(path, digest));
+        } else if (cache->digest != digest) {
+            throw std::invalid_argument(
+                "Hash cache " + path + " was opened with another digest.");
+        }
+
+        return *cache;
+    }
+
+    HashCache(const HashCache&) = delete;
+    HashCache& operator=(const HashCache&) = delete;
+
+    /**
+     * @brief Hash the content of a file
+     *
+     * @return lowercase hex digits, empty if the file could not be read
+     */
+    std::string hash(const std::string& file) {
+        return self.hash(std::vector<std::string>{file}, 1)[0];
+    }
+
+    /**
+     * @brief Hash the content of files in parallel
+     *
+     * Thread safe.
+     *
+     * @param files The files
+     * @param threads Threads reading files not memoised, `0` for one per
+     * core. Concurrent calls share the cores, the calling thread always
+     * hashes.
+     * @return lowercase hex digits for each file, empty for files that
+     * could not be read
+     */
+    std::vector<std::string> hash(
+        const std::vector<std::string>& files, size_t threads = 0) {
+        std::vector<std::string> hashes(files.size());
+        std::vector<FileStat> stats(files.size());
+        std::vector<size_t> missing;
+        {
+            std::lock_guard<std::mutex> lock(self.mutex);
+
+            for (size_t i = 0; i < files.size(); ++i) {
+                if (!stat_file(files[i], stats[i])) {
+                    continue;
+                }
+
+                auto found = self.entries.find(files[i]);
+                if (found != self.entries.end() &&
+                    found->second.inode == stats[i].inode &&
+                    found->second.mtime == stats[i].mtime &&
+                    found->second.size == stats[i].size) {
+                    hashes[i] = found->second.hash;
+                } else {
+                    missing.push_back(i);
+                }
+            }
+        }
+
+        if (threads == 0) {
+            threads = std::max(1u, std::thread::hardware_concurrency());
+        }
+        const size_t helpers = take_helpers(
+            std::min(threads, std::max<size_t>(missing.size(), 1)) - 1);
+
+        std::atomic<size_t> next{0};
+        const auto hash_missing = [&]() {
+            for (size_t i = next++; i < missing.size(); i = next++) {
+                const MappedFile file(files[missing[i]]);
+
+                if (file.is_open()) {
+                    hashes[missing[i]] =
+                        self.hex_digest(file.data(), file.size());
+                }
+            }
+        };
+
+        std::vector<std::thread> workers;
+        for (size_t i = 0; i < helpers; ++i) {
+            workers.emplace_back(hash_missing);
+        }
+        hash_missing();
+        for (std::thread& worker : workers) {
+            worker.join();
+        }
+        spare_helpers() += helpers;
+
+        std::lock_guard<std::mutex> lock(self.mutex);
+        const int64_t recent = self.now() - 2000000000;
+        std::string lines;
+
+        for (const size_t i : missing) {
+            if (hashes[i] == "" || stats[i].mtime > recent ||
+                files[i].find('\n') != std::string::npos) {
+                continue;
+            }
+
+            Entry& entry = self.entries[files[i]];
+            entry.inode = stats[i].inode;
+            entry.mtime = stats[i].mtime;
+            entry.size = stats[i].size;
+            entry.hash = hashes[i];
+            lines += self.format(files[i], entry);
+            ++self.lines;
+        }
+
+        if (lines != "") {
+            self.append(lines);
+        }
+
+        return hashes;
+    }
+
+private:
+    struct Entry {
+        uint64_t inode = 0;
+        int64_t mtime = 0;
+        uint64_t size = 0;
+        std::string hash;
+    };
+
+    HashCache& self = *this;
+
+    std::string path;
+    const Digest digest;
+    std::mutex mutex;
+    std::unordered_map<std::string, Entry> entries;
+    /// Lines in the file, more than entries once files were hashed again
+    size_t lines = 0;
+
+    HashCache(const std::string& path, Digest digest)
+        : path(path), digest(digest) {
+        std::string content;
+        if (!read_file(self.path, content)) {
+            return;
+        }
+
+        std::istringstream stream(content);
+        std::string line;
+        while (std::getline(stream, line)) {
+            std::istringstream fields(line);
+            Entry entry;
+            std::string file;
+
+            if (!(fields >> entry.hash >> entry.inode >> entry.mtime >>
+                    entry.size) ||
+                fields.get() != '\t' || !std::getline(fields, file)) {
+                continue;
+            }
+
+            self.entries[file] = entry;
+            ++self.lines;
+        }
+    }
+
+    static std::string format(const std::string& file, const Entry& entry) {
+        return entry.hash + "\t" + std::to_string(entry.inode) + "\t" +
+               std::to_string(entry.mtime) + "\t" +
+               std::to_string(entry.size) + "\t" + file + "\n";
+    }
+
+    std::string hex_digest(const char* data, size_t size) const {
+        return self.digest == Digest::sha256
+                   ? sha256::Hasher().update(data, size).hex_digest()
+                   : xxh64::hex_digest(data, size);
+    }
+
+    /// Threads every cache may start besides the callers, one per core
+    static std::atomic<size_t>& spare_helpers() {
+        static std::atomic<size_t> spare{
+            std::max(1u, std::thread::hardware_concurrency()) - 1};
+        return spare;
+    }
+
+    /// Take up to `wanted` of the spare threads
+    static size_t take_helpers(size_t wanted) {
+        std::atomic<size_t>& spare = spare_helpers();
+        size_t available = spare.load();
+
+        while (!spare.compare_exchange_weak(
+            available, available - std::min(wanted, available))) {
+        }
+        return std::min(wanted, available);
+    }
+
+    /// Now in the clock of `FileStat::mtime`
+    static int64_t now() {
+#ifdef _WIN32
+        FILETIME time;
+        GetSystemTimeAsFileTime(&time);
+        return filetime_to_ns(time);
+#else
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::system_clock::now().time_since_epoch())
+            .count();
+#endif
+    }
+
+    /// `mutex` must be held, compacts the file once most lines are stale
+    void append(const std::string& lines) {
+        create_parent_dir(self.path);
+
+        if (self.lines > 2 * self.entries.size() + 64) {
+            std::string content;
+            for (const auto& entry : self.entries) {
+                content += self.format(entry.first, entry.second);
+            }
+
+            if (write_file(self.path, content)) {
+                self.lines = self.entries.size();
+            }
+            return;
+        }
+
+        std::ofstream file(self.path, std::ios::binary | std::ios::app);
+        file.write(lines.data(), static_cast<std::streamsize>(lines.size()));
+    }
+};
+
+enum struct Compiler { clang, gcc };
+enum struct Language { c, cpp };
+enum struct TargetOS { windows, linux };
+enum struct OptimizationLevel { o0, o1, o2, o3, os, oz };
+enum struct Mode { debug, release };
+enum struct OutputType { executable, static_library };
+
+/**
+ * @brief Sanitizers, combine them with `|`
+ * @code
+ * ```cpp
+ * nobpp::Sanitizer::address | nobpp::Sanitizer::undefined
+ * ```
+ * @endcode
+ */
+enum struct Sanitizer : unsigned {
+    none = 0,
+    address = 1 << 0,
+    undefined = 1 << 1,
+    thread = 1 << 2,
+    memory = 1 << 3,
+    leak = 1 << 4,
+};
+
+constexpr Sanitizer operator|(Sanitizer a, Sanitizer b) noexcept {
+    return static_cast<Sanitizer>(
+        static_cast<unsigned>(a) | static_cast<unsigned>(b));
+}
+
+constexpr bool has_sanitizer(Sanitizer set, Sanitizer sanitizer) noexcept {
+    return (static_cast<unsigned>(set) & static_cast<unsigned>(sanitizer)) !=
+           0;
+}
+
+/**
+ * @brief Coverage instrumentation
+ *
+ * `gcov` uses `--coverage`, `llvm` uses clang's source based coverage
+ * (`-fprofile-instr-generate -fcoverage-mapping`).
+ */
+enum struct Coverage { none, gcov, llvm };
+
+/**
+ * @brief How strictly compiles are held to their declared inputs
+ *
+ * Declared are the source directory, the include directories, the
+ * directories added by `CommandBuilder::add_sandbox_dir`, the output
+ * directory and the system directories such as `/usr`.
+ */
+enum struct Sandbox {
+    none,
+    /// Report inputs outside the declared directories found in depfiles
+    audit,
+    /// Fail compiles reading undeclared inputs, and deny the compiler
+    /// access to undeclared directories with Landlock on Linux
+    enforce
+};
+
+/**
+ * @brief Throw if the sanitizers can not be used together
+ *
+ * @param sanitizers The sanitizers
+ * @throw std::invalid_argument
+ */
+void check_sanitizers(Sanitizer sanitizers) {
+    const Sanitizer exclusive[] = {
+        Sanitizer::address, Sanitizer::thread, Sanitizer::memory};
+    int count = 0;
+
+    for (Sanitizer sanitizer : exclusive) {
+        count += has_sanitizer(sanitizers, sanitizer) ? 1 : 0;
+    }
+
+    if (count > 1) {
+        throw std::invalid_argument(
+            "Only one of the address, thread and memory sanitizers can be "
+            "used at once.");
+    }
+
+    if (has_sanitizer(sanitizers, Sanitizer::leak) &&
+        (has_sanitizer(sanitizers, Sanitizer::thread) ||
+            has_sanitizer(sanitizers, Sanitizer::memory))) {
+        throw std::invalid_argument(
+            "The leak sanitizer can not be combined with the thread or memory "
+            "sanitizer.");
+    }
+}
+
+/**
+ * @brief Named build configuration of a `CommandBuilder`
+ *
+ * Every variant is built into `<build_dir>/<name>` with its own mode,
+ * optimization level, instrumentation and extra options on top of the
+ * options of the builder.
+ *
+ * @code
+ * ```cpp
+ * nobpp::Variant release = {"release", nobpp::Mode::release,
+ *     nobpp::OptimizationLevel::o3, {"-flto"}};
+ * ```
+ * @endcode
+ */
+struct Variant {
+    std::string name;
+    Mode mode = Mode::release;
+    OptimizationLevel optimization_level = OptimizationLevel::o3;
+    std::vector<std::string> options;
+    /// Added to the sanitizers of the builder
+    Sanitizer sanitizers = Sanitizer::none;
+    /// Replaces the coverage of the builder unless `none`
+    Coverage coverage = Coverage::none;
+};
+
+/**
+ * @brief Test run with the output of a `CommandBuilder` once it is linked
+ *
+ * Each shard runs as its own process with `GTEST_TOTAL_SHARDS` and
+ * `GTEST_SHARD_INDEX` set, so GoogleTest binaries split their test cases
+ * between the shards.
+ *
+ * @code
+ * ```cpp
+ * nobpp::Test unit = {"unit", {"--gtest_brief=1"}, {"./data/golden.txt"},
+ *     60, 4};
+ * ```
+ * @endcode
+ */
+struct Test {
+    std::string name;
+    /// Passed to the output
+    std::vector<std::string> arguments;
+    /// Files the test reads, it runs again when one of them is newer than
+    /// its last pass
+    std::vector<std::string> inputs;
+    /// Seconds after which a shard is killed and fails, `0` for no limit
+    unsigned timeout_seconds = 0;
+    unsigned shards = 1;
+};
+
+/**
+ * @brief Command generating files a `CommandBuilder` compiles or includes
+ *
+ * The command runs through the shell before the translation units using its
+ * outputs are compiled, and only when an output is missing or an input is
+ * newer than the oldest output.
+ *
+ * @code
+ * ```cpp
+ * nobpp::CustomCommand messages = {"messages",
+ *     "protoc --cpp_out=gen proto/messages.proto", {"proto/messages.proto"},
+ *     {"gen/proto/messages.pb.cc", "gen/proto/messages.pb.h"}};
+ * ```
+ * @endcode
+ */
+struct CustomCommand {
+    /// Names the job and the state of the command, unique in its builder
+    std::string name;
+    std::string command;
+    std::vector<std::string> inputs;
+    std::vector<std::string> outputs;
+};
+
+/**
+ * @brief Binary file linked into the output of a `CommandBuilder`
+ *
+ * The bytes are embedded by an assembler stub using `.incbin`, so no
+ * source file with the content as an array is ever generated or compiled.
+ */
+struct Resource {
+    std::string path;
+    /// The content is at `symbol` and ends at `symbol_end`
+    std::string symbol;
+};
+
+
+/**
+ * @brief Compiler, archiver and linker executables used by a builder
+ *
+ * Executables can be versioned (`clang++-18`), cross compilers or commands
+ * with arguments such as `zig c++`. The compiler version and the support of
+ * flags are probed once per executable and cached in
+ * `<cache_dir>/<hash>`, keyed by the path, size and modification time of
+ * the executable, so feature checks only spawn the compiler again after it
+ * was updated. Unless `set_cache_dir` is called, the cache lives in the
+ * state directory of the first builder probing the toolchain.
+ *
+ * @code
+ * ```cpp
+ * auto toolchain = nobpp::Toolchain::clang("-18");
+ * toolchain->set_linker("lld");
+ * builder.set_toolchain(toolchain);
+ * ```
+ * @endcode
+ */
+class Toolchain {
+public:
+    /**
+     * @brief Construct a toolchain with the default executables of a
+     * compiler family
+     *
+     * @param family `nobpp::Compiler::clang` or `nobpp::Compiler::gcc`
+     */
+    Toolchain(Compiler family = Compiler::clang) : family(family) {
+        if (family == Compiler::gcc) {
+            self.c_compiler = "gcc";
+            self.cpp_compiler = "g++";
+            self.archiver = "gcc-ar";
+        } else {
+            self.c_compiler = "clang";
+            self.cpp_compiler = "clang++";
+            self.archiver = "llvm-ar";
+        }
+    }
+    Toolchain(const Toolchain&) = delete;
+    Toolchain& operator=(const Toolchain&) = delete;
+
+    /**
+     * @brief Create a clang toolchain
+     *
+     * @param suffix Version suffix, e.g. `-18` for `clang++-18`
+     * @return `std::shared_ptr<nobpp::Toolchain>`
+     */
+    static std::shared_ptr<Toolchain> clang(const std::string& suffix = "") {
+        std::shared_ptr<Toolchain> toolchain =
+            std::make_shared<Toolchain>(Compiler::clang);
+        toolchain->set_c_compiler("clang" + suffix)
+            .set_cpp_compiler("clang++" + suffix)
+            .set_archiver("llvm-ar" + suffix)
+            .set_dwp("llvm-dwp" + suffix);
+        return toolchain;
+    }
+
+    /**
+     * @brief Create a gcc toolchain
+     *
+     * @param suffix Version suffix, e.g. `-13` for `g++-13`
+     * @return `std::shared_ptr<nobpp::Toolchain>`
+     */
+    static std::shared_ptr<Toolchain> gcc(const std::string& suffix = "") {
+        std::shared_ptr<Toolchain> toolchain =
+            std::make_shared<Toolchain>(Compiler::gcc);
+        toolchain->set_c_compiler("gcc" + suffix)
+            .set_cpp_compiler("g++" + suffix)
+            .set_archiver("gcc-ar" + suffix);
+        return toolchain;
+    }
+
+    /**
+     * @brief Create a toolchain using `zig cc` and `zig c++`
+     *
+     * @param target Optional target triple, e.g. `aarch64-linux-gnu`
+     * @return `std::shared_ptr<nobpp::Toolchain>`
+     */
+    static std::shared_ptr<Toolchain> zig(const std::string& target = "") {
+        const std::string target_flag =
+            target == "" ? "" : " -target " + target;
+        std::shared_ptr<Toolchain> toolchain =
+            std::make_shared<Toolchain>(Compiler::clang);
+        toolchain->set_c_compiler("zig cc" + target_flag)
+            .set_cpp_compiler("zig c++" + target_flag)
+            .set_archiver("zig ar");
+        return toolchain;
+    }
+
+    Toolchain& set_c_compiler(const std::string& command) {
+        self.c_compiler = command;
+        return self;
+    }
+
+    Toolchain& set_cpp_compiler(const std::string& command) {
+        self.cpp_compiler = command;
+        return self;
+    }
+
+    Toolchain& set_archiver(const std::string& command) {
+        self.archiver = command;
+        return self;
+    }
+
+    /**
+     * @brief Set the tool packaging split debug information into a `.dwp`
+     *
+     * The binutils `dwp` does not understand the DWARF 5 emitted by gcc 11
+     * and later, so both families default to `llvm-dwp`.
+     *
+     * @param command The packaging tool, `llvm-dwp` by default
+     * @return `Toolchain&`
+     */
+    Toolchain& set_dwp(const std::string& command) {
+        self.dwp = command;
+        return self;
+    }
+
+    /**
+     * @brief Set the linker passed to the compiler driver as `-fuse-ld=`
+     *
+     * @param linker e.g. `lld`, `mold` or a path to a linker
+     * @return `Toolchain&`
+     */
+    Toolchain& set_linker(const std::string& linker) {
+        self.linker = linker;
+        return self;
+    }
+
+    /**
+     * @brief Set the directory probe results are cached in
+     *
+     * @param dir The directory
+     * @return `Toolchain&`
+     */
+    Toolchain& set_cache_dir(const std::string& dir) {
+        std::lock_guard<std::mutex> lock(self.probe_mutex);
+        self.cache_dir = dir;
+        self.probes.clear();
+        return self;
+    }
+
+    /**
+     * @brief Set the directory probe results are cached in if none was set
+     * yet, `.nobpp/toolchains` is used if neither is called
+     *
+     * @param dir The directory
+     * @return `Toolchain&`
+     */
+    Toolchain& set_default_cache_dir(const std::string& dir) {
+        std::lock_guard<std::mutex> lock(self.probe_mutex);
+        if (self.cache_dir == "") {
+            self.cache_dir = dir;
+        }
+        return self;
+    }
+
+    Compiler get_family() const noexcept {
+        return self.family;
+    }
+
+    const std::string& compiler(Language language) const noexcept {
+        return language == Language::c ? self.c_compiler : self.cpp_compiler;
+    }
+
+    const std::string& get_archiver() const noexcept {
+        return self.archiver;
+    }
+
+    const std::string& get_linker() const noexcept {
+        return self.linker;
+    }
+
+    const std::string& get_dwp() const noexcept {
+        return self.dwp;
+    }
+
+    /**
+     * @brief Get the first line of `<compiler> --version`
+     *
+     * @param language Selects the C or the C++ compiler
+     * @return `std::string`, empty if the compiler could not be run
+     */
+    std::string version(Language language) {
+        const std::string& command = self.compiler(language);
+        // Concurrent first calls would otherwise all spawn the compiler
+        std::lock_guard<std::mutex> probing(self.version_mutex);
+        {
+            std::lock_guard<std::mutex> lock(self.probe_mutex);
+            Probes& probes = self.load(command);
+            if (probes.has_version) {
+                return probes.version;
+            }
+        }
+
+        std::string output;
+        std::string version;
+        if (create_process(command + " --version", output) == 0) {
+            version = output.substr(0, output.find_first_of("\r\n"));
+        }
+
+        std::lock_guard<std::mutex> lock(self.probe_mutex);
+        Probes& probes = self.load(command);
+        probes.has_version = true;
+        probes.version = version;
+        self.save(probes);
+
+        return version;
+    }
+
+    /**
+     * @brief Check if the compiler accepts a flag without warnings
+     *
+     * @param language Selects the C or the C++ compiler
+     * @param flag The flag, e.g. `-mavx2`
+     * @return `bool`
+     * @code
+     * ```cpp
+     * if (toolchain->supports_flag(nobpp::Language::cpp, "-std=c++23")) {
+     *     // ...
+     * }
+     * ```
+     * @endcode
+     */
+    bool supports_flag(Language language, const std::string& flag) {
+        const std::string& command = self.compiler(language);
+        const std::string key = command + '\0' + flag;
+        std::unique_lock<std::mutex> lock(self.probe_mutex);
+
+        // Concurrent first calls for a flag wait for the one probing it
+        while (true) {
+            Probes& probes = self.load(command);
+            auto it = probes.flags.find(flag);
+            if (it != probes.flags.end()) {
+                return it->second;
+            }
+            if (self.probing_flags.insert(key).second) {
+                break;
+            }
+            self.flag_probed.wait(lock);
+        }
+
+        const std::string dir = self.probe_dir();
+        lock.unlock();
+        const bool supported = self.try_compile(language,
+            "int main(void) { return 0; }\n", "-Werror " + flag, false, dir);
+        lock.lock();
+
+        Probes& probes = self.load(command);
+        probes.flags[flag] = supported;
+        self.save(probes);
+        self.probing_flags.erase(key);
+        self.flag_probed.notify_all();
+
+        return supported;
+    }
+
+    /**
+     * @brief Compile a source snippet, the result is not cached
+     *
+     * @param language Selects the C or the C++ compiler
+     * @param source The source code
+     * @param flags Extra flags passed to the compiler
+     * @param link Link an executable instead of only compiling
+     * @param dir Directory the temporary files are written to
+     * @return `true` if the compiler succeeded
+     */
+    bool try_compile(Language language, const std::string& source,
+        const std::string& flags = "", bool link = false,
+        const std::string& dir = ".nobpp/probes") const {
+        const std::string base = dir + "/probe-" + nanoid::generate(8);
+        const std::string source_file =
+            base + (language == Language::c ? ".c" : ".cpp");
+        const std::string output_file = base + (link ? ".out" : ".o");
+
+        create_parent_dir(source_file);
+        bool compiled = false;
+        if (write_file(source_file, source)) {
+            std::string output;
+            compiled = create_process(self.compiler(language) + " " + flags +
+                                          (link ? " " : " -c ") +
+                                          source_file + " -o " + output_file,
+                           output) == 0;
+        }
+        std::remove(source_file.c_str());
+        std::remove(output_file.c_str());
+
+        return compiled;
+    }
+
+private:
+    /**
+     * @brief Probe results of one executable
+     */
+    struct Probes {
+        std::string cache_file;
+        bool has_version = false;
+        std::string version;
+        std::map<std::string, bool> flags;
+    };
+
+    Toolchain& self = *this;
+
+    Compiler family;
+    std::string c_compiler;
+    std::string cpp_compiler;
+    std::string archiver;
+    std::string linker;
+    std::string dwp = "llvm-dwp";
+    std::string cache_dir;
+
+    std::mutex probe_mutex;
+    std::mutex version_mutex;
+    std::map<std::string, Probes> probes;
+    std::unordered_set<std::string> probing_flags;
+    std::condition_variable flag_probed;
+
+private:
+    std::string probe_dir() const {
+        return self.cache_dir == "" ? ".nobpp/toolchains" : self.cache_dir;
+    }
+
+    /**
+     * @brief Get the probes of a command, loading them from disk on first
+     * use, `probe_mutex` must be held
+     */
+    Probes& load(const std::string& command) {
+        auto it = self.probes.find(command);
+        if (it != self.probes.end()) {
+            return it->second;
+        }
+
+        Probes& probes = self.probes[command];
+
+        const std::string executable = command.substr(0, command.find(' '));
+        const std::string path = find_executable(executable);
+        FileStat info;
+        stat_file(path, info);
+
+        sha256::Hasher hasher;
+        hasher.update(command).update("", 1).update(path).update("", 1);
+        hasher.update(std::to_string(info.size)).update("", 1);
+        hasher.update(std::to_string(info.mtime));
+        probes.cache_file = self.probe_dir() + "/" + hasher.hex_digest();
+
+        std::string content;
+        if (!read_file(probes.cache_file, content)) {
+            return probes;
+        }
+
+        std::istringstream lines(content);
+        std::string line;
+        while (std::getline(lines, line)) {
+            const std::vector<std::string> fields = split(line, '\t');
+
+            if (fields.size() == 2 && fields[0] == "version") {
+                probes.has_version = true;
+                probes.version = fields[1];
+            } else if (fields.size() == 3 && fields[0] == "flag") {
+                probes.flags[fields[1]] = fields[2] == "1";
+            }
+        }
+
+        return probes;
+    }
+
+    void save(const Probes& probes) const {
+        std::string content;
+
+        if (probes.has_version) {
+            content += "version\t" + probes.version + "\n";
+        }
+        for (const auto& flag : probes.flags) {
+            content += "flag\t" + flag.first + "\t" +
+                       (flag.second ? "1" : "0") + "\n";
+        }
+
+        create_parent_dir(probes.cache_file);
+        write_file(probes.cache_file, content);
+    }
+};
+
+/**
+ * @brief Command Builder to create and run build commands
+ * @code
+ * ```cpp
+ * #include "nobpp.hpp"
+ *
+ * int main() {
+ *      nobpp::CommandBuilder builder = nobpp::CommandBuilder();
+ *
+ *      builder.set_language(nobpp::Language::cpp)
+ *          .set_target_os(nobpp::TargetOS::windows)
+ *          .set_optimization_level(nobpp::OptimizationLevel::o3)
+ *          .add_options({"-ffast-math"})
+ *          .add_file("./test.cpp")
+ *          .set_build_dir("./bin")
+ *          .set_output("test")
+ *          .run();
+ *
+ *      return 0;
+ * }
+ * ```
+ * @endcode
+ */
+class CommandBuilder {
+public:
+    /**
+     * @brief Construct a new Command Builder object
+     * @return `nobpp::CommandBuilder`
+     * @code
+     * ```cpp
+     * nobpp::CommandBuilder builder = nobpp::CommandBuilder();
+     * ```
+     * @endcode
+     */
+    CommandBuilder() = default;
+
+    /**
+     * @brief Copy a Command Builder object
+     *
+     * `self` has to refer to the new object, so every member is copied
+     * explicitly.
+     */
+    CommandBuilder(const CommandBuilder& other)
+        : project_name(other.project_name),
+          compiler(other.compiler),
+          language(other.language),
+          target_os(other.target_os),
+          mode(other.mode),
+          optimization_level(other.optimization_level),
+          include_dirs(other.include_dirs),
+          files(other.files),
+          options(other.options),
+          build_dir(other.build_dir),
+          output(other.output),
+          output_type(other.output_type),
+          toolchain(other.toolchain),
+          implicit_toolchain(other.implicit_toolchain),
+          response_file_threshold(other.response_file_threshold),
+          sanitizers(other.sanitizers),
+          coverage(other.coverage),
+          split_debug_info(other.split_debug_info),
+          compress_debug_sections(other.compress_debug_sections),
+          debug_package(other.debug_package),
+          variants(other.variants),
+          variant_name(other.variant_name),
+          origin(other.origin),
+          dependencies(other.dependencies),
+          tests(other.tests),
+          custom_commands(other.custom_commands),
+          resources(other.resources),
+          sandbox(other.sandbox),
+          sandbox_dirs(other.sandbox_dirs),
+          reproducible(other.reproducible),
+          source_date_epoch(other.source_date_epoch),
+          cache(other.cache) {}
+    CommandBuilder& operator=(const CommandBuilder&) = delete;
+
+    /**
+     * @brief Set the project name
+     *
+     * @param project_name `const std::string&`
+     * @return `CommandBuilder&`
+     * @code
+     * ```cpp
+     * builder.set_project_name("Hello Project");
+     * ```
+     * @endcode
+     */
+    CommandBuilder& set_project_name(const std::string& project_name) noexcept {
+        self.project_name = project_name;
+        return self;
+    }
+
+    /**
+     * @brief Set the project name
+     *
+     * @param project_name `const char*`
+     * @return `CommandBuilder&`
+     * @code
+     * ```cpp
+     * builder.set_project_name("Hello Project");
+     * ```
+     * @endcode
+     */
+    CommandBuilder& set_project_name(const char* project_name) noexcept {
+        self.project_name = project_name;
+        return self;
+    }
+
+    /**
+     * @brief Set the compiler
+     *
+     * @param compiler `nobpp::Compiler`
+     * @return `CommandBuilder&`
+     * @code
+     * ```cpp
+     * builder.set_compiler(nobpp::Compiler::clang);
+     * ```
+     * @endcode
+     */
+    CommandBuilder& set_compiler(Compiler compiler) noexcept {
+        self.compiler = compiler;
+        if (self.implicit_toolchain) {
+            self.toolchain.reset();
+            self.implicit_toolchain = false;
+        }
+        return self;
+    }
+
+    /**
+     * @brief Use explicit compiler, archiver and linker executables instead
+     * of the ones selected by `set_compiler`
+     *
+     * @param toolchain The toolchain, may be shared between builders
+     * @return `CommandBuilder&`
+     * @code
+     * ```cpp
+     * builder.set_toolchain(nobpp::Toolchain::clang("-18"));
+     * ```
+     * @endcode
+     */
+    CommandBuilder& set_toolchain(
+        std::shared_ptr<Toolchain> toolchain) noexcept {
+        self.toolchain = std::move(toolchain);
+        self.implicit_toolchain = false;
+        return self;
+    }
+
+    /**
+     * @brief Get the toolchain of the builder, created from the compiler set
+     * by `set_compiler` if none was set
+     *
+     * A created toolchain is dropped again by `set_compiler`.
+     *
+     * @return `std::shared_ptr<nobpp::Toolchain>`
+     */
+    std::shared_ptr<Toolchain> get_toolchain() {
+        if (!self.toolchain) {
+            self.toolchain = std::make_shared<Toolchain>(self.compiler);
+            self.implicit_toolchain = true;
+        }
+        return self.toolchain;
+    }
+
+    /**
+     * @brief Set the language of the source files
+     *
+     * @param language `nobpp::Language::cpp` or `nobpp::Language::c`
+     * @return `nobpp::CommandBuilder&`
+     * @code
+     * ```cpp
+     * builder.set_language(nobpp::Language::cpp);
+     * ```
+     * @endcode
+     */
+    CommandBuilder& set_language(Language language) noexcept {
+        self.language = language;
+        return self;
+    }
+
+    /**
+     * @brief Set the target operating system
+     *
+     * @param os `nobpp::TargetOS::windows` or `nobpp::TargetOS::linux`
+     * @return `nobpp::CommandBuilder&`
+     * @code
+     * ```cpp
+     * builder.set_target_os(nobpp::TargetOS::windows);
+     * ```
+     * @endcode
+     */
+    CommandBuilder& set_target_os(TargetOS os) noexcept {
+        self.target_os = os;
+        return self;
+    }
+
+    /**
+     * @brief Set the build mode
+     *
+     * `nobpp::Mode::debug` adds `-g`, `nobpp::Mode::release` adds nothing.
+     * Assertions stay enabled unless `-DNDEBUG` is added to the options.
+     *
+     * @param mode `nobpp::Mode::debug` or `nobpp::Mode::release`
+     * @return `nobpp::CommandBuilder&`
+     * @code
+     * ```cpp
+     * builder.set_mode(nobpp::Mode::debug);
+     * ```
+     * @endcode
+     */
+    CommandBuilder& set_mode(Mode mode) noexcept {
+        self.mode = mode;
+        return self;
+    }
+
+    /**
+     * @brief Set the optimization level
+     *
+     * @param level `nobpp::OptimizationLevel::none`
+     *     | `nobpp::OptimizationLevel::o1`
+     *     | `nobpp::OptimizationLevel::o2`
+     *     | `nobpp::OptimizationLevel::o3`
+     *     | `nobpp::OptimizationLevel::os`,
+     *     | `nobpp::OptimizationLevel::oz`
+     * @return `nobpp::CommandBuilder&`
+     * @code
+     * ```cpp
+     * builder.set_optimization_level(nobpp::OptimizationLevel::o3);
+     * ```
+     * @endcode
+     */
+    CommandBuilder& set_optimization_level(OptimizationLevel level) noexcept {
+        self.optimization_level = level;
+        return self;
+    }
+
+    /**
+     * @brief Add an include directory
+     *
+     * @param dir The directory to include
+     * @return `nobpp::CommandBuilder&`
+     * @code
+     * ```cpp
+     * builder.add_include_dir("./include");
+     * ```
+     * @endcode
+     */
+    CommandBuilder& add_include_dir(const char* dir) noexcept {
+        self.include_dirs.push_back(dir);
+        return self;
+    }
+
+    /**
+     * @brief Add an include directory
+     *
+     * @param dir The directory to include
+     * @return `nobpp::CommandBuilder&`
+     * @code
+     * ```cpp
+     * builder.add_include_dir("./include");
+     * ```
+     * @endcode
+     */
+    CommandBuilder& add_include_dir(const std::string& dir) noexcept {
+        self.include_dirs.push_back(dir);
+        return self;
+    }
+
+    /**
+     * @brief Add include directories from a list of directories
+     *
+     * @param dirs A list of directories to include
+     * @return `nobpp::CommandBuilder&`
+     * @code
+     * ```cpp
+     * builder.add_include_dirs({"./include", "./src"});
+     * ```
+     * @endcode
+     */
+    CommandBuilder& add_include_dirs(
+        std::initializer_list<std::string> dirs) noexcept {
+        self.include_dirs.reserve(self.include_dirs.size() + dirs.size());
+        self.include_dirs.insert(
+            self.include_dirs.end(), dirs.begin(), dirs.end());
+        return self;
+    }
+
+    /**
+     * @brief Add include directories from a list of directories
+     *
+     * @param dirs A list of directories to include
+     * @return `nobpp::CommandBuilder&`
+     * @code
+     * ```cpp
+     * builder.add_include_dirs({"./include", "./src"});
+     * ```
+     * @endcode
+     */
+    CommandBuilder& add_include_dirs(std::vector<std::string>&& dirs) noexcept {
+        self.include_dirs.reserve(self.include_dirs.size() + dirs.size());
+        self.include_dirs.insert(
+            self.include_dirs.end(), dirs.begin(), dirs.end());
+        return self;
+    }
+
+    /**
+     * @brief Add include directories from a list of directories
+     *
+     * @param dirs A list of directories to include
+     * @return `nobpp::CommandBuilder&`
+     * @code
+     * ```cpp
+     * builder.add_include_dirs({"./include", "./src"});
+     * ```
+     * @endcode
+     */
+    CommandBuilder& add_include_dirs(
+        const std::vector<std::string>& dirs) noexcept {
+        self.include_dirs.reserve(self.include_dirs.size() + dirs.size());
+        self.include_dirs.insert(
+            self.include_dirs.end(), dirs.begin(), dirs.end());
+        return self;
+    }
+
+    /**
+     * @brief Add a source file
+     *
+     * @param file The source file to add
+     * @return `nobpp::CommandBuilder&`
+     * @code
+     * ```cpp
+     * builder.add_file("./src/main.cpp");
+     * ```
+     * @endcode
+     */
+    CommandBuilder& add_file(const char* file) noexcept {
+        self.files.push_back(file);
+        return self;
+    }
+
+    /**
+     * @brief Add a source file
+     *
+     * @param file The source file to add
+     * @return `nobpp::CommandBuilder&`
+     * @code
+     * ```cpp
+     * builder.add_file("./src/main.cpp");
+     * ```
+     * @endcode
+     */
+    CommandBuilder& add_file(const std::string& file) noexcept {
+        self.files.push_back(file);
+        return self;
+    }
+
+    /**
+     * @brief Add source files from a directory
+     *
+     * @param target_directory The directory to search for source files
+     * @param recursive Whether to search recursively
+     * @return `nobpp::CommandBuilder&`
+     * @code
+     * ```cpp
+     * builder.add_files("./src");
+     * ```
+     * @endcode
+     */
+    CommandBuilder& add_files(
+        const char* target_directory, bool recursive = true) {
+        return self.add_directory(target_directory,
+            self.language == Language::c ? is_c_file : is_cpp_file, recursive);
+    }
+
+    /**
+     * @brief Add source files from a directory
+     *
+     * @param target_directory The directory to search for source files
+     * @param recursive Whether to search recursively
+     * @return `nobpp::CommandBuilder&`
+     * @code
+     * ```cpp
+     * builder.add_files("./src");
+     * ```
+     * @endcode
+     */
+    CommandBuilder& add_files(
+        const std::string& target_directory, bool recursive = true) {
+        return self.add_directory(target_directory,
+            self.language == Language::c ? is_c_file : is_cpp_file, recursive);
+    }
+
+    /**
+     * @brief Add source files from a directory with a custom file predicate
+     *
+     * @param target_directory The directory to search for source files
+     * @param file_predicate A function that returns true if the file should be
+     * included
+     * @param recursive Whether to search recursively
+     * @return `nobpp::CommandBuilder&`
+     * @code
+     * ```cpp
+     * builder.add_files("./src", [](const std::string& file) {
+     *     return file.find(".cpp") != std::string::npos;
+     * });
+     * ```
+     * @endcode
+     */
+    CommandBuilder& add_files(const char* target_directory,
+        std::function<bool(const std::string&)> file_predicate,
+        bool recursive = true) {
+        return self.add_directory(target_directory, file_predicate, recursive);
+    }
+
+    /**
+     * @brief Add source files from a directory with a custom file predicate
+     *
+     * @param target_directory The directory to search for source files
+     * @param file_predicate A function that returns true if the file should be
+     * included
+     * @param recursive Whether to search recursively
+     * @return `nobpp::CommandBuilder&`
+     * @code
+     * ```cpp
+     * builder.add_files("./src", [](const std::string& file) {
+     *     return file.find(".cpp") != std::string::npos;
+     * });
+     * ```
+     * @endcode
+     */
+    CommandBuilder& add_files(const std::string& target_directory,
+        std::function<bool(const std::string&)> file_predicate,
+        bool recursive = true) {
+        return self.add_directory(target_directory, file_predicate, recursive);
+    }
+
+    /**
+     * @brief Add source files from a list of files
+     *
+     * @param files  A list of source files
+     * @return `nobpp::CommandBuilder&`
+     * @code
+     * ```cpp
+     * builder.add_files({"./src/main.cpp", "./src/utils.cpp"});
+     * ```
+     * @endcode
+     */
+    CommandBuilder& add_files(
+        std::initializer_list<std::string> files) noexcept {
+        self.files.reserve(self.files.size() + files.size());
+        self.files.insert(self.files.end(), files.begin(), files.end());
+        return self;
+    }
+
+    /**
+     * @brief Add source files from a list of files
+     *
+     * @param files  A list of source files
+     * @return `nobpp::CommandBuilder&`
+     * @code
+     * ```cpp
+     * std::vector<std::string> files = {"./src/main.cpp", "./src/utils.cpp"};
+     * builder.add_files({"./src/main.cpp", "./src/utils.cpp"});
+     * ```
+     * @endcode
+     */
+    CommandBuilder& add_files(std::vector<std::string>&& files) noexcept {
+        self.files.reserve(self.files.size() + files.size());
+        self.files.insert(self.files.end(), files.begin(), files.end());
+        return self;
+    }
+
+    /**
+     * @brief Add source files from a list of files
+     *
+     * @param files  A list of source files
+     * @return `nobpp::CommandBuilder&`
+     * @code
+     * ```cpp
+     * builder.add_files({"./src/main.cpp", "./src/utils.cpp"});
+     * ```
+     * @endcode
+     */
+    CommandBuilder& add_files(const std::vector<std::string>& files) noexcept {
+        self.files.reserve(self.files.size() + files.size());
+        self.files.insert(self.files.end(), files.begin(), files.end());
+        return self;
+    }
+
+    /**
+     * @brief Add any compiler option
+     *
+     * @param opt A compiler option
+     * @return `nobpp::CommandBuilder&`
+     * @code
+     * ```cpp
+     * builder.add_option("-ffast-math");
+     * ```
+     * @endcode
+     */
+    CommandBuilder& add_option(const char* opt) noexcept {
+        self.options.push_back(opt);
+        return self;
+    }
+
+    /**
+     * @brief Add any compiler option
+     *
+     * @param opt A compiler option
+     * @return `nobpp::CommandBuilder&`
+     * @code
+     * ```cpp
+     * builder.add_option("-ffast-math");
+     * ```
+     * @endcode
+     */
+    CommandBuilder& add_option(const std::string& opt) noexcept {
+        self.options.push_back(opt);
+        return self;
+    }
+
+    /**
+     * @brief Add any compiler options
+     *
+     * @param opts A list of compiler options
+     * @return `nobpp::CommandBuilder&`
+     * @code
+     * ```cpp
+     * builder.add_options({"-ffast-math", "-fno-exceptions"});
+     * ```
+     * @endcode
+     */
+    CommandBuilder& add_options(
+        std::initializer_list<std::string>&& opts) noexcept {
+        for (const std::string& opt : opts) {
+            self.options.push_back(opt);
+        }
+        return self;
+    }
+
+    /**
+     * @brief Add any compiler options
+     *
+     * @param opts A list of compiler options
+     * @return `nobpp::CommandBuilder&`
+     * @code
+     * ```cpp
+     * builder.add_options({"-ffast-math", "-fno-exceptions"});
+     * ```
+     * @endcode
+     */
+    CommandBuilder& add_options(const std::vector<std::string>& opts) noexcept {
+        for (const std::string& opt : opts) {
+            self.options.push_back(opt);
+        }
+        return self;
+    }
+
+    /**
+     * @brief Add a compiler option if the compiler accepts it
+     *
+     * Support is probed once and cached on disk by the toolchain.
+     *
+     * @param opt A compiler option
+     * @return `nobpp::CommandBuilder&`
+     * @code
+     * ```cpp
+     * builder.add_option_if_supported("-fno-semantic-interposition");
+     * ```
+     * @endcode
+     */
+    CommandBuilder& add_option_if_supported(const std::string& opt) {
+        self.get_toolchain();
+        if (self.probed_toolchain().supports_flag(self.language, opt)) {
+            self.options.push_back(opt);
+        }
+        return self;
+    }
+
+    /**
+     * @brief Set the length above which a command passes its arguments
+     * through a response file
+     *
+     * The arguments are written to a `.rsp` file next to the output and
+     * the command becomes `<program> @<file>`. The file is only rewritten
+     * when its content changes.
+     *
+     * @param threshold Length in characters, `0` to never use response files
+     * @return `nobpp::CommandBuilder&`
+     * @code
+     * ```cpp
+     * builder.set_response_file_threshold(8000);
+     * ```
+     * @endcode
+     */
+    CommandBuilder& set_response_file_threshold(size_t threshold) noexcept {
+        self.response_file_threshold = threshold;
+        return self;
+    }
+
+    /**
+     * @brief Set the kind of output
+     *
+     * Static libraries are created by the archiver of the toolchain.
+     *
+     * @param type `nobpp::OutputType::executable` or
+     *     `nobpp::OutputType::static_library`
+     * @return `nobpp::CommandBuilder&`
+     * @code
+     * ```cpp
+     * builder.set_output_type(nobpp::OutputType::static_library)
+     *     .set_output("libutils.a");
+     * ```
+     * @endcode
+     */
+    CommandBuilder& set_output_type(OutputType type) noexcept {
+        self.output_type = type;
+        return self;
+    }
+
+    OutputType get_output_type() const noexcept {
+        return self.output_type;
+    }
+
+    /**
+     * @brief Set the build directory
+     *
+     * @param dir The directory to build the output file in
+     * @return `nobpp::CommandBuilder&`
+     * @code
+     * ```cpp
+     * builder.set_build_dir("./bin");
+     * ```
+     * @endcode
+     */
+    CommandBuilder& set_build_dir(const std::string& dir) noexcept {
+        self.build_dir = dir;
+        return self;
+    }
+
+    /**
+     * @brief Set the sanitizers
+     *
+     * The flags are passed to both the compiler and the linker. Instrumented
+     * builds write their objects, state and output to a separate directory
+     * per profile, e.g. `<build_dir>/asan-ubsan`, so switching profiles keeps
+     * the incremental state and cache entries of every profile intact.
+     *
+     * @param sanitizers The sanitizers, combined with `|`
+     * @return `nobpp::CommandBuilder&`
+     * @throw std::invalid_argument if the sanitizers can not be combined
+     * @code
+     * ```cpp
+     * builder.set_sanitizers(
+     *     nobpp::Sanitizer::address | nobpp::Sanitizer::undefined);
+     * ```
+     * @endcode
+     */
+    CommandBuilder& set_sanitizers(Sanitizer sanitizers) {
+        check_sanitizers(sanitizers);
+        self.sanitizers = sanitizers;
+        return self;
+    }
+
+    /**
+     * @brief Set the coverage instrumentation
+     *
+     * @param coverage `nobpp::Coverage::gcov` or `nobpp::Coverage::llvm`
+     * @return `nobpp::CommandBuilder&`
+     * @code
+     * ```cpp
+     * builder.set_coverage(nobpp::Coverage::llvm);
+     * ```
+     * @endcode
+     */
+    CommandBuilder& set_coverage(Coverage coverage) noexcept {
+        self.coverage = coverage;
+        return self;
+    }
+
+    /**
+     * @brief Keep the DWARF debug information of each object in a `.dwo`
+     * file next to it (`-gsplit-dwarf`)
+     *
+     * The linker then only copies the skeleton units, so relinking after a
+     * change moves far less data. Only has an effect when debug information
+     * is generated, i.e. in debug mode or with `-g` in the options.
+     *
+     * @param enabled `true` to split the debug information
+     * @return `nobpp::CommandBuilder&`
+     * @code
+     * ```cpp
+     * builder.set_mode(nobpp::Mode::debug).set_split_debug_info(true);
+     * ```
+     * @endcode
+     */
+    CommandBuilder& set_split_debug_info(bool enabled) noexcept {
+        self.split_debug_info = enabled;
+        return self;
+    }
+
+    /**
+     * @brief Compress the debug sections of objects and outputs (`-gz`)
+     *
+     * @param enabled `true` to compress debug sections
+     * @return `nobpp::CommandBuilder&`
+     */
+    CommandBuilder& set_compress_debug_sections(bool enabled) noexcept {
+        self.compress_debug_sections = enabled;
+        return self;
+    }
+
+    /**
+     * @brief Package the `.dwo` files of an executable into `<output>.dwp`
+     * after it is linked
+     *
+     * `CommandQueue` runs the packaging as its own job that nothing waits
+     * on. Needs split debug information.
+     *
+     * @param enabled `true` to create the `.dwp` package
+     * @return `nobpp::CommandBuilder&`
+     */
+    CommandBuilder& set_debug_package(bool enabled) noexcept {
+        self.debug_package = enabled;
+        return self;
+    }
+
+    /**
+     * @brief Check that the settings of the builder can be used together
+     *
+     * Called by `run()` and `CommandQueue::add_builder()`, before any job
+     * starts.
+     *
+     * @throw std::invalid_argument
+     */
+    void validate() const {
+        check_sanitizers(self.sanitizers);
+
+        if (self.compiler_family() == Compiler::gcc) {
+            if (has_sanitizer(self.sanitizers, Sanitizer::memory)) {
+                throw std::invalid_argument(
+                    "The memory sanitizer is only supported by clang.");
+            }
+            if (self.coverage == Coverage::llvm) {
+                throw std::invalid_argument(
+                    "Source based coverage is only supported by clang, use "
+                    "nobpp::Coverage::gcov.");
+            }
+        }
+
+        if (self.target_os == TargetOS::windows && self.split_debug_info) {
+            throw std::invalid_argument(
+                "Split debug information is only supported for ELF targets.");
+        }
+
+        if (self.debug_package && !self.split_debug_info) {
+            throw std::invalid_argument(
+                "A debug package needs split debug information.");
+        }
+
+        if (self.output_type == OutputType::static_library &&
+            !self.tests.empty()) {
+            throw std::invalid_argument(
+                "Tests need an executable, " + self.get_name() +
+                " is a static library.");
+        }
+
+        if (self.target_os == TargetOS::windows &&
+            (has_sanitizer(self.sanitizers, Sanitizer::thread) ||
+                has_sanitizer(self.sanitizers, Sanitizer::memory) ||
+                has_sanitizer(self.sanitizers, Sanitizer::leak))) {
+            throw std::invalid_argument(
+                "Only the address and undefined sanitizers are supported on "
+                "Windows.");
+        }
+
+        for (const CommandBuilder* dependency : self.dependencies) {
+            self.resolve_dependency(*dependency);
+        }
+    }
+
+    /**
+     * @brief Get the name of the instrumentation profile
+     *
+     * @return e.g. `asan-ubsan` or `cov`, empty without instrumentation
+     */
+    std::string profile() const {
+        std::vector<std::string> parts;
+
+        if (has_sanitizer(self.sanitizers, Sanitizer::address)) {
+            parts.push_back("asan");
+        }
+        if (has_sanitizer(self.sanitizers, Sanitizer::undefined)) {
+            parts.push_back("ubsan");
+        }
+        if (has_sanitizer(self.sanitizers, Sanitizer::thread)) {
+            parts.push_back("tsan");
+        }
+        if (has_sanitizer(self.sanitizers, Sanitizer::memory)) {
+            parts.push_back("msan");
+        }
+        if (has_sanitizer(self.sanitizers, Sanitizer::leak)) {
+            parts.push_back("lsan");
+        }
+
+        switch (self.coverage) {
+            case Coverage::none:
+                break;
+            case Coverage::gcov:
+                parts.push_back("cov");
+                break;
+            case Coverage::llvm:
+                parts.push_back("llvm-cov");
+                break;
+        }
+
+        return join(parts, '-');
+    }
+
+    /**
+     * @brief Get the directory objects, state and output are written to
+     *
+     * @return `<build_dir>` or `<build_dir>/<profile>` for instrumented builds
+     */
+    std::string output_dir() const {
+        const std::string name = self.profile();
+
+        if (name == "") {
+            return self.build_dir;
+        }
+
+        return self.build_dir == "" ? name : self.build_dir + "/" + name;
+    }
+
+    /**
+     * @brief Add a build variant
+     *
+     * Once variants are added, the builder is built once per variant into
+     * `<build_dir>/<name>`. The mode and optimization level of the variant
+     * replace the ones of the builder, its options are added after the
+     * options of the builder. `CommandQueue` schedules the jobs of all
+     * variants together.
+     *
+     * @param variant The variant
+     * @return `nobpp::CommandBuilder&`
+     * @code
+     * ```cpp
+     * builder.add_variant({"debug", nobpp::Mode::debug,
+     *            nobpp::OptimizationLevel::o0, {}})
+     *     .add_variant({"release", nobpp::Mode::release,
+     *         nobpp::OptimizationLevel::o3, {}})
+     *     .add_variant({"asan", nobpp::Mode::debug,
+     *         nobpp::OptimizationLevel::o1, {"-fsanitize=address"}});
+     * ```
+     * @endcode
+     */
+    CommandBuilder& add_variant(const Variant& variant) {
+        self.variants.push_back(variant);
+        return self;
+    }
+
+    /**
+     * @brief Get the variants of the builder
+     *
+     * @return `const std::vector<nobpp::Variant>&`
+     */
+    const std::vector<Variant>& get_variants() const noexcept {
+        return self.variants;
+    }
+
+    /**
+     * @brief Create a builder for a single variant
+     *
+     * @param variant The variant
+     * @return `nobpp::CommandBuilder` building only the variant
+     */
+    CommandBuilder with_variant(const Variant& variant) const {
+        CommandBuilder builder(self);
+
+        builder.variants.clear();
+        builder.mode = variant.mode;
+        builder.optimization_level = variant.optimization_level;
+        builder.options.insert(builder.options.end(), variant.options.begin(),
+            variant.options.end());
+        builder.sanitizers = self.sanitizers | variant.sanitizers;
+        if (variant.coverage != Coverage::none) {
+            builder.coverage = variant.coverage;
+        }
+        builder.build_dir = self.build_dir == ""
+                                ? variant.name
+                                : self.build_dir + "/" + variant.name;
+        builder.variant_name = variant.name;
+        builder.origin = self.origin != nullptr ? self.origin : this;
+
+        return builder;
+    }
+
+    /**
+     * @brief Find a variant by name
+     *
+     * @return `nullptr` if the builder has no such variant
+     */
+    const Variant* find_variant(const std::string& name) const noexcept {
+        for (const Variant& variant : self.variants) {
+            if (variant.name == name) {
+                return &variant;
+            }
+        }
+
+        return nullptr;
+    }
+
+    /**
+     * @brief Get the name of the variant this builder was created for by
+     * `with_variant`, empty otherwise
+     */
+    const std::string& get_variant_name() const noexcept {
+        return self.variant_name;
+    }
+
+    /**
+     * @brief Get the builder this one was created from by `with_variant`,
+     * or this builder
+     *
+     * Identifies a target across its variants.
+     */
+    const CommandBuilder& get_origin() const noexcept {
+        return self.origin != nullptr ? *self.origin : self;
+    }
+
+    /**
+     * @brief Get the name of the target, the project name if set and the
+     * output otherwise
+     */
+    const std::string& get_name() const noexcept {
+        return self.project_name != "" ? self.project_name : self.output;
+    }
+
+    /**
+     * @brief Build another builder before this one
+     *
+     * Static library dependencies are linked into this builder, with their
+     * own library dependencies. A variant of this builder uses the equally
+     * named variant of a dependency that has variants. `CommandQueue` adds
+     * dependencies that were not added explicitly. The dependency must
+     * outlive this builder.
+     *
+     * @param dependency The builder to build first
+     * @return `nobpp::CommandBuilder&`
+     * @code
+     * ```cpp
+     * app.depends_on(core).depends_on(utils);
+     * ```
+     * @endcode
+     */
+    CommandBuilder& depends_on(const CommandBuilder& dependency) {
+        self.dependencies.push_back(&dependency.get_origin());
+        return self;
+    }
+
+    /**
+     * @brief Get the builders this one depends on
+     *
+     * @return `const std::vector<const nobpp::CommandBuilder*>&`
+     */
+    const std::vector<const CommandBuilder*>& get_dependencies()
+        const noexcept {
+        return self.dependencies;
+    }
+
+    /**
+     * @brief Get the builder a dependency is built with for this builder
+     *
+     * @param dependency One of the dependencies
+     * @return the dependency, or its variant named like this builder's
+     * @throw std::invalid_argument if the dependency lacks that variant
+     */
+    CommandBuilder resolve_dependency(const CommandBuilder& dependency) const {
+        if (dependency.get_variants().empty()) {
+            return CommandBuilder(dependency);
+        }
+
+        const Variant* variant = dependency.find_variant(self.variant_name);
+        if (variant == nullptr) {
+            throw std::invalid_argument("Dependency " + dependency.get_name() +
+                                        " has no variant named '" +
+                                        self.variant_name + "'.");
+        }
+
+        return dependency.with_variant(*variant);
+    }
+
+    /**
+     * @brief Produce the same outputs from the same sources on every
+     * machine
+     *
+     * Paths on command lines are made relative to the working directory
+     * with `/` as separator, the working directory is mapped to `.` in
+     * debug information, `__FILE__` and `__DATE__` and the compiler and
+     * the preprocessor run with `SOURCE_DATE_EPOCH` set. ELF outputs get a
+     * build id hashed from their content, PE outputs no timestamp, and
+     * archives are written deterministically. The working directory does
+     * not enter cache keys, so checkouts in different directories share
+     * cached objects.
+     *
+     * @param reproducible `true` to enable
+     * @return `nobpp::CommandBuilder&`
+     * @code
+     * ```cpp
+     * builder.set_reproducible();
+     * ```
+     * @endcode
+     */
+    CommandBuilder& set_reproducible(bool reproducible = true) noexcept {
+        self.reproducible = reproducible;
+        return self;
+    }
+
+    /**
+     * @brief Check if reproducible mode is enabled
+     *
+     * @return `bool`
+     */
+    bool is_reproducible() const noexcept {
+        return self.reproducible;
+    }
+
+    /**
+     * @brief Set the time reproducible builds use for `__DATE__` and
+     * `__TIME__`
+     *
+     * Defaults to the `SOURCE_DATE_EPOCH` environment variable of nobpp,
+     * e.g. the commit time set by CI, and to `0` if it is not set.
+     *
+     * @param seconds Seconds since 1970-01-01 UTC
+     * @return `nobpp::CommandBuilder&`
+     */
+    CommandBuilder& set_source_date_epoch(int64_t seconds) noexcept {
+        self.source_date_epoch = seconds;
+        return self;
+    }
+
+    /**
+     * @brief Get the time reproducible builds use for `__DATE__` and
+     * `__TIME__`
+     *
+     * @return seconds since 1970-01-01 UTC
+     */
+    int64_t get_source_date_epoch() const {
+        if (self.source_date_epoch >= 0) {
+            return self.source_date_epoch;
+        }
+
+        const char* epoch = std::getenv("SOURCE_DATE_EPOCH");
+        return epoch != nullptr ? std::atoll(epoch) : 0;
+    }
+
+    /**
+     * @brief Hold compiles to their declared inputs
+     *
+     * After every compile the depfile is checked for inputs outside the
+     * declared directories, which a cache or an incremental build would
+     * not notice changing. `nobpp::Sandbox::audit` prints them,
+     * `nobpp::Sandbox::enforce` also fails the compile. On Linux 5.13 and
+     * later, `enforce` additionally runs the compiler under Landlock, so
+     * it can only read the declared and system directories and only write
+     * to the output directory and the temporary directory. With remote
+     * workers, the local preprocessor is checked and sandboxed instead.
+     *
+     * @param sandbox `nobpp::Sandbox`
+     * @return `nobpp::CommandBuilder&`
+     * @code
+     * ```cpp
+     * builder.set_sandbox(nobpp::Sandbox::enforce)
+     *     .add_sandbox_dir("/opt/sdk");
+     * ```
+     * @endcode
+     */
+    CommandBuilder& set_sandbox(Sandbox sandbox) noexcept {
+        self.sandbox = sandbox;
+        return self;
+    }
+
+    /**
+     * @brief Get how strictly compiles are held to their declared inputs
+     *
+     * @return `nobpp::Sandbox`
+     */
+    Sandbox get_sandbox() const noexcept {
+        return self.sandbox;
+    }
+
+    /**
+     * @brief Declare a directory compiles may read besides the include
+     * directories, e.g. a toolchain or SDK outside the system directories
+     *
+     * @param dir The directory
+     * @return `nobpp::CommandBuilder&`
+     */
+    CommandBuilder& add_sandbox_dir(const std::string& dir) {
+        self.sandbox_dirs.push_back(dir);
+        return self;
+    }
+
+    /**
+     * @brief Get the directories a source file may read from, as absolute
+     * paths
+     *
+     * @param source The source file
+     * @return `std::vector<std::string>`
+     */
+    std::vector<std::string> declared_dirs(const std::string& source) const {
+        const std::string cwd = current_dir();
+        std::vector<std::string> dirs = {"/usr", "/lib", "/lib32", "/lib64",
+            "/bin", "/sbin", "/etc", "/proc", "/sys", "/dev"};
+
+        // Toolchains installed outside the system directories
+        const std::string compiler = self.compiler_executable();
+        if (compiler.find('/') != std::string::npos) {
+            dirs.push_back(
+                parent_dir(parent_dir(absolute_path(compiler, cwd))));
+        }
+
+        dirs.push_back(parent_dir(absolute_path(source, cwd)));
+        for (const std::string& dir : self.include_dirs) {
+            dirs.push_back(absolute_path(dir, cwd));
+        }
+        for (const std::string& dir : self.sandbox_dirs) {
+            dirs.push_back(absolute_path(dir, cwd));
+        }
+        if (self.output_dir() != "") {
+            dirs.push_back(absolute_path(self.output_dir(), cwd));
+        }
+
+        return dirs;
+    }
+
+    /**
+     * @brief Find the inputs of the last compile of a source file outside
+     * `declared_dirs`
+     *
+     * @param source The source file
+     * @return the undeclared inputs listed in the depfile
+     */
+    std::vector<std::string> undeclared_inputs(
+        const std::string& source) const {
+        std::vector<const std::string*> inputs;
+        if (!self.read_dependencies(source, inputs)) {
+            return {};
+        }
+
+        const std::string cwd = current_dir();
+        const std::vector<std::string> dirs = self.declared_dirs(source);
+        std::vector<std::string> undeclared;
+
+        for (const std::string* input : inputs) {
+            const std::string path = absolute_path(*input, cwd);
+            const bool declared = std::any_of(dirs.begin(), dirs.end(),
+                [&path](const std::string& dir) {
+                    return path.compare(0, dir.size(), dir) == 0 &&
+                           (path.size() == dir.size() || dir == "/" ||
+                               path[dir.size()] == '/');
+                });
+
+            if (!declared) {
+                undeclared.push_back(*input);
+            }
+        }
+
+        return undeclared;
+    }
+
+    /**
+     * @brief Report the undeclared inputs of the last compile of a source
+     * file, if the builder has a sandbox
+     *
+     * @param source The source file
+     * @return `false` if `nobpp::Sandbox::enforce` rejected the compile, its
+     * object file is removed
+     */
+    bool check_declared_inputs(const std::string& source) const {
+        if (self.sandbox == Sandbox::none) {
+            return true;
+        }
+
+        const std::vector<std::string> undeclared =
+            self.undeclared_inputs(source);
+        for (const std::string& input : undeclared) {
+            std::cout << "Undeclared input " << input << " of " << source
+                      << "\n";
+        }
+
+        if (!undeclared.empty() && self.sandbox == Sandbox::enforce) {
+            std::remove(self.object_file(source).c_str());
+            return false;
+        }
+        return true;
+    }
+
+#ifndef _WIN32
+    /**
+     * @brief Get the Landlock rules of the compiler for a source file
+     *
+     * @return `false` if the compiler is not sandboxed
+     */
+    bool sandbox_rules(
+        const std::string& source, details::SandboxRules& rules) const {
+        if (self.sandbox != Sandbox::enforce) {
+            return false;
+        }
+
+        if (details::landlock_abi() < 1) {
+            static std::once_flag warned;
+            std::call_once(warned, []() {
+                std::cout << "Landlock is not available, undeclared inputs "
+                             "are only found after compiling\n";
+            });
+            return false;
+        }
+
+        const char* temp_dir = std::getenv("TMPDIR");
+        const std::string output_dir = self.output_dir();
+
+        rules.read_dirs = self.declared_dirs(source);
+        rules.write_dirs = {
+            absolute_path(output_dir == "" ? "." : output_dir, current_dir()),
+            temp_dir != nullptr && *temp_dir != '\0' ? temp_dir : "/tmp"};
+        return true;
+    }
+#endif
+
+    /**
+     * @brief Run a test with the output after it is linked
+     *
+     * `CommandQueue` runs every shard of the test as soon as the output is
+     * linked, in parallel with the rest of the build. A shard that passed
+     * is not run again until the output, the test or one of its inputs
+     * changes. `validate` rejects tests of static libraries.
+     *
+     * @param test The test
+     * @return `nobpp::CommandBuilder&`
+     * @throw std::invalid_argument if the test has no name or no shards
+     * @code
+     * ```cpp
+     * tests.add_test({"unit", {"--gtest_brief=1"}, {}, 60, 4});
+     * ```
+     * @endcode
+     */
+    CommandBuilder& add_test(const Test& test) {
+        if (test.name == "" || test.shards == 0) {
+            throw std::invalid_argument(
+                "Tests need a name and at least one shard.");
+        }
+
+        self.tests.push_back(test);
+        return self;
+    }
+
+    /**
+     * @brief Get the tests run with the output
+     *
+     * @return `const std::vector<nobpp::Test>&`
+     */
+    const std::vector<Test>& get_tests() const noexcept {
+        return self.tests;
+    }
+
+    /**
+     * @brief Create the command running a shard of a test
+     *
+     * @param test The test
+     * @param shard Index of the shard
+     * @return `std::string`
+     * @code
+     * ```cpp
+     * builder.create_test_command(unit, 1);
+     * // GTEST_TOTAL_SHARDS=4 GTEST_SHARD_INDEX=1 ./bin/tests --gtest_brief=1
+     * ```
+     * @endcode
+     */
+    std::string create_test_command(
+        const Test& test, unsigned shard) const {
+        std::vector<std::string> command = {self.output_file()};
+        command.insert(
+            command.end(), test.arguments.begin(), test.arguments.end());
+
+#ifdef _WIN32
+        const std::string program = create_command_line(command);
+
+        if (test.shards == 1) {
+            return program;
+        }
+
+        return "cmd /C \"set GTEST_TOTAL_SHARDS=" +
+               std::to_string(test.shards) +
+               "&& set GTEST_SHARD_INDEX=" + std::to_string(shard) + "&& " +
+               program + "\"";
+#else
+        // Relative paths would be looked up in PATH
+        if (command[0].find('/') == std::string::npos) {
+            command[0] = "./" + command[0];
+        }
+
+        const std::string program = create_command_line(command);
+
+        if (test.shards == 1) {
+            return program;
+        }
+
+        return "GTEST_TOTAL_SHARDS=" + std::to_string(test.shards) +
+               " GTEST_SHARD_INDEX=" + std::to_string(shard) + " " + program;
+#endif
+    }
+
+    /**
+     * @brief Name of the job running a shard of a test
+     *
+     * @return `test <output> <name>`, followed by `[<shard>/<shards>]` for
+     * sharded tests
+     */
+    std::string test_job_name(const Test& test, unsigned shard) const {
+        std::string name = "test " + self.output_file() + " " + test.name;
+
+        if (test.shards > 1) {
+            name += " [" + std::to_string(shard + 1) + "/" +
+                    std::to_string(test.shards) + "]";
+        }
+
+        return name;
+    }
+
+    /**
+     * @brief Explain why a shard of a test has to run
+     *
+     * The shard runs if it did not pass yet, if its command changed, or if
+     * the output or one of the inputs is newer than its last pass.
+     *
+     * @param test The test
+     * @param shard Index of the shard
+     * @param stats Optional cache of file stats shared between calls
+     * @return the reason, empty if the last pass is still valid
+     */
+    std::string explain_test(const Test& test, unsigned shard,
+        StatCache* stats = nullptr) const {
+        const std::string record = self.test_record(test, shard);
+        FileStat record_stat;
+
+        if (!stat_file(record, record_stat)) {
+            return "no recorded pass";
+        }
+
+        std::string recorded;
+        if (!read_file(record, recorded) ||
+            recorded != self.test_hash(test, shard)) {
+            return "test command changed";
+        }
+
+        FileStat output_stat;
+        if (!stat_file(self.output_file(), output_stat)) {
+            return "output missing";
+        }
+        if (output_stat.mtime > record_stat.mtime) {
+            return "output newer";
+        }
+
+        for (const std::string& input : test.inputs) {
+            FileStat input_stat;
+            const bool exists = stats != nullptr
+                                    ? stats->stat(input, input_stat)
+                                    : stat_file(input, input_stat);
+
+            if (!exists) {
+                return "input " + input + " missing";
+            }
+            if (input_stat.mtime > record_stat.mtime) {
+                return "input " + input + " newer";
+            }
+        }
+
+        return "";
+    }
+
+    /**
+     * @brief Run a shard of a test and record when it passes
+     *
+     * The output of the test is captured and only printed if it fails.
+     *
+     * @param test The test
+     * @param shard Index of the shard
+     * @return `true` if the test passed
+     */
+    bool run_test(const Test& test, unsigned shard) const {
+        std::string output;
+        const int result = create_process(
+            self.create_test_command(test, shard), output,
+            std::chrono::seconds(test.timeout_seconds));
+
+        return self.record_test_result(test, shard, result, output);
+    }
+
+    /**
+     * @brief Record the pass of a shard of a test, or print why it failed
+     *
+     * @param test The test
+     * @param shard Index of the shard
+     * @param result Exit code of `create_test_command(test, shard)`
+     * @param output What the command wrote to stdout and stderr
+     * @return `true` if the test passed
+     */
+    bool record_test_result(const Test& test, unsigned shard, int result,
+        const std::string& output) const {
+        const std::string record = self.test_record(test, shard);
+
+        if (result != 0) {
+            std::remove(record.c_str());
+            std::cout << self.test_job_name(test, shard)
+                      << (result == TIMEOUT_EXIT_CODE
+                                 ? " timed out after " +
+                                       std::to_string(test.timeout_seconds) +
+                                       " s"
+                                 : " failed with exit code " +
+                                       std::to_string(result))
+                      << "\n"
+                      << output;
+            return false;
+        }
+
+        create_parent_dir(record);
+        write_file(record, self.test_hash(test, shard));
+        return true;
+    }
+
+    /**
+     * @brief Generate files before compiling
+     *
+     * `CommandQueue` runs the command as its own job. A translation unit
+     * waits for it if it compiles one of the outputs or if its depfile
+     * lists one. Translation units without an up to date depfile may
+     * include any generated header, so they wait for every command that
+     * generates files other than sources of the builder. With a cache, the
+     * outputs are cached by the command and the content of the inputs.
+     *
+     * @param command The command
+     * @return `nobpp::CommandBuilder&`
+     * @throw std::invalid_argument if the command has no name, no command
+     * line or no outputs
+     * @code
+     * ```cpp
+     * builder.add_custom_command({"version", "./gen_version.sh gen/version.h",
+     *     {"gen_version.sh", ".git/HEAD"}, {"gen/version.h"}});
+     * ```
+     * @endcode
+     */
+    CommandBuilder& add_custom_command(const CustomCommand& command) {
+        if (command.name == "" || command.command == "" ||
+            command.outputs.empty()) {
+            throw std::invalid_argument(
+                "Custom commands need a name, a command and outputs.");
+        }
+
+        self.custom_commands.push_back(command);
+        return self;
+    }
+
+    /**
+     * @brief Get the custom commands of the builder
+     *
+     * @return `const std::vector<nobpp::CustomCommand>&`
+     */
+    const std::vector<CustomCommand>& get_custom_commands() const noexcept {
+        return self.custom_commands;
+    }
+
+    /**
+     * @brief Explain why a custom command has to run
+     *
+     * @param command One of the custom commands
+     * @param stats Optional cache of file stats shared between calls
+     * @return the reason, empty if the outputs are up to date
+     */
+    std::string explain_custom_command(
+        const CustomCommand& command, StatCache* stats = nullptr) const {
+        std::string recorded;
+        if (!read_file(self.custom_command_record(command), recorded)) {
+            return "no recorded command";
+        }
+        if (recorded != self.custom_command_hash(command)) {
+            return "command changed";
+        }
+
+        int64_t oldest_output = 0;
+        for (const std::string& output : command.outputs) {
+            FileStat output_stat;
+
+            if (!stat_file(output, output_stat)) {
+                return "output " + output + " missing";
+            }
+            if (oldest_output == 0 || output_stat.mtime < oldest_output) {
+                oldest_output = output_stat.mtime;
+            }
+        }
+
+        for (const std::string& input : command.inputs) {
+            FileStat input_stat;
+            const bool exists = stats != nullptr
+                                    ? stats->stat(input, input_stat)
+                                    : stat_file(input, input_stat);
+
+            if (!exists) {
+                return "input " + input + " missing";
+            }
+            if (input_stat.mtime > oldest_output) {
+                return "input " + input + " newer";
+            }
+        }
+
+        return "";
+    }
+
+    /**
+     * @brief Run a custom command, or restore its outputs from the cache
+     *
+     * @param command One of the custom commands
+     * @return `true` if the command succeeded and created every output
+     */
+    bool run_custom_command(const CustomCommand& command) const {
+        const std::string record = self.custom_command_record(command);
+        std::remove(record.c_str());
+
+        for (const std::string& output : command.outputs) {
+            create_parent_dir(output);
+        }
+
+        const std::string action =
+            self.cache ? self.custom_command_action(command) : "";
+
+        if (action == "" || !self.fetch_outputs(action, command.outputs)) {
+            if (create_process(command.command) != 0) {
+                return false;
+            }
+
+            for (const std::string& output : command.outputs) {
+                FileStat output_stat;
+
+                if (!stat_file(output, output_stat)) {
+                    std::cerr << "Custom command " << command.name
+                              << " did not create " << output << "\n";
+                    return false;
+                }
+            }
+
+            if (action != "") {
+                self.store_outputs(action, command.outputs);
+            }
+        }
+
+        create_parent_dir(record);
+        write_file(record, self.custom_command_hash(command));
+        return true;
+    }
+
+    /**
+     * @brief Get the custom commands a source file has to wait for
+     *
+     * @param source The source file
+     * @param stats Optional cache of file stats shared between calls
+     * @return indices into `get_custom_commands()`
+     */
+    std::vector<size_t> custom_commands_for(
+        const std::string& source, StatCache* stats = nullptr) const {
+        std::vector<const std::string*> includes;
+
+        // Only a depfile of an up to date object lists every include, an
+        // edited source may include other generated headers
+        const bool includes_known =
+            !self.custom_commands.empty() &&
+            self.read_dependencies(source, includes, false) &&
+            self.explain_compile(source, stats) == "";
+
+        std::vector<size_t> needed;
+        for (size_t i = 0; i < self.custom_commands.size(); ++i) {
+            for (const std::string& output : self.custom_commands[i].outputs) {
+                const bool used =
+                    same_path(output, source) ||
+                    (includes_known
+                            ? std::any_of(includes.begin(), includes.end(),
+                                  [&output](const std::string* include) {
+                                      return same_path(output, *include);
+                                  })
+                            : !self.is_source(output));
+
+                if (used) {
+                    needed.push_back(i);
+                    break;
+                }
+            }
+        }
+
+        return needed;
+    }
+
+    /**
+     * @brief Link the content of a file into the output
+     *
+     * The file is embedded by assembling a stub with `.incbin`, which costs
+     * about as much as copying the file. The symbols are declared in
+     * `resources.h`, whose directory is added to the include directories:
+     *
+     * ```cpp
+     * #include "resources.h"
+     *
+     * std::string shader(resource_shaders_blur_frag,
+     *     NOBPP_RESOURCE_SIZE(resource_shaders_blur_frag));
+     * ```
+     *
+     * The content is followed by a NUL byte not counted in its size, so
+     * text files can be used as C strings.
+     *
+     * @param path The file
+     * @param symbol Name of the symbol, by default `resource_` followed by
+     * the path with every other character than letters and digits replaced
+     * by `_`
+     * @return `nobpp::CommandBuilder&`
+     * @throw std::invalid_argument if the symbol is not an identifier or is
+     * used by another resource
+     * @code
+     * ```cpp
+     * builder.add_resource("./shaders/blur.frag")
+     *     .add_resource("./models/face.onnx", "face_model");
+     * ```
+     * @endcode
+     */
+    CommandBuilder& add_resource(
+        const std::string& path, const std::string& symbol = "") {
+        Resource resource = {path, symbol};
+
+        if (symbol == "") {
+            std::string relative = path;
+            while (relative.compare(0, 2, "./") == 0) {
+                relative = relative.substr(2);
+            }
+
+            resource.symbol = "resource_" + relative;
+            for (char& c : resource.symbol) {
+                if (!std::isalnum(static_cast<unsigned char>(c))) {
+                    c = '_';
+                }
+            }
+        }
+
+        const std::string& name = resource.symbol;
+        if (name == "" || std::isdigit(static_cast<unsigned char>(name[0])) ||
+            std::any_of(name.begin(), name.end(), [](char c) {
+                return !std::isalnum(static_cast<unsigned char>(c)) &&
+                       c != '_';
+            })) {
+            throw std::invalid_argument(
+                "Resource symbol '" + name + "' is not an identifier.");
+        }
+
+        // Default symbols of paths such as `a-b` and `a_b` are the same
+        for (const Resource& other : self.resources) {
+            if (other.symbol == name) {
+                throw std::invalid_argument("Resources " + other.path +
+                                            " and " + path +
+                                            " both use the symbol '" + name +
+                                            "', pass another symbol.");
+            }
+        }
+
+        self.resources.push_back(resource);
+        return self;
+    }
+
+    /**
+     * @brief Get the resources linked into the output
+     *
+     * @return `const std::vector<nobpp::Resource>&`
+     */
+    const std::vector<Resource>& get_resources() const noexcept {
+        return self.resources;
+    }
+
+    /**
+     * @brief Get the header declaring the symbols of the resources
+     *
+     * @return `<output_dir>/res/resources.h`
+     */
+    std::string resource_header() const {
+        const std::string dir = self.output_dir();
+
+        return (dir == "" ? "res" : dir + "/res") + "/resources.h";
+    }
+
+    /**
+     * @brief Write `resource_header()` unless it is up to date, called
+     * before any translation unit of the builder is compiled
+     *
+     * @return `false` if the header could not be written
+     */
+    bool write_resource_header() const {
+        if (self.resources.empty()) {
+            return true;
+        }
+
+        std::string header =
+            "// Generated by nobpp, do not edit\n"
+            "#pragma once\n\n"
+            "#include <stddef.h>\n\n"
+            "#define NOBPP_RESOURCE_SIZE(symbol) \\\n"
+            "    ((size_t)(symbol##_end - symbol))\n\n"
+            "#ifdef __cplusplus\n"
+            "extern \"C\" {\n"
+            "#endif\n\n";
+
+        for (const Resource& resource : self.resources) {
+            header += "// " + resource.path + "\n" +
+                      "extern const unsigned char " + resource.symbol +
+                      "[];\n" + "extern const unsigned char " +
+                      resource.symbol + "_end[];\n";
+        }
+
+        header += "\n#ifdef __cplusplus\n}\n#endif\n";
+
+        create_parent_dir(self.resource_header());
+        return write_file_if_changed(self.resource_header(), header);
+    }
+
+    /**
+     * @brief Create the assembler stub embedding a resource
+     *
+     * @param resource One of the resources
+     * @return `std::string`
+     */
+    std::string create_resource_stub(const Resource& resource) const {
+        std::string path;
+        for (const char c : resource.path) {
+            if (c == '\\' || c == '"') {
+                path += '\\';
+            }
+            path += c;
+        }
+
+        const std::string& symbol = resource.symbol;
+        const bool elf = self.target_os != TargetOS::windows;
+
+        std::string stub =
+            elf ? "    .section .rodata." + symbol + ",\"a\"\n"
+                : "    .section .rdata,\"dr\"\n";
+        stub += "    .globl " + symbol + "\n" + "    .globl " + symbol +
+                "_end\n" + "    .balign 16\n";
+
+        if (elf) {
+            stub += "    .type " + symbol + ", %object\n";
+        }
+
+        stub += symbol + ":\n" + "    .incbin \"" + path + "\"\n" + symbol +
+                "_end:\n" + "    .byte 0\n";
+
+        if (elf) {
+            stub += "    .size " + symbol + ", " + symbol + "_end - " +
+                    symbol + "\n" +
+                    "    .section .note.GNU-stack,\"\",%progbits\n";
+        }
+
+        return stub;
+    }
+
+    /**
+     * @brief Create the arguments of the command assembling the stub of a
+     * resource, the first one being the compiler
+     *
+     * @param resource One of the resources
+     * @return `std::vector<std::string>`
+     */
+    std::vector<std::string> create_resource_arguments(
+        const Resource& resource) const {
+        std::vector<std::string> command;
+
+        command.push_back(self.compiler_executable());
+        self.push_compile_flags(command);
+        command.push_back("-x");
+        command.push_back("assembler");
+        command.push_back("-c");
+        command.push_back(self.resource_stub(resource));
+        command.push_back("-o");
+        command.push_back(partial(self.object_file(resource.path)));
+
+        return command;
+    }
+
+    /**
+     * @brief Explain why a resource has to be embedded again
+     *
+     * @param resource One of the resources
+     * @param stats Optional cache of file stats shared between calls
+     * @return the reason, empty if its object is up to date
+     */
+    std::string explain_resource(
+        const Resource& resource, StatCache* stats = nullptr) const {
+        const std::string object = self.object_file(resource.path);
+        FileStat object_stat;
+
+        if (!stat_file(object, object_stat)) {
+            return "object missing";
+        }
+
+        std::string recorded;
+        if (!read_file(object + ".cmd", recorded) ||
+            recorded != self.resource_hash(resource)) {
+            return "flags hash changed";
+        }
+
+        FileStat resource_stat;
+        const bool exists = stats != nullptr
+                                ? stats->stat(resource.path, resource_stat)
+                                : stat_file(resource.path, resource_stat);
+
+        if (!exists) {
+            return "resource " + resource.path + " missing";
+        }
+        if (resource_stat.mtime > object_stat.mtime) {
+            return "resource " + resource.path + " newer";
+        }
+
+        return "";
+    }
+
+    /**
+     * @brief Assemble the object of a resource, or restore it from the cache
+     * by the hash of its content
+     *
+     * @param resource One of the resources
+     * @return `true` if the object was created
+     */
+    bool embed_resource(const Resource& resource) const {
+        const std::string object = self.object_file(resource.path);
+        const std::string stub = self.resource_stub(resource);
+        create_parent_dir(object);
+        create_parent_dir(stub);
+
+        if (!write_file_if_changed(stub, self.create_resource_stub(resource))) {
+            std::cerr << "Could not write " << stub << "\n";
+            return false;
+        }
+
+        std::string action;
+        if (self.cache) {
+            const std::string content =
+                self.hash_files({resource.path}, Digest::sha256)[0];
+            if (content != "") {
+                action = sha256::Hasher()
+                             .update(self.resource_hash(resource))
+                             .update("", 1)
+                             .update(content)
+                             .hex_digest();
+            }
+        }
+
+        std::string blob;
+        if (action != "" && self.cache->fetch(action, blob)) {
+            if (!write_file(object, blob)) {
+                return false;
+            }
+        } else {
+            const int result = self.run_command(
+                self.create_resource_arguments(resource), object + ".rsp");
+
+            if (!commit_file(result == 0, partial(object), object)) {
+                return false;
+            }
+
+            if (action != "" && read_file(object, blob)) {
+                self.cache->store_async(action, std::move(blob));
+            }
+        }
+
+        write_file(object + ".cmd", self.resource_hash(resource));
+        return true;
+    }
+
+    /**
+     * @brief Get the libraries of the dependencies to link with, each after
+     * the libraries depending on it
+     *
+     * @return `std::vector<std::string>`
+     */
+    std::vector<std::string> library_outputs() const {
+        std::vector<std::string> libraries;
+        self.collect_libraries(libraries, 0);
+
+        // Keep the last occurrence, static libraries must come after every
+        // library using them
+        std::vector<std::string> ordered;
+        for (auto it = libraries.begin(); it != libraries.end(); ++it) {
+            if (std::find(it + 1, libraries.end(), *it) == libraries.end()) {
+                ordered.push_back(*it);
+            }
+        }
+
+        return ordered;
+    }
+
+    /**
+     * @brief Set the output file
+     *
+     * Executables for Windows get the `.exe` extension if it is missing.
+     *
+     * @param output The name of the output file
+     * @return `nobpp::CommandBuilder&`
+     * @code
+     * ```cpp
+     * builder.set_output("test");
+     * ```
+     * @endcode
+     */
+    CommandBuilder& set_output(const std::string& output) noexcept {
+        self.output = output;
+        return self;
+    }
+
+    /**
+     * @brief Create a command object
+     *
+     * The command writes `<output>.tmp`, which `run` renames to the output
+     * once the compiler succeeded. Rename it yourself when running the
+     * command without the builder.
+     *
+     * @return std::string
+     * @code
+     * ```cpp
+     * std::string command = builder.create_command();
+     * ```
+     */
+    std::string create_command() const {
+        return self.command_line(
+            self.create_command_arguments(), self.response_file());
+    }
+
+    /**
+     * @brief Create the arguments of the one-shot command, the first one
+     * being the compiler
+     *
+     * @return `std::vector<std::string>`
+     */
+    std::vector<std::string> create_command_arguments() const {
+        std::vector<std::string> command;
+
+        command.push_back(self.compiler_executable());
+        self.push_compile_flags(command);
+
+        for (const std::string& file : self.files) {
+            command.push_back(self.command_path(file));
+        }
+        for (const Resource& resource : self.resources) {
+            command.push_back(self.object_file(resource.path));
+        }
+
+        self.push_include_dirs(command);
+
+        const std::string dir = self.output_dir();
+
+        if (dir != "" && self.output != "") {
+            if (!dir_exists(dir)) {
+                createDirectoryRecursively(dir);
+            }
+
+            std::string out_file = dir + "/" + self.output_name();
+            command.push_back("-o");
+            command.push_back(partial(out_file));
+        } else {
+            if (self.output != "") {
+                command.push_back("-o");
+                command.push_back(partial(self.output_name()));
+            }
+        }
+
+        return command;
+    }
+
+    /**
+     * @brief Get the source files of the builder
+     *
+     * @return `const std::vector<std::string>&`
+     */
+    const std::vector<std::string>& get_files() const noexcept {
+        return self.files;
+    }
+
+    /**
+     * @brief Get the language of the source files
+     *
+     * @return `nobpp::Language`
+     */
+    Language get_language() const noexcept {
+        return self.language;
+    }
+
+    /**
+     * @brief Get the compiler executable, e.g. `clang++`
+     *
+     * @return `std::string`
+     */
+    std::string compiler_executable() const {
+        if (self.toolchain) {
+            return self.toolchain->compiler(self.language);
+        }
+
+        switch (self.compiler) {
+            case Compiler::clang:
+                return self.language == Language::c ? "clang" : "clang++";
+            case Compiler::gcc:
+                return self.language == Language::c ? "gcc" : "g++";
+        }
+
+        return "clang++";
+    }
+
+    /**
+     * @brief Get the compile flags shared by every translation unit, without
+     * include directories
+     *
+     * @param source Source file the flags compile, adds the `-frandom-seed=`
+     * of reproducible gcc builds when set
+     * @return `std::vector<std::string>`
+     */
+    std::vector<std::string> compile_flags(
+        const std::string& source = "") const {
+        std::vector<std::string> flags;
+        self.push_compile_flags(flags);
+        if (source != "") {
+            self.push_random_seed(flags, source);
+        }
+        return flags;
+    }
+
+    /**
+     * @brief Get the path of the final output file
+     *
+     * @return `std::string`
+     */
+    std::string output_file() const {
+        const std::string dir = self.output_dir();
+
+        if (dir != "") {
+            return dir + "/" + self.output_name();
+        }
+
+        return self.output_name();
+    }
+
+    /**
+     * @brief Get the object file a source file is compiled into
+     *
+     * Objects are placed under `<output_dir>/obj/`, mirroring the layout of
+     * the source tree so equally named files in different directories do not
+     * collide.
+     *
+     * @param source The source file
+     * @return `std::string`
+     * @code
+     * ```cpp
+     * builder.object_file("./src/main.cpp"); // ./bin/obj/src/main.cpp.o
+     * ```
+     * @endcode
+     */
+    std::string object_file(const std::string& source) const {
+        std::string relative = source;
+        std::replace(relative.begin(), relative.end(), '\\', '/');
+
+        while (relative.compare(0, 2, "./") == 0) {
+            relative = relative.substr(2);
+        }
+
+        std::vector<std::string> parts = split(relative, '/');
+
+        for (std::string& part : parts) {
+            if (part == "..") {
+                part = "__";
+            } else if (part.size() > 1 && part[1] == ':') {
+                part.erase(1, 1);
+            }
+        }
+
+        const std::string dir = self.output_dir();
+        const std::string object_dir = dir == "" ? "obj" : dir + "/obj";
+
+        return object_dir + "/" + join(parts, '/') + ".o";
+    }
+
+    /**
+     * @brief Get the depfile written next to the object of a source file
+     *
+     * @param source The source file
+     * @return `std::string`
+     */
+    std::string depfile(const std::string& source) const {
+        return self.object_file(source) + ".d";
+    }
+
+    /**
+     * @brief Get the prerequisites listed in the depfile of a source file
+     *
+     * They come from the deps log `<state_dir>/deps`, the depfile is only
+     * parsed if it changed since it was logged.
+     *
+     * @param source The source file
+     * @param dependencies Receives the prerequisites in order
+     * @param log Log a depfile that changed, `false` for lookups that must
+     * not write to the build directory
+     * @return `false` if the depfile could not be read
+     */
+    bool read_dependencies(const std::string& source,
+        std::vector<const std::string*>& dependencies, bool log = true) const {
+        return DepsLog::open(self.state_dir() + "/deps")
+            .get(self.depfile(source), dependencies, log);
+    }
+
+    /**
+     * @brief Hash the content of files in parallel, memoised in
+     * `<state_dir>/hashes`, or `<state_dir>/sha256` for SHA-256
+     *
+     * @param files The files
+     * @param digest XXH64 for local checks, SHA-256 for shared cache keys
+     * @return lowercase hex digits for each file, empty for files that
+     * could not be read
+     */
+    std::vector<std::string> hash_files(const std::vector<std::string>& files,
+        Digest digest = Digest::xxh64) const {
+        return HashCache::open(self.state_dir() +
+                                   (digest == Digest::sha256 ? "/sha256"
+                                                             : "/hashes"),
+            digest)
+            .hash(files);
+    }
+
+    /**
+     * @brief Get the split debug information file of a source file
+     *
+     * @param source The source file
+     * @return the object file with `.dwo` appended, as objects are written
+     * to `<object>.tmp` first and the compiler replaces that extension
+     */
+    std::string dwo_file(const std::string& source) const {
+        return dwo_of(self.object_file(source));
+    }
+
+    /**
+     * @brief Check if the objects keep their debug information in `.dwo`
+     * files
+     */
+    bool get_split_debug_info() const noexcept {
+        return self.split_debug_info;
+    }
+
+    /**
+     * @brief Check if a `.dwp` package is created after linking
+     */
+    bool packages_debug_info() const noexcept {
+        return self.debug_package &&
+               self.output_type != OutputType::static_library;
+    }
+
+    /**
+     * @brief Get the package the `.dwo` files are packed into
+     *
+     * @return `<output_file>.dwp`
+     */
+    std::string debug_package_file() const {
+        return self.output_file() + ".dwp";
+    }
+
+    /**
+     * @brief Get the shared build cache, `nullptr` if there is none
+     */
+    const std::shared_ptr<cache::Client>& get_cache() const noexcept {
+        return self.cache;
+    }
+
+    /**
+     * @brief Hash of the command compiling a source file, recorded next to
+     * the object so changed flags cause a rebuild
+     *
+     * @param source The source file
+     * @return `std::string`
+     */
+    std::string compile_hash(const std::string& source) const {
+        sha256::Hasher hasher;
+
+        for (const std::string& argument :
+            self.create_compile_arguments(source)) {
+            hasher.update(argument).update("", 1);
+        }
+
+        return hasher.hex_digest();
+    }
+
+    /**
+     * @brief Hash of the link command, recorded in the state directory
+     *
+     * @return `std::string`
+     */
+    std::string link_hash() const {
+        sha256::Hasher hasher;
+
+        for (const std::string& argument : self.create_link_arguments()) {
+            hasher.update(argument).update("", 1);
+        }
+
+        return hasher.hex_digest();
+    }
+
+    /**
+     * @brief Explain why a source file has to be compiled
+     *
+     * The object is out of date if it is missing, was compiled with other
+     * flags, or if the source or a header listed in its depfile is newer.
+     * Nothing is spawned.
+     *
+     * @param source The source file
+     * @param stats Optional cache of file stats shared between calls
+     * @return the reason, empty if the object is up to date
+     * @code
+     * ```cpp
+     * builder.explain_compile("./src/main.cpp"); // "header foo.hpp newer"
+     * ```
+     * @endcode
+     */
+    std::string explain_compile(
+        const std::string& source, StatCache* stats = nullptr) const {
+        const std::string object = self.object_file(source);
+        FileStat object_stat;
+
+        if (!stat_file(object, object_stat)) {
+            return "object missing";
+        }
+
+        std::string recorded;
+        if (!read_file(object + ".cmd", recorded)) {
+            return "no recorded command";
+        }
+        if (recorded.substr(0, recorded.find('\n')) !=
+            self.compile_hash(source)) {
+            return "flags hash changed";
+        }
+
+        std::vector<const std::string*> dependencies;
+        if (!self.read_dependencies(source, dependencies, false)) {
+            return "depfile missing";
+        }
+
+        for (const std::string* entry : dependencies) {
+            const std::string& dependency = *entry;
+            FileStat dependency_stat;
+            const bool exists = stats != nullptr
+                                    ? stats->stat(dependency, dependency_stat)
+                                    : stat_file(dependency, dependency_stat);
+
+            if (!exists) {
+                return dependency + " missing";
+            }
+            if (dependency_stat.mtime > object_stat.mtime) {
+                return (dependency == source ? "source " : "header ") +
+                       dependency + " newer";
+            }
+        }
+
+        return "";
+    }
+
+    /**
+     * @brief Check whether the source and headers of an object still have
+     * the content it was compiled from
+     *
+     * Called for objects `explain_compile()` finds out of date, catches
+     * files that were touched or checked out again without a change. The
+     * content hashes are memoised in `<state_dir>/hashes`.
+     *
+     * @param source The source file
+     * @return true if the object does not have to be compiled
+     */
+    bool inputs_unchanged(const std::string& source) const {
+        const std::string object = self.object_file(source);
+        std::string recorded;
+        FileStat object_stat;
+
+        if (!stat_file(object, object_stat) ||
+            !read_file(object + ".cmd", recorded)) {
+            return false;
+        }
+
+        const size_t newline = recorded.find('\n');
+        if (newline == std::string::npos ||
+            recorded.compare(0, newline, self.compile_hash(source)) != 0) {
+            return false;
+        }
+
+        const std::string inputs = self.inputs_hash(source);
+        return inputs != "" && recorded.compare(newline + 1,
+                                   std::string::npos, inputs) == 0;
+    }
+
+    /**
+     * @brief Explain why the output has to be linked
+     *
+     * @param stats Optional cache of file stats shared between calls
+     * @return the reason, empty if the output is up to date
+     */
+    std::string explain_link(StatCache* stats = nullptr) const {
+        FileStat output_stat;
+
+        if (!stat_file(self.output_file(), output_stat)) {
+            return "output missing";
+        }
+
+        std::string recorded;
+        if (!read_file(self.link_record(), recorded)) {
+            return "no recorded command";
+        }
+        if (recorded != self.link_hash()) {
+            return "link command changed";
+        }
+
+        std::vector<std::string> objects;
+        for (const std::string& source : self.files) {
+            objects.push_back(self.object_file(source));
+        }
+        for (const Resource& resource : self.resources) {
+            objects.push_back(self.object_file(resource.path));
+        }
+
+        for (const std::string& object : objects) {
+            FileStat object_stat;
+            const bool exists = stats != nullptr
+                                    ? stats->stat(object, object_stat)
+                                    : stat_file(object, object_stat);
+
+            if (!exists) {
+                return "object " + object + " missing";
+            }
+            if (object_stat.mtime > output_stat.mtime) {
+                return "object " + object + " newer";
+            }
+        }
+
+        if (self.output_type == OutputType::static_library) {
+            return "";
+        }
+
+        for (const std::string& library : self.library_outputs()) {
+            FileStat library_stat;
+
+            if (!stat_file(library, library_stat)) {
+                return "library " + library + " missing";
+            }
+            if (library_stat.mtime > output_stat.mtime) {
+                return "library " + library + " newer";
+            }
+        }
+
+        return "";
+    }
+
+    /**
+     * @brief Explain why the `.dwo` files have to be packaged
+     *
+     * @return the reason, empty if the package is up to date
+     */
+    std::string explain_package() const {
+        FileStat output_stat;
+        FileStat package_stat;
+
+        if (!stat_file(self.debug_package_file(), package_stat)) {
+            return "package missing";
+        }
+        if (!stat_file(self.output_file(), output_stat) ||
+            output_stat.mtime > package_stat.mtime) {
+            return "output newer";
+        }
+
+        return "";
+    }
+
+    /**
+     * @brief Record the command an object was compiled with, called after
+     * it was compiled successfully
+     *
+     * @param source The source file
+     */
+    void record_compile(const std::string& source) const {
+        write_file(self.object_file(source) + ".cmd",
+            self.compile_hash(source) + "\n" + self.inputs_hash(source));
+    }
+
+    /**
+     * @brief Get the directory nobpp keeps its state files in
+     *
+     * @return `<output_dir>/.nobpp`
+     */
+    std::string state_dir() const {
+        const std::string dir = self.output_dir();
+
+        return dir == "" ? ".nobpp" : dir + "/.nobpp";
+    }
+
+    /**
+     * @brief Share compiled objects through a content addressed cache
+     *
+     * Every translation unit is preprocessed first, the cache is consulted
+     * with the hash of the compiler, the flags and the preprocessed source
+     * and the compiler only runs on a miss, compiling the preprocessed
+     * source. With a toolchain set, the compiler version is part of the
+     * hash as well.
+     *
+     * @param cache The cache client, may be shared between builders
+     * @return `nobpp::CommandBuilder&`
+     * @code
+     * ```cpp
+     * builder.set_cache(std::make_shared<nobpp::cache::Client>(
+     *     std::make_shared<nobpp::cache::DirectoryBackend>("./.cache")));
+     * ```
+     * @endcode
+     */
+    CommandBuilder& set_cache(std::shared_ptr<cache::Client> cache) noexcept {
+        self.cache = std::move(cache);
+        return self;
+    }
+
+    /**
+     * @brief Create the command compiling a single source file into its
+     * object file
+     *
+     * Like `create_command`, the command writes `<object>.tmp`, renamed by
+     * `compile` once it succeeded.
+     *
+     * @param source The source file
+     * @return `std::string`
+     * @code
+     * ```cpp
+     * std::string command = builder.create_compile_command("./src/main.cpp");
+     * ```
+     * @endcode
+     */
+    std::string create_compile_command(const std::string& source) const {
+        return self.command_line(self.create_compile_arguments(source),
+            self.object_file(source) + ".rsp");
+    }
+
+    /**
+     * @brief Create the arguments of the command compiling a single source
+     * file, the first one being the compiler
+     *
+     * @param source The source file
+     * @param preprocessed The preprocessed source of `source` written by
+     * `preprocess`, compiled instead of it. The depfile is then left to the
+     * preprocessor.
+     * @return `std::vector<std::string>`
+     */
+    std::vector<std::string> create_compile_arguments(
+        const std::string& source, const std::string& preprocessed = "") const {
+        std::vector<std::string> command;
+
+        command.push_back(self.compiler_executable());
+        self.push_compile_flags(command);
+        if (preprocessed == "") {
+            self.push_include_dirs(command);
+            self.push_depfile_flags(command, source);
+        }
+
+        self.push_random_seed(command, source);
+
+        command.push_back("-c");
+        command.push_back(
+            preprocessed == "" ? self.command_path(source) : preprocessed);
+        command.push_back("-o");
+        command.push_back(partial(self.object_file(source)));
+
+        return command;
+    }
+
+    /**
+     * @brief Create the command preprocessing a single source file
+     *
+     * @param source The source file
+     * @param out The file the preprocessed source is written to
+     * @return `std::string`
+     */
+    std::string create_preprocess_command(
+        const std::string& source, const std::string& out) const {
+        std::vector<std::string> command;
+
+        command.push_back(self.compiler_executable());
+        self.push_compile_flags(command);
+        self.push_include_dirs(command);
+        self.push_depfile_flags(command, source);
+
+        // gcc writes the working directory into the preprocessed source
+        // when compiling with debug information
+        if (self.reproducible && self.compiler_family() == Compiler::gcc) {
+            command.push_back("-fno-working-directory");
+        }
+
+        command.push_back("-E");
+        command.push_back(self.command_path(source));
+        command.push_back("-o");
+        command.push_back(out);
+
+        return self.with_environment(create_command_line(command));
+    }
+
+    /**
+     * @brief Create the command linking every object file into the output
+     *
+     * Like `create_command`, the command writes `<output>.tmp`, renamed by
+     * `link` once it succeeded.
+     *
+     * @return `std::string`
+     */
+    std::string create_link_command() const {
+        return self.command_line(self.create_link_arguments(),
+            self.response_file(), self.link_prefix_size());
+    }
+
+    /**
+     * @brief Create the arguments of the link command, the first one being
+     * the linker or the archiver
+     *
+     * @return `std::vector<std::string>`
+     */
+    std::vector<std::string> create_link_arguments() const {
+        std::vector<std::string> command;
+
+        if (self.output_type == OutputType::static_library) {
+            command.push_back(self.archiver_executable());
+            // `D` stores zero timestamps, owners and modes
+            command.push_back(self.reproducible ? "rcsD" : "rcs");
+            command.push_back(partial(self.output_file()));
+
+            for (const std::string& file : self.files) {
+                command.push_back(self.object_file(file));
+            }
+            for (const Resource& resource : self.resources) {
+                command.push_back(self.object_file(resource.path));
+            }
+
+            return command;
+        }
+
+        command.push_back(self.compiler_executable());
+        self.push_compile_flags(command);
+
+        if (self.toolchain && self.toolchain->get_linker() != "") {
+            command.push_back("-fuse-ld=" + self.toolchain->get_linker());
+        }
+
+        if (self.reproducible && self.links_with_msvc()) {
+            command.push_back("-Wl,/Brepro");
+        } else if (self.reproducible) {
+            command.push_back(self.target_os == TargetOS::windows
+                                  ? "-Wl,--no-insert-timestamp"
+                                  : "-Wl,--build-id=sha1");
+        }
+
+        for (const std::string& file : self.files) {
+            command.push_back(self.object_file(file));
+        }
+        for (const Resource& resource : self.resources) {
+            command.push_back(self.object_file(resource.path));
+        }
+
+        for (const std::string& library : self.library_outputs()) {
+            command.push_back(library);
+        }
+
+        command.push_back("-o");
+        command.push_back(partial(self.output_file()));
+
+        return command;
+    }
+
+    /**
+     * @brief Compile a single source file into its object file
+     *
+     * @param source The source file
+     * @return `true` if the compiler succeeded
+     */
+    bool compile(const std::string& source) const {
+        bool fetched = false;
+        return self.compile(source, fetched);
+    }
+
+    /**
+     * @brief Compile a single source file into its object file
+     *
+     * @param source The source file
+     * @param fetched Set to `true` if the object came from the cache
+     * instead of the compiler
+     * @return `true` if the object was produced
+     */
+    bool compile(const std::string& source, bool& fetched) const {
+#ifndef _WIN32
+        details::SandboxRules rules;
+        const bool sandboxed = self.sandbox_rules(source, rules);
+        details::SandboxScope scope(sandboxed ? &rules : nullptr);
+#endif
+
+        fetched = false;
+        return self.compile_object(source, fetched) &&
+               self.accept_compile(source);
+    }
+
+    /**
+     * @brief Prepare the compile of a source file for a caller running
+     * `command` itself, then passing its exit code to `finish_compile`
+     *
+     * Creates the object directory and writes the response file. The
+     * cache and the Landlock sandbox are not used on this path.
+     *
+     * @param source The source file
+     * @param command Receives the command
+     * @return `false` if the response file could not be written
+     */
+    bool start_compile(const std::string& source, std::string& command) const {
+        const std::string object = self.object_file(source);
+        create_parent_dir(object);
+
+        return self.prepare_command(self.create_compile_arguments(source),
+            object + ".rsp", 1, command);
+    }
+
+    /**
+     * @brief Keep the object of a compile started by `start_compile`
+     *
+     * @param source The source file
+     * @param result Exit code of the command
+     * @return `true` if the object was produced and passed the sandbox
+     * check
+     */
+    bool finish_compile(const std::string& source, int result) const {
+        const std::string object = self.object_file(source);
+
+        return commit_file(result == 0, partial(object), object) &&
+               self.accept_compile(source);
+    }
+
+    /**
+     * @brief Preprocess a single source file
+     *
+     * @param source The source file
+     * @param preprocessed Receives the preprocessed source
+     * @return `true` if the preprocessor succeeded
+     */
+    bool preprocess(
+        const std::string& source, std::string& preprocessed) const {
+        const std::string out = self.object_file(source) + "." +
+                                nanoid::generate(8) +
+                                (self.language == Language::c ? ".i" : ".ii");
+
+        const bool ok = self.preprocess(source, out, preprocessed);
+        std::remove(out.c_str());
+
+        return ok;
+    }
+
+    /**
+     * @brief Preprocess a single source file into `out`
+     *
+     * @param source The source file
+     * @param out The file the preprocessed source is written to, it is kept
+     * @param preprocessed Receives the preprocessed source
+     * @return `true` if the preprocessor succeeded
+     */
+    bool preprocess(const std::string& source, const std::string& out,
+        std::string& preprocessed) const {
+        create_parent_dir(out);
+
+        return create_process(self.create_preprocess_command(source, out)) ==
+                   0 &&
+               read_file(out, preprocessed);
+    }
+
+    /**
+     * @brief Hash identifying the compilation of a preprocessed source
+     *
+     * @param source The source file
+     * @param preprocessed_source The preprocessed source of `source`
+     * @return `std::string`
+     */
+    std::string action_hash(const std::string& source,
+        const std::string& preprocessed_source) const {
+        sha256::Hasher hasher;
+        hasher.update(self.compiler_executable()).update("", 1);
+        hasher.update(self.profile()).update("", 1);
+
+        if (self.toolchain) {
+            hasher.update(self.probed_toolchain().version(self.language))
+                .update("", 1);
+        }
+
+        for (const std::string& flag : self.compile_flags(source)) {
+            // Name the working directory, which they remove from outputs
+            if (flag.compare(0, 18, "-ffile-prefix-map=") == 0 ||
+                flag.compare(0, 19, "-fdebug-prefix-map=") == 0) {
+                continue;
+            }
+            hasher.update(flag).update("", 1);
+        }
+
+        if (self.reproducible) {
+            hasher.update("SOURCE_DATE_EPOCH=" +
+                          std::to_string(self.get_source_date_epoch()))
+                .update("", 1);
+        }
+
+        // Objects refer to their `.dwo` file by path
+        if (self.split_debug_info) {
+            hasher.update(self.output_dir()).update("", 1);
+        }
+
+        return hasher.update(preprocessed_source).hex_digest();
+    }
+
+    /**
+     * @brief Get the cache key of an extra output of an action, a sha256
+     * digest like the action itself so remote caches accept it
+     */
+    static std::string output_action(
+        const std::string& action, const std::string& output) {
+        return sha256::Hasher()
+            .update(action)
+            .update("", 1)
+            .update(output)
+            .hex_digest();
+    }
+
+    /**
+     * @brief Write the cached output of an action to `object`, and to its
+     * `.dwo` file with split debug information
+     *
+     * @return `true` on a cache hit, `false` if there is no cache or on a miss
+     */
+    bool fetch_from_cache(
+        const std::string& action, const std::string& object) const {
+        std::string blob;
+
+        if (!self.cache || !self.cache->fetch(action, blob)) {
+            return false;
+        }
+
+        if (self.split_debug_info) {
+            std::string dwo;
+
+            if (!self.cache->fetch(output_action(action, "dwo"), dwo) ||
+                !write_file(dwo_of(object), dwo)) {
+                return false;
+            }
+        }
+
+        return write_file(object, blob);
+    }
+
+    /**
+     * @brief Upload `object`, and its `.dwo` file with split debug
+     * information, as the output of an action in the background
+     */
+    void store_in_cache(
+        const std::string& action, const std::string& object) const {
+        std::string blob;
+
+        if (!self.cache || !read_file(object, blob)) {
+            return;
+        }
+
+        if (self.split_debug_info) {
+            std::string dwo;
+
+            if (!read_file(dwo_of(object), dwo)) {
+                return;
+            }
+            self.cache->store_async(
+                output_action(action, "dwo"), std::move(dwo));
+        }
+
+        self.cache->store_async(action, std::move(blob));
+    }
+
+    /**
+     * @brief Link every object file into the output
+     *
+     * @return `true` if the linker succeeded
+     */
+    bool link() const {
+        std::string command;
+
+        return self.start_link(command) &&
+               self.finish_link(create_process(command));
+    }
+
+    /**
+     * @brief Prepare the link for a caller running `command` itself, then
+     * passing its exit code to `finish_link`
+     *
+     * @param command Receives the command
+     * @return `false` if the response file could not be written
+     */
+    bool start_link(std::string& command) const {
+        const std::string output = self.output_file();
+        create_parent_dir(output);
+
+        // Archivers add to an existing archive instead of replacing it
+        if (self.output_type == OutputType::static_library) {
+            std::remove(partial(output).c_str());
+        }
+
+        return self.prepare_command(self.create_link_arguments(),
+            self.response_file(), self.link_prefix_size(), command);
+    }
+
+    /**
+     * @brief Keep the output of a link started by `start_link`
+     *
+     * @param result Exit code of the command
+     * @return `true` if the output was produced
+     */
+    bool finish_link(int result) const {
+        const std::string output = self.output_file();
+
+        if (!commit_file(result == 0, partial(output), output)) {
+            return false;
+        }
+
+        create_parent_dir(self.link_record());
+        write_file(self.link_record(), self.link_hash());
+        return true;
+    }
+
+    /**
+     * @brief Create the command packaging the `.dwo` files of the output
+     *
+     * @return `std::string`
+     */
+    std::string create_package_command() const {
+        const std::string dwp =
+            self.toolchain ? self.toolchain->get_dwp() : "llvm-dwp";
+
+        return dwp + " -e " + self.output_file() + " -o " +
+               partial(self.debug_package_file());
+    }
+
+    /**
+     * @brief Package the `.dwo` files of the linked output
+     *
+     * @return `true` if the packaging succeeded
+     */
+    bool package_debug_info() const {
+        const std::string package = self.debug_package_file();
+        const int result = create_process(self.create_package_command());
+
+        return commit_file(result == 0, partial(package), package);
+    }
+
+    /**
+     * @brief Run the command
+     *
+     * @code
+     * ```cpp
+     * builder.run();
+     * ```
+     * @endcode
+     */
+    void run() const {
+        if (!self.variants.empty()) {
+            // No variant is built unless all of them are valid
+            std::vector<CommandBuilder> variants;
+            variants.reserve(self.variants.size());
+            for (const Variant& variant : self.variants) {
+                variants.push_back(self.with_variant(variant));
+                variants.back().validate();
+            }
+
+            for (const CommandBuilder& variant : variants) {
+                variant.run();
+            }
+            return;
+        }
+
+        self.validate();
+
+        for (const CustomCommand& command : self.custom_commands) {
+            if (self.explain_custom_command(command) != "" &&
+                !self.run_custom_command(command)) {
+                std::cout << "Custom command " << command.name << " failed\n";
+                return;
+            }
+        }
+
+        if (!self.write_resource_header()) {
+            std::cout << "Could not write " << self.resource_header() << "\n";
+            return;
+        }
+        for (const Resource& resource : self.resources) {
+            if (self.explain_resource(resource) != "" &&
+                !self.embed_resource(resource)) {
+                std::cout << "Failed to embed " << resource.path << "\n";
+                return;
+            }
+        }
+
+        if (self.output_type == OutputType::static_library) {
+            bool compiled = true;
+            for (const std::string& file : self.files) {
+                compiled = self.compile(file) && compiled;
+            }
+
+            if (compiled && self.link()) {
+                std::cout << "Archive " << self.output_file() << " created\n";
+            }
+            return;
+        }
+
+        // A single compile and link command would scatter the `.dwo` files
+        if (self.split_debug_info) {
+            bool compiled = true;
+            for (const std::string& file : self.files) {
+                compiled = self.compile(file) && compiled;
+            }
+
+            if (compiled && self.link() &&
+                (!self.packages_debug_info() || self.package_debug_info())) {
+                std::cout << "Linked " << self.output_file() << "\n";
+            }
+            return;
+        }
+
+        const int result = self.run_command(
+            self.create_command_arguments(), self.response_file());
+
+        if (self.output != "") {
+            commit_file(
+                result == 0, partial(self.output_file()), self.output_file());
+        }
+
+        if (self.project_name == "") {
+            std::cout << "Compile finished\n";
+        } else {
+            std::cout << "Project " << self.project_name
+                      << " compile finished\n";
+        }
+    }
+
+private:
+    CommandBuilder& self = *this;
+
+    CommandBuilder& add_directory(const std::string& directory,
+        const std::function<bool(const std::string&)>& file_predicate,
+        bool recursive) {
+        metrics::ScopedTimer timer(metrics::global().scan_ns);
+        std::vector<std::string> found =
+            readdir(directory, file_predicate, recursive);
+
+        // Directory order depends on the file system, sorted files give the
+        // same command lines on every machine
+        std::sort(found.begin(), found.end());
+        self.files.insert(self.files.end(), found.begin(), found.end());
+        return self;
+    }
+
+    bool compile_object(const std::string& source, bool& fetched) const {
+        const std::string object = self.object_file(source);
+        create_parent_dir(object);
+
+        if (!self.cache) {
+            return self.run_compiler(source);
+        }
+
+        // Compiled on a miss, so the source is preprocessed only once
+        const std::string out =
+            object + (self.language == Language::c ? ".i" : ".ii");
+        std::string preprocessed;
+        if (!self.preprocess(source, out, preprocessed)) {
+            std::remove(out.c_str());
+            return false;
+        }
+
+        const std::string action = self.action_hash(source, preprocessed);
+        fetched = self.fetch_from_cache(action, object);
+        bool compiled = fetched;
+
+        if (!compiled && self.run_compiler(source, out)) {
+            self.store_in_cache(action, object);
+            compiled = true;
+        }
+        std::remove(out.c_str());
+
+        return compiled;
+    }
+
+    bool run_compiler(
+        const std::string& source, const std::string& preprocessed = "") const {
+        const std::string object = self.object_file(source);
+        const std::vector<std::string> arguments =
+            self.create_compile_arguments(source, preprocessed);
+
+        const int result = self.run_command(arguments, object + ".rsp");
+
+        return commit_file(result == 0, partial(object), object);
+    }
+
+    std::string link_record() const {
+        const std::string name = self.output == "" ? "a" : self.output_name();
+
+        return self.state_dir() + "/" + name + ".cmd";
+    }
+
+    std::string resource_stub(const Resource& resource) const {
+        const std::string object = self.object_file(resource.path);
+
+        return object.substr(0, object.size() - 2) + ".s";
+    }
+
+    // Identifies the stub and how it is assembled, not the content
+    std::string resource_hash(const Resource& resource) const {
+        sha256::Hasher hasher;
+
+        for (const std::string& argument :
+            self.create_resource_arguments(resource)) {
+            hasher.update(argument).update("", 1);
+        }
+
+        return hasher.update(self.create_resource_stub(resource)).hex_digest();
+    }
+
+    // Variants share the outputs of their custom commands, so the record too
+    std::string custom_command_record(const CustomCommand& command) const {
+        return self.get_origin().state_dir() + "/gen/" + command.name + ".cmd";
+    }
+
+    static std::string custom_command_hash(const CustomCommand& command) {
+        sha256::Hasher hasher;
+        hasher.update(command.command).update("", 1);
+
+        for (const std::string& input : command.inputs) {
+            hasher.update(input).update("", 1);
+        }
+        hasher.update("", 1);
+        for (const std::string& output : command.outputs) {
+            hasher.update(output).update("", 1);
+        }
+
+        return hasher.hex_digest();
+    }
+
+    // Cache key of the outputs, `""` if an input can not be read
+    std::string custom_command_action(const CustomCommand& command) const {
+        sha256::Hasher hasher;
+        hasher.update(custom_command_hash(command)).update("", 1);
+
+        for (const std::string& content :
+            self.hash_files(command.inputs, Digest::sha256)) {
+            if (content == "") {
+                return "";
+            }
+            hasher.update(content).update("", 1);
+        }
+
+        return hasher.hex_digest();
+    }
+
+    bool fetch_outputs(const std::string& action,
+        const std::vector<std::string>& outputs) const {
+        std::vector<std::string> blobs(outputs.size());
+
+        for (size_t i = 0; i < outputs.size(); ++i) {
+            if (!self.cache->fetch(
+                    output_action(action, std::to_string(i)), blobs[i])) {
+                return false;
+            }
+        }
+
+        for (size_t i = 0; i < outputs.size(); ++i) {
+            if (!write_file(outputs[i], blobs[i])) {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    void store_outputs(const std::string& action,
+        const std::vector<std::string>& outputs) const {
+        for (size_t i = 0; i < outputs.size(); ++i) {
+            std::string blob;
+
+            if (read_file(outputs[i], blob)) {
+                self.cache->store_async(
+                    output_action(action, std::to_string(i)), std::move(blob));
+            }
+        }
+    }
+
+    bool is_source(const std::string& path) const {
+        return std::any_of(self.files.begin(), self.files.end(),
+            [&path](const std::string& file) {
+                return same_path(file, path);
+            });
+    }
+
+    static bool same_path(const std::string& a, const std::string& b) {
+        size_t a_start = 0;
+        size_t b_start = 0;
+
+        while (a.compare(a_start, 2, "./") == 0) {
+            a_start += 2;
+        }
+        while (b.compare(b_start, 2, "./") == 0) {
+            b_start += 2;
+        }
+
+        return a.compare(a_start, std::string::npos, b, b_start,
+                   std::string::npos) == 0;
+    }
+
+    std::string test_record(const Test& test, unsigned shard) const {
+        const std::string name = self.output == "" ? "a" : self.output_name();
+
+        return self.state_dir() + "/" + name + "." + test.name + "." +
+               std::to_string(shard) + ".pass";
+    }
+
+    std::string test_hash(const Test& test, unsigned shard) const {
+        sha256::Hasher hasher;
+        hasher.update(self.create_test_command(test, shard))
+            .update("", 1)
+            .update(std::to_string(test.timeout_seconds));
+
+        return hasher.hex_digest();
+    }
+
+    std::string response_file() const {
+        const std::string name = self.output == "" ? "a" : self.output_name();
+
+        return self.state_dir() + "/" + name + ".rsp";
+    }
+
+    bool needs_response_file(const std::vector<std::string>& command) const {
+        if (self.response_file_threshold == 0 || command.size() < 2) {
+            return false;
+        }
+
+        size_t size = command.size() - 1;
+        for (const std::string& argument : command) {
+            size += argument.size();
+        }
+
+        return size > self.response_file_threshold;
+    }
+
+    // Archivers only read their operation and archive from the command line
+    size_t link_prefix_size() const noexcept {
+        return self.output_type == OutputType::static_library ? 3 : 1;
+    }
+
+    std::string command_line(const std::vector<std::string>& command,
+        const std::string& response_file, size_t prefix_size = 1) const {
+        if (!self.needs_response_file(command)) {
+            return create_command_line(command);
+        }
+
+        const std::vector<std::string> prefix(
+            command.begin(), command.begin() + prefix_size);
+
+        return create_command_line(prefix) + " " +
+               quote_shell_argument("@" + response_file);
+    }
+
+    // Like `create_process(command_line(...))` but writes the response file
+    // first when the command needs one
+    int run_command(const std::vector<std::string>& command,
+        const std::string& response_file, size_t prefix_size = 1) const {
+        std::string line;
+        if (!self.prepare_command(command, response_file, prefix_size, line)) {
+            return -1;
+        }
+
+        return create_process(line);
+    }
+
+    // The shell command of `run_command`, after writing its response file
+    bool prepare_command(const std::vector<std::string>& command,
+        const std::string& response_file, size_t prefix_size,
+        std::string& line) const {
+        if (self.needs_response_file(command)) {
+            create_parent_dir(response_file);
+
+            if (!write_file_if_changed(response_file,
+                    create_response_file(command, prefix_size))) {
+                std::cerr << "Could not write " << response_file << "\n";
+                return false;
+            }
+        }
+
+        line = self.with_environment(
+            self.command_line(command, response_file, prefix_size));
+        return true;
+    }
+
+    // XXH64 over the paths and contents of the files listed in the depfile,
+    // `""` if one of them can not be read
+    std::string inputs_hash(const std::string& source) const {
+        std::vector<const std::string*> dependencies;
+        if (!self.read_dependencies(source, dependencies, false)) {
+            return "";
+        }
+
+        std::vector<std::string> files;
+        for (const std::string* dependency : dependencies) {
+            files.push_back(*dependency);
+        }
+
+        const std::vector<std::string> contents = self.hash_files(files);
+        std::string joined;
+        for (size_t i = 0; i < files.size(); ++i) {
+            if (contents[i] == "") {
+                return "";
+            }
+            joined.append(files[i]).append(1, '\0');
+            joined.append(contents[i]).append(1, '\n');
+        }
+
+        return xxh64::hex_digest(joined);
+    }
+
+    // Checks and records a compile that produced its object
+    bool accept_compile(const std::string& source) const {
+        if (!self.check_declared_inputs(source)) {
+            return false;
+        }
+
+        self.record_compile(source);
+
+        // Logged now, so the next run does not have to parse it
+        std::vector<const std::string*> dependencies;
+        self.read_dependencies(source, dependencies);
+
+        return true;
+    }
+
+    // Paths as written on command lines, relative to the working directory
+    // in reproducible mode so they do not differ between machines. Paths
+    // sharing only the root with it, like system headers, stay absolute.
+    std::string command_path(const std::string& path) const {
+        if (!self.reproducible) {
+            return path;
+        }
+
+        const std::string cwd = current_dir();
+        const std::string absolute = absolute_path(path, cwd);
+
+        if (absolute == cwd) {
+            return ".";
+        }
+        if (absolute.compare(0, cwd.size() + 1, cwd + "/") == 0) {
+            return absolute.substr(cwd.size() + 1);
+        }
+
+        // Siblings such as `../third_party`, through the common parent
+        const std::vector<std::string> to = split(absolute, '/');
+        const std::vector<std::string> from = split(cwd, '/');
+        size_t common = 0;
+        while (common < to.size() && common < from.size() &&
+               to[common] == from[common]) {
+            ++common;
+        }
+        if (common < 2) {
+            return absolute;
+        }
+
+        std::string relative;
+        for (size_t i = common; i < from.size(); ++i) {
+            relative += "../";
+        }
+        for (size_t i = common; i < to.size(); ++i) {
+            relative += to[i] + (i + 1 < to.size() ? "/" : "");
+        }
+
+        return relative;
+    }
+
+    // gcc seeds the names of some symbols randomly otherwise. The source
+    // path is part of the preprocessed source, so of cache keys.
+    void push_random_seed(
+        std::vector<std::string>& command, const std::string& source) const {
+        if (self.reproducible && self.compiler_family() == Compiler::gcc) {
+            command.push_back("-frandom-seed=" + self.command_path(source));
+        }
+    }
+
+    // clang targeting the MSVC ABI links with `link.exe` or `lld-link`,
+    // which take MSVC options, gcc and MinGW targets with GNU ld or lld
+    bool links_with_msvc() const {
+        if (self.target_os != TargetOS::windows ||
+            self.compiler_family() == Compiler::gcc) {
+            return false;
+        }
+
+        std::vector<std::string> words = self.options;
+        words.push_back(self.compiler_executable());
+        for (const std::string& word : words) {
+            if (word.find("msvc") != std::string::npos) {
+                return true;
+            }
+            if (word.find("mingw") != std::string::npos ||
+                word.find("windows-gnu") != std::string::npos) {
+                return false;
+            }
+        }
+
+        // The default target of clang matches the ABI nobpp was built with
+#if defined(_WIN32) && !defined(__MINGW32__)
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    std::string with_environment(const std::string& command) const {
+        if (!self.reproducible) {
+            return command;
+        }
+
+        const std::string epoch =
+            std::to_string(self.get_source_date_epoch());
+#ifdef _WIN32
+        return "cmd /C \"set SOURCE_DATE_EPOCH=" + epoch + "&& " + command +
+               "\"";
+#else
+        return "SOURCE_DATE_EPOCH=" + epoch + " " + command;
+#endif
+    }
+
+    void collect_libraries(
+        std::vector<std::string>& libraries, size_t depth) const {
+        if (depth > 64) {
+            throw std::invalid_argument(
+                "Dependency cycle through " + self.get_name() + ".");
+        }
+
+        for (const CommandBuilder* dependency : self.dependencies) {
+            const CommandBuilder resolved =
+                self.resolve_dependency(*dependency);
+
+            if (resolved.output_type == OutputType::executable) {
+                continue;
+            }
+
+            libraries.push_back(resolved.output_file());
+            resolved.collect_libraries(libraries, depth + 1);
+        }
+    }
+
+    static std::string dwo_of(const std::string& object) {
+        return object + ".dwo";
+    }
+
+    // Compilers and linkers write to this file, which is only renamed to
+    // `path` once they succeeded, so an interrupted build never leaves a
+    // partial output that looks up to date
+    static std::string partial(const std::string& path) {
+        return path + ".tmp";
+    }
+
+    Compiler compiler_family() const noexcept {
+        return self.toolchain ? self.toolchain->get_family() : self.compiler;
+    }
+
+    // The toolchain, which must be set, caching its probes next to the
+    // other state files unless it was given its own cache directory
+    Toolchain& probed_toolchain() const {
+        self.toolchain->set_default_cache_dir(self.state_dir() + "/toolchains");
+        return *self.toolchain;
+    }
+
+    std::string archiver_executable() const {
+        if (self.toolchain) {
+            return self.toolchain->get_archiver();
+        }
+
+        return self.compiler == Compiler::gcc ? "gcc-ar" : "llvm-ar";
+    }
+
+    std::string output_name() const {
+        if (self.output_type == OutputType::executable &&
+            self.target_os == TargetOS::windows &&
+            self.output.find(".exe") == std::string::npos) {
+            return self.output + ".exe";
+        }
+
+        return self.output;
+    }
+
+    void push_compile_flags(std::vector<std::string>& command) const {
+        switch (self.optimization_level) {
+            case OptimizationLevel::o0:
+                command.push_back("-O0");
+                break;
+            case OptimizationLevel::o1:
+                command.push_back("-O1");
+                break;
+            case OptimizationLevel::o2:
+                command.push_back("-O2");
+                break;
+            case OptimizationLevel::o3:
+                command.push_back("-O3");
+                break;
+            case OptimizationLevel::os:
+                command.push_back("-Os");
+                break;
+            case OptimizationLevel::oz:
+                command.push_back("-Oz");
+                break;
+        }
+
+        if (self.mode == Mode::debug) {
+            command.push_back("-g");
+        }
+
+        if (self.split_debug_info) {
+            command.push_back("-gsplit-dwarf");
+        }
+
+        if (self.compress_debug_sections) {
+            command.push_back("-gz");
+        }
+
+        if (self.reproducible) {
+            const std::string cwd = current_dir();
+            command.push_back("-ffile-prefix-map=" + cwd + "=.");
+            command.push_back("-fdebug-prefix-map=" + cwd + "=.");
+
+            // COFF objects of the MSVC ABI carry a timestamp otherwise
+            if (self.links_with_msvc()) {
+                command.push_back("-mno-incremental-linker-compatible");
+            }
+        }
+
+        self.push_instrumentation_flags(command);
+
+        for (const std::string& option : self.options) {
+            command.push_back(option);
+        }
+    }
+
+    void push_instrumentation_flags(std::vector<std::string>& command) const {
+        std::vector<std::string> names;
+
+        if (has_sanitizer(self.sanitizers, Sanitizer::address)) {
+            names.push_back("address");
+        }
+        if (has_sanitizer(self.sanitizers, Sanitizer::undefined)) {
+            names.push_back("undefined");
+        }
+        if (has_sanitizer(self.sanitizers, Sanitizer::thread)) {
+            names.push_back("thread");
+        }
+        if (has_sanitizer(self.sanitizers, Sanitizer::memory)) {
+            names.push_back("memory");
+        }
+        if (has_sanitizer(self.sanitizers, Sanitizer::leak)) {
+            names.push_back("leak");
+        }
+
+        if (!names.empty()) {
+            command.push_back("-fsanitize=" + join(names, ','));
+            command.push_back("-fno-omit-frame-pointer");
+        }
+
+        switch (self.coverage) {
+            case Coverage::none:
+                break;
+            case Coverage::gcov:
+                command.push_back("--coverage");
+                break;
+            case Coverage::llvm:
+                command.push_back("-fprofile-instr-generate");
+                command.push_back("-fcoverage-mapping");
+                break;
+        }
+    }
+
+    void push_include_dirs(std::vector<std::string>& command) const {
+        for (const std::string& include_dir : self.include_dirs) {
+            command.push_back("-I" + self.command_path(include_dir));
+        }
+
+        if (!self.resources.empty()) {
+            const std::string header = self.resource_header();
+            command.push_back(
+                "-I" + header.substr(0, header.find_last_of('/')));
+        }
+    }
+
+    void push_depfile_flags(
+        std::vector<std::string>& command, const std::string& source) const {
+        command.push_back("-MD");
+        command.push_back("-MF");
+        command.push_back(self.depfile(source));
+        command.push_back("-MT");
+        command.push_back(self.object_file(source));
+    }
+
+private:
+    std::string project_name = "";
+    Compiler compiler = Compiler::clang;
+    Language language = Language::cpp;
+#ifdef _WIN32
+    TargetOS target_os = TargetOS::windows;
+#else
+    TargetOS target_os = TargetOS::linux;
+#endif
+    Mode mode = Mode::release;
+    OptimizationLevel optimization_level = OptimizationLevel::o3;
+    std::vector<std::string> include_dirs;
+    std::vector<std::string> files;
+    std::vector<std::string> options;
+    std::string build_dir;
+    std::string output;
+    OutputType output_type = OutputType::executable;
+    std::shared_ptr<Toolchain> toolchain;
+    bool implicit_toolchain = false;
+#ifdef _WIN32
+    // CreateProcessW takes at most 32767 characters
+    size_t response_file_threshold = 30000;
+#else
+    // `sh -c` gets the command as one argument, capped by MAX_ARG_STRLEN
+    size_t response_file_threshold = 100000;
+#endif
+    Sanitizer sanitizers = Sanitizer::none;
+    Coverage coverage = Coverage::none;
+    bool split_debug_info = false;
+    bool compress_debug_sections = false;
+    bool debug_package = false;
+    std::vector<Variant> variants;
+    std::string variant_name;
+    const CommandBuilder* origin = nullptr;
+    std::vector<const CommandBuilder*> dependencies;
+    std::vector<Test> tests;
+    std::vector<CustomCommand> custom_commands;
+    std::vector<Resource> resources;
+    Sandbox sandbox = Sandbox::none;
+    std::vector<std::string> sandbox_dirs;
+    bool reproducible = false;
+    /// `-1` to use the environment
+    int64_t source_date_epoch = -1;
+    std::shared_ptr<cache::Client> cache;
+};
+
+#ifndef _WIN32
+/**
+ * @brief Remote compilation over Unix domain sockets
+ *
+ * The client preprocesses a translation unit locally and ships the
+ * preprocessed source together with the compile flags to a `nobpp-worker`
+ * daemon. The worker compiles it and sends the object file back, so the
+ * worker does not need access to the headers of the project.
+ *
+ * The worker only runs compilers it allows and starts them without a
+ * shell, but the flags are passed on as they are. Anyone able to connect to
+ * the socket can therefore run code as the worker user, so keep it in a
+ * directory only the build user can access.
+ *
+ * Every message on the socket is framed as
+ * `magic (u32) | kind (u32) | size (u64) | payload`, integers are little
+ * endian and strings inside a payload are prefixed with their size (u64).
+ */
+namespace remote {
+
+constexpr uint32_t PROTOCOL_MAGIC = 0x5050424e;  // "NBPP"
+
+/// Larger messages are rejected before their payload is allocated
+constexpr uint64_t MAX_MESSAGE_SIZE = uint64_t(1) << 30;
+
+enum struct MessageKind : uint32_t { compile_request = 1, compile_response };
+
+/**
+ * @brief Translation unit shipped to a worker
+ */
+struct CompileRequest {
+    std::string compiler;
+    /// `.i` for C and `.ii` for C++, tells the compiler what it gets
+    std::string extension;
+    std::vector<std::string> flags;
+    std::string preprocessed_source;
+};
+
+/**
+ * @brief Result of a compilation sent back by a worker
+ */
+struct CompileResponse {
+    int32_t exit_code = -1;
+    std::string diagnostics;
+    std::string object;
+};
+
+namespace details {
+inline void put_u32(std::string& out, uint32_t value) {
+    for (int i = 0; i < 4; ++i) {
+        out.push_back(static_cast<char>((value >> (i * 8)) & 0xff));
+    }
+}
+
+inline void put_u64(std::string& out, uint64_t value) {
+    for (int i = 0; i < 8; ++i) {
+        out.push_back(static_cast<char>((value >> (i * 8)) & 0xff));
+    }
+}
+
+inline void put_string(std::string& out, const std::string& value) {
+    put_u64(out, value.size());
+    out += value;
+}
+
+/**
+ * @brief Sequential reader over a received payload
+ */
+class Reader {
+public:
+    Reader(const std::string& data) : data(data) {}
+
+    bool get_u32(uint32_t& value) {
+        if (self.position + 4 > self.data.size()) {
+            return false;
+        }
+
+        value = 0;
+        for (int i = 0; i < 4; ++i) {
+            value |= static_cast<uint32_t>(
+                         static_cast<unsigned char>(self.data[self.position++]))
+                     << (i * 8);
+        }
+
+        return true;
+    }
+
+    bool get_u64(uint64_t& value) {
+        if (self.position + 8 > self.data.size()) {
+            return false;
+        }
+
+        value = 0;
+        for (int i = 0; i < 8; ++i) {
+            value |= static_cast<uint64_t>(
+                         static_cast<unsigned char>(self.data[self.position++]))
+                     << (i * 8);
+        }
+
+        return true;
+    }
+
+    bool get_string(std::string& value) {
+        uint64_t size = 0;
+
+        if (!self.get_u64(size) || size > self.data.size() - self.position) {
+            return false;
+        }
+
+        value = self.data.substr(self.position, size);
+        self.position += size;
+
+        return true;
+    }
+
+private:
+    Reader& self = *this;
+
+    const std::string& data;
+    size_t position = 0;
+};
+
+inline bool write_all(int fd, const char* data, size_t size) {
+    while (size > 0) {
+        ssize_t written = ::send(fd, data, size, MSG_NOSIGNAL);
+
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+
+        data += written;
+        size -= static_cast<size_t>(written);
+    }
+
+    return true;
+}
+
+inline bool read_all(int fd, char* data, size_t size) {
+    while (size > 0) {
+        ssize_t received = ::recv(fd, data, size, 0);
+
+        if (received < 0 && errno == EINTR) {
+            continue;
+        }
+        if (received <= 0) {
+            return false;
+        }
+
+        data += received;
+        size -= static_cast<size_t>(received);
+    }
+
+    return true;
+}
+
+inline bool send_message(
+    int fd, MessageKind kind, const std::string& payload) {
+    std::string header;
+    put_u32(header, PROTOCOL_MAGIC);
+    put_u32(header, static_cast<uint32_t>(kind));
+    put_u64(header, payload.size());
+
+    return write_all(fd, header.data(), header.size()) &&
+           write_all(fd, payload.data(), payload.size());
+}
+
+inline bool receive_message(int fd, MessageKind& kind, std::string& payload) {
+    std::string header(16, '\0');
+
+    if (!read_all(fd, &header[0], header.size())) {
+        return false;
+    }
+
+    Reader reader(header);
+    uint32_t magic = 0;
+    uint32_t raw_kind = 0;
+    uint64_t size = 0;
+    reader.get_u32(magic);
+    reader.get_u32(raw_kind);
+    reader.get_u64(size);
+
+    if (magic != PROTOCOL_MAGIC || size > MAX_MESSAGE_SIZE) {
+        return false;
+    }
+
+    kind = static_cast<MessageKind>(raw_kind);
+    payload.assign(size, '\0');
+
+    return size == 0 || read_all(fd, &payload[0], payload.size());
+}
+
+inline int connect_to(const std::string& socket_path) {
+    sockaddr_un address;
+    std::memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+
+    if (socket_path.size() >= sizeof(address.sun_path)) {
+        return -1;
+    }
+    std::memcpy(address.sun_path, socket_path.c_str(), socket_path.size());
+
+    int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+
+    if (::connect(fd, reinterpret_cast<sockaddr*>(&address),
+            sizeof(address)) != 0) {
+        ::close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+}  // namespace details
+
+inline std::string encode(const CompileRequest& request) {
+    std::string out;
+    details::put_string(out, request.compiler);
+    details::put_string(out, request.extension);
+    details::put_u64(out, request.flags.size());
+    for (const std::string& flag : request.flags) {
+        details::put_string(out, flag);
+    }
+    details::put_string(out, request.preprocessed_source);
+    return out;
+}
+
+inline bool decode(const std::string& payload, CompileRequest& request) {
+    details::Reader reader(payload);
+    uint64_t flag_count = 0;
+
+    if (!reader.get_string(request.compiler) ||
+        !reader.get_string(request.extension) ||
+        !reader.get_u64(flag_count)) {
+        return false;
+    }
+
+    request.flags.clear();
+    for (uint64_t i = 0; i < flag_count; ++i) {
+        std::string flag;
+        if (!reader.get_string(flag)) {
+            return false;
+        }
+        request.flags.push_back(flag);
+    }
+
+    return reader.get_string(request.preprocessed_source);
+}
+
+inline std::string encode(const CompileResponse& response) {
+    std::string out;
+    details::put_u32(out, static_cast<uint32_t>(response.exit_code));
+    details::put_string(out, response.diagnostics);
+    details::put_string(out, response.object);
+    return out;
+}
+
+inline bool decode(const std::string& payload, CompileResponse& response) {
+    details::Reader reader(payload);
+    uint32_t exit_code = 0;
+
+    if (!reader.get_u32(exit_code)) {
+        return false;
+    }
+    response.exit_code = static_cast<int32_t>(exit_code);
+
+    return reader.get_string(response.diagnostics) &&
+           reader.get_string(response.object);
+}
+
+/**
+ * @brief Connection to a `nobpp-worker` daemon
+ * @code
+ * ```cpp
+ * nobpp::remote::Client client("/tmp/nobpp-worker.sock");
+ * client.compile(builder, "./src/main.cpp");
+ * ```
+ * @endcode
+ */
+class Client {
+public:
+    Client(const std::string& socket_path) : socket_path(socket_path) {}
+
+    /**
+     * @brief Send a request to the worker and wait for its response
+     *
+     * @return `false` if the worker could not be reached.
+     */
+    bool send(const CompileRequest& request, CompileResponse& response) const {
+        int fd = details::connect_to(self.socket_path);
+
+        if (fd < 0) {
+            return false;
+        }
+
+        MessageKind kind;
+        std::string payload;
+        bool ok = details::send_message(
+                      fd, MessageKind::compile_request, encode(request)) &&
+                  details::receive_message(fd, kind, payload) &&
+                  kind == MessageKind::compile_response &&
+                  decode(payload, response);
+
+        ::close(fd);
+
+        return ok;
+    }
+
+    /**
+     * @brief Compile a source file of `builder` on the worker
+     *
+     * The source is preprocessed locally, the object file received from the
+     * worker is written to `builder.object_file(source)`. The cache of the
+     * builder is consulted before shipping the source. Falls back to a local
+     * compilation if the worker can not be reached. The sandbox of the
+     * builder applies to the local preprocessor, the only step reading
+     * headers.
+     *
+     * @return `true` if the object file was produced
+     */
+    bool compile(const CommandBuilder& builder, const std::string& source) {
+        bool fetched = false;
+        return self.compile(builder, source, fetched);
+    }
+
+    /**
+     * @brief Compile a source file of `builder` on the worker
+     *
+     * @param fetched Set to `true` if the object came from the cache
+     * @return `true` if the object file was produced
+     */
+    bool compile(const CommandBuilder& builder, const std::string& source,
+        bool& fetched) {
+        fetched = false;
+
+        // The `.dwo` file would stay on the worker
+        if (builder.get_split_debug_info()) {
+            return builder.compile(source, fetched);
+        }
+
+        const std::string object = builder.object_file(source);
+        create_parent_dir(object);
+
+        CompileRequest request;
+        request.compiler = builder.compiler_executable();
+        request.extension =
+            builder.get_language() == Language::c ? ".i" : ".ii";
+        request.flags = builder.compile_flags(source);
+
+        {
+            nobpp::details::SandboxRules rules;
+            const bool sandboxed = builder.sandbox_rules(source, rules);
+            nobpp::details::SandboxScope scope(sandboxed ? &rules : nullptr);
+
+            if (!builder.preprocess(source, request.preprocessed_source)) {
+                return false;
+            }
+        }
+
+        if (!builder.check_declared_inputs(source)) {
+            return false;
+        }
+
+        const std::string action =
+            builder.action_hash(source, request.preprocessed_source);
+
+        if (builder.fetch_from_cache(action, object)) {
+            builder.record_compile(source);
+            fetched = true;
+            return true;
+        }
+
+        CompileResponse response;
+
+        if (!self.send(request, response)) {
+            std::cout << "Worker " << self.socket_path
+                      << " is not reachable, compiling " << source
+                      << " locally\n";
+            return builder.compile(source, fetched);
+        }
+
+        std::cerr << response.diagnostics;
+
+        if (response.exit_code != 0 || !write_file(object, response.object)) {
+            return false;
+        }
+
+        builder.store_in_cache(action, object);
+        builder.record_compile(source);
+
+        return true;
+    }
+
+private:
+    Client& self = *this;
+
+    std::string socket_path;
+};
+
+/**
+ * @brief `nobpp-worker` daemon compiling translation units sent by clients
+ * @code
+ * ```cpp
+ * // worker.cpp
+ * #include "nobpp.hpp"
+ *
+ * int main() {
+ *     nobpp::remote::Worker("/tmp/nobpp-worker.sock").serve();
+ * }
+ * ```
+ * @endcode
+ */
+class Worker {
+public:
+    /**
+     * @brief Construct a new Worker object
+     *
+     * @param socket_path Path of the Unix domain socket to listen on
+     * @param max_jobs Number of translation units compiled concurrently
+     */
+    Worker(const std::string& socket_path,
+        size_t max_jobs = std::thread::hardware_concurrency())
+        : socket_path(socket_path), max_jobs(max_jobs == 0 ? 1 : max_jobs) {}
+    Worker(const Worker&) = delete;
+    Worker& operator=(const Worker&) = delete;
+
+    /**
+     * @brief Allow clients to compile with `compiler`
+     *
+     * Requests naming any other compiler are refused. `cc`, `c++`, `gcc`,
+     * `g++`, `clang` and `clang++` are allowed by default, so add full paths
+     * and versioned names used by the toolchains of the clients.
+     *
+     * @param compiler The compiler exactly as the client sends it
+     * @return `Worker&`
+     */
+    Worker& allow_compiler(const std::string& compiler) {
+        self.compilers.insert(compiler);
+        return self;
+    }
+
+    /**
+     * @brief Set the directory temporary sources and objects are written to
+     *
+     * @param dir The directory, `/tmp` by default
+     * @return `Worker&`
+     */
+    Worker& set_work_dir(const std::string& dir) {
+        self.work_dir = dir;
+        return self;
+    }
+
+    /**
+     * @brief Listen on the socket and serve requests, never returns unless
+     * the socket could not be created
+     *
+     * @return `false` if the socket could not be created
+     */
+    bool serve() {
+        sockaddr_un address;
+        std::memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+
+        if (self.socket_path.size() >= sizeof(address.sun_path)) {
+            std::cout << "Socket path is too long: " << self.socket_path
+                      << "\n";
+            return false;
+        }
+        std::memcpy(address.sun_path, self.socket_path.c_str(),
+            self.socket_path.size());
+
+        int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0) {
+            return false;
+        }
+
+        ::unlink(self.socket_path.c_str());
+
+        if (::bind(fd, reinterpret_cast<sockaddr*>(&address),
+                sizeof(address)) != 0 ||
+            ::listen(fd, static_cast<int>(self.max_jobs * 2)) != 0) {
+            std::cout << "Could not listen on " << self.socket_path << " ("
+                      << errno << ")\n";
+            ::close(fd);
+            return false;
+        }
+
+        if (!dir_exists(self.work_dir)) {
+            createDirectoryRecursively(self.work_dir);
+        }
+
+        std::vector<std::thread> threads;
+        threads.reserve(self.max_jobs);
+
+        for (size_t i = 0; i < self.max_jobs; ++i) {
+            threads.emplace_back([this, fd]() { this->accept_loop(fd); });
+        }
+
+        for (std::thread& thread : threads) {
+            thread.join();
+        }
+
+        ::close(fd);
+
+        return true;
+    }
+
+    /**
+     * @brief Compile a single request
+     *
+     * @return `CompileResponse`
+     */
+    CompileResponse compile(const CompileRequest& request) const {
+        CompileResponse response;
+
+        if (self.compilers.count(request.compiler) == 0) {
+            response.diagnostics = "nobpp-worker: compiler " +
+                                   request.compiler + " is not allowed\n";
+            return response;
+        }
+        if (request.extension != ".i" && request.extension != ".ii") {
+            response.diagnostics = "nobpp-worker: unknown source extension " +
+                                   request.extension + "\n";
+            return response;
+        }
+
+        const std::string base =
+            self.work_dir + "/nobpp-" + nanoid::generate(12);
+        const std::string source = base + request.extension;
+        const std::string object = base + ".o";
+
+        if (!write_file(source, request.preprocessed_source)) {
+            response.diagnostics = "nobpp-worker: could not write " + source;
+            return response;
+        }
+
+        std::vector<std::string> command;
+        command.push_back(request.compiler);
+        command.insert(
+            command.end(), request.flags.begin(), request.flags.end());
+        command.push_back("-c");
+        command.push_back(source);
+        command.push_back("-o");
+        command.push_back(object);
+
+        int output_fd = -1;
+        const pid_t pid = nobpp::details::spawn_captured(
+            command, output_fd, nobpp::details::current_job_slot());
+        response.exit_code = pid < 0 ? -1
+                                     : nobpp::details::collect_output(pid,
+                                           output_fd,
+                                           std::chrono::milliseconds(0),
+                                           response.diagnostics);
+
+        if (response.exit_code == 0 && !read_file(object, response.object)) {
+            response.exit_code = -1;
+        }
+
+        std::remove(source.c_str());
+        std::remove(object.c_str());
+
+        return response;
+    }
+
+private:
+    Worker& self = *this;
+
+    std::string socket_path;
+    std::string work_dir = "/tmp";
+    size_t max_jobs;
+    std::unordered_set<std::string> compilers = {
+        "cc", "c++", "gcc", "g++", "clang", "clang++"};
+
+private:
+    void accept_loop(int listen_fd) const {
+        while (true) {
+            int fd = ::accept(listen_fd, nullptr, nullptr);
+
+            if (fd < 0) {
+                if (errno == EINTR || errno == ECONNABORTED) {
+                    continue;
+                }
+                return;
+            }
+
+            MessageKind kind;
+            std::string payload;
+
+            while (details::receive_message(fd, kind, payload)) {
+                CompileRequest request;
+
+                if (kind != MessageKind::compile_request ||
+                    !decode(payload, request)) {
+                    break;
+                }
+
+                if (!details::send_message(fd, MessageKind::compile_response,
+                        encode(self.compile(request)))) {
+                    break;
+                }
+            }
+
+            ::close(fd);
+        }
+    }
+};
+
+}  // namespace remote
+#endif
+
+/**
+ * @brief Compile durations of previous builds
+ *
+ * Stored as one `<milliseconds>\t<source>` line per translation unit in
+ * `<build_dir>/.nobpp/timings`. `CommandQueue` updates it after every build.
+ * Links, custom commands and tests are recorded under their job name.
+ */
+class TimingLog {
+public:
+    /**
+     * @brief Load the log of a builder, missing files give an empty log
+     *
+     * @param builder The builder
+     */
+    TimingLog(const CommandBuilder& builder)
+        : path(builder.state_dir() + "/timings") {
+        std::string content;
+        if (!read_file(self.path, content)) {
+            return;
+        }
+
+        std::istringstream lines(content);
+        std::string line;
+        while (std::getline(lines, line)) {
+            const size_t tab = line.find('\t');
+            if (tab == std::string::npos) {
+                continue;
+            }
+            self.durations[line.substr(tab + 1)] =
+                std::atof(line.substr(0, tab).c_str());
+        }
+    }
+    TimingLog(const TimingLog&) = delete;
+    TimingLog& operator=(const TimingLog&) = delete;
+
+    /**
+     * @brief Get the last recorded duration of a source file
+     *
+     * @param source The source file
+     * @param milliseconds Receives the duration
+     * @return `false` if the source was never compiled
+     */
+    bool get(const std::string& source, double& milliseconds) const {
+        auto it = self.durations.find(source);
+
+        if (it == self.durations.end()) {
+            return false;
+        }
+
+        milliseconds = it->second;
+        return true;
+    }
+
+    void set(const std::string& source, double milliseconds) {
+        self.durations[source] = milliseconds;
+    }
+
+    bool save() const {
+        std::ostringstream content;
+
+        for (const auto& entry : self.durations) {
+            content << entry.second << "\t" << entry.first << "\n";
+        }
+
+        create_parent_dir(self.path);
+        return write_file(self.path, content.str());
+    }
+
+private:
+    TimingLog& self = *this;
+
+    std::string path;
+    std::map<std::string, double> durations;
+};
+
+/**
+ * @brief Creates a pool of process that will be used to run multiple processes
+ * at once
+ *
+ */
+class ProcessPool {};
+
+/**
+ * @brief What `CommandQueue` does after a job failed
+ */
+enum struct FailureMode {
+    /// Run every job that does not depend on a failed one
+    keep_going,
+    /// Cancel running jobs and skip every job that has not started yet
+    fail_fast
+};
+
+/**
+ * @brief Order in which `CommandQueue` starts jobs that are ready
+ */
+enum struct Scheduling {
+    /// In the order they became ready
+    fifo,
+    /// By their last recorded duration, estimated from the file size for
+    /// new translation units, so long jobs do not start last and stretch
+    /// the build. Custom commands add the compiles waiting for them.
+    longest_first
+};
+
+/**
+ * @brief Queue of commands that can run multiple commands in parallel
+ *
+ * Every source file of a builder is compiled as its own job and the link job
+ * of the builder starts as soon as all of its objects are ready, so the jobs
+ * of different builders and of all variants of a builder interleave freely.
+ * Jobs whose outputs are up to date, as explained by `nobpp::BuildPlan`,
+ * return without spawning anything. Jobs depending on a failed job are
+ * skipped, `wait` reports every failed and skipped job.
+ *
+ * @code
+ * ```cpp
+ * #include "nobpp.hpp"
+ *
+ * int main() {
+ *     const nobpp::CommandBuilder builder1 = nobpp::CommandBuilder();
+ *     const nobpp::CommandBuilder builder2 = nobpp::CommandBuilder();
+ *     const nobpp::CommandBuilder builder3 = nobpp::CommandBuilder();
+ *     const nobpp::CommandBuilder builder4 = nobpp::CommandBuilder();
+ *
+ *     const nobpp::CommandQueue queue = nobpp::CommandQueue(4);
+ *     queue.add_builder(builder1)
+ *          .add_builder(builder2)
+ *          .add_builder(builder3)
+ *          .add_builder(builder4);
+ * }
+ * ```
+ * @endcode
+ */
+class CommandQueue {
+public:
+    CommandQueue(size_t max_processes = 8) noexcept
+        : worker_count(max_processes), max_commands(max_processes) {
+#ifndef _WIN32
+        self.job_children.reset(new std::atomic<pid_t>[max_processes]);
+        for (size_t i = 0; i < max_processes; ++i) {
+            self.job_children[i] = 0;
+        }
+#endif
+        self.workers.reserve(max_processes);
+
+        for (size_t i = 0; i < max_processes; ++i) {
+            self.workers.emplace_back([this, i]() { this->create_worker(i); });
+        }
+    }
+    CommandQueue(CommandQueue&) = delete;
+    CommandQueue& operator=(CommandQueue&) = delete;
+
+    ~CommandQueue() {
+        self.wait();
+        {
+            std::lock_guard<std::mutex> lock(self.job_mutex);
+            self.all_finished = true;
+        }
+        self.job_cv.notify_all();
+
+        for (size_t i = 0; i < self.workers.size(); ++i) {
+            self.workers[i].join();
+        }
+    }
+
+#ifndef _WIN32
+    /**
+     * @brief Compile translation units on a `nobpp-worker` daemon
+     *
+     * Translation units are distributed over all added workers round robin.
+     * Linking always happens locally.
+     *
+     * @param socket_path Path of the Unix domain socket of the worker
+     * @return `CommandQueue&`
+     * @code
      * ```cpp
-     * builder.set_target_os(nobpp::TargetOS::windows);
+     * nobpp::CommandQueue(32)
+     *     .add_worker("/tmp/nobpp-worker-0.sock")
+     *     .add_worker("/tmp/nobpp-worker-1.sock")
+     *     .add_builder(builder);
+     * ```
+     * @endcode
+     */
+    CommandQueue& add_worker(const std::string& socket_path) {
+        std::lock_guard<std::mutex> lock(self.job_mutex);
+        self.remote_workers.push_back(socket_path);
+        return self;
+    }
+#endif
+
+    /**
+     * @brief Set what happens after a job failed
+     *
+     * With `nobpp::FailureMode::fail_fast` the process groups of running
+     * jobs are terminated on POSIX and every job that has not started yet
+     * is skipped, including jobs added before `wait` returns. The default
+     * `nobpp::FailureMode::keep_going` only skips the dependents of the
+     * failed job.
+     *
+     * @param mode `nobpp::FailureMode`
+     * @return `CommandQueue&`
+     * @code
+     * ```cpp
+     * nobpp::CommandQueue(16)
+     *     .set_failure_mode(nobpp::FailureMode::fail_fast)
+     *     .add_builder(builder);
+     * ```
+     * @endcode
+     */
+    CommandQueue& set_failure_mode(FailureMode mode) {
+        std::lock_guard<std::mutex> lock(self.job_mutex);
+        self.failure_mode = mode;
+        return self;
+    }
+
+    /**
+     * @brief Set the order in which ready jobs start, applies to jobs
+     * that become ready afterwards
+     *
+     * @param scheduling `nobpp::Scheduling`, `longest_first` by default
+     * @return `CommandQueue&`
+     */
+    CommandQueue& set_scheduling(Scheduling scheduling) {
+        std::lock_guard<std::mutex> lock(self.job_mutex);
+        self.scheduling = scheduling;
+        return self;
+    }
+
+    /**
+     * @brief Set how many command jobs run at once
+     *
+     * Command jobs, added with `add_command` and for tests, do not hold a
+     * worker while their process runs. One thread waits for all of them,
+     * so the limit can be far above the number of workers. Compiles and
+     * links without a cache, remote workers or Landlock do not hold a
+     * worker either, but stay limited to one per worker.
+     *
+     * @param count At least one, the number of workers by default
+     * @return `CommandQueue&`
+     * @throw std::invalid_argument if `count` is 0
+     * @code
+     * ```cpp
+     * nobpp::CommandQueue(8).set_max_commands(256).add_builder(tests);
+     * ```
+     * @endcode
+     */
+    CommandQueue& set_max_commands(size_t count) {
+        if (count == 0) {
+            throw std::invalid_argument("At least one command has to run.");
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(self.job_mutex);
+            self.max_commands = count;
+
+            while (self.commands_running < self.max_commands &&
+                   !self.waiting_commands.empty()) {
+                self.make_ready(self.waiting_commands.front());
+                self.waiting_commands.pop_front();
+            }
+        }
+        self.job_cv.notify_all();
+
+        return self;
+    }
+
+    /**
+     * @brief Write every job that ran to a trace file on each `wait`
+     *
+     * The file uses the Chrome trace event format, open it in Perfetto or
+     * `chrome://tracing` to see what each worker ran and when.
+     *
+     * @param path The trace file, empty to stop tracing
+     * @return `CommandQueue&`
+     * @code
+     * ```cpp
+     * nobpp::CommandQueue(16)
+     *     .set_trace_file("build/trace.json")
+     *     .add_builder(builder);
+     * ```
+     * @endcode
+     */
+    CommandQueue& set_trace_file(const std::string& path) {
+        std::lock_guard<std::mutex> lock(self.job_mutex);
+        self.trace_file = path;
+        return self;
+    }
+
+    /**
+     * @brief Get the names of the jobs that failed so far
+     *
+     * @return `std::vector<std::string>`
+     */
+    std::vector<std::string> get_failed() {
+        std::lock_guard<std::mutex> lock(self.job_mutex);
+        return self.failed;
+    }
+
+    /**
+     * @brief Get the names of the jobs that were skipped or cancelled so far
+     *
+     * @return `std::vector<std::string>`
+     */
+    std::vector<std::string> get_skipped() {
+        std::lock_guard<std::mutex> lock(self.job_mutex);
+        return self.skipped;
+    }
+
+    /**
+     * @brief Wait until every job added so far has finished
+     *
+     * Jobs that failed or were skipped since the last call are listed, and
+     * compile durations are written to the timing log of each builder.
+     *
+     * @code
+     * ```cpp
+     * queue.add_builder(builder).wait();
+     * ```
+     * @endcode
+     */
+    void wait() {
+        std::vector<Timing> finished;
+        {
+            std::unique_lock<std::mutex> lock(self.job_mutex);
+            self.job_cv.wait(lock, [this]() {
+                return this->queue.empty() && this->running == 0;
+            });
+            finished.swap(self.timings);
+
+            if (self.reported_failures != self.failed.size() ||
+                self.reported_skips != self.skipped.size()) {
+                self.report_failures();
+            }
+
+            if (self.trace_file != "") {
+                create_parent_dir(self.trace_file);
+                write_file(self.trace_file, self.trace_json());
+            }
+
+            // Jobs added from now on run again
+            self.cancelled = false;
+        }
+
+        std::vector<const CommandBuilder*> builders;
+        for (const Timing& timing : finished) {
+            if (std::find(builders.begin(), builders.end(), timing.builder) ==
+                builders.end()) {
+                builders.push_back(timing.builder);
+            }
+        }
+
+        for (const CommandBuilder* builder : builders) {
+            TimingLog log(*builder);
+            for (const Timing& timing : finished) {
+                if (timing.builder == builder) {
+                    log.set(timing.source, timing.milliseconds);
+                }
+            }
+            log.save();
+        }
+    }
+
+    /**
+     * @brief Add job to the queue
+     *
+     * Dependencies of the builder that were not added yet are added first,
+     * each target is only added once.
+     *
+     * @param builder
+     * @return `CommandQueue&`
+     * @throw std::invalid_argument if the builder or one of its variants is
+     * invalid, no variant is queued then
+     */
+    CommandQueue& add_builder(const CommandBuilder& builder) {
+        if (self.all_finished) {
+            std::cout << "Worker Pool disabled\n";
+            return self;
+        }
+
+        if (!builder.get_variants().empty()) {
+            // No variant is queued unless all of them are valid
+            std::vector<CommandBuilder> variants;
+            variants.reserve(builder.get_variants().size());
+            for (const Variant& variant : builder.get_variants()) {
+                variants.push_back(builder.with_variant(variant));
+                variants.back().validate();
+            }
+
+            for (const CommandBuilder& variant : variants) {
+                self.add_target(self.own(variant));
+            }
+            return self;
+        }
+
+        self.add_target(builder);
+
+        return self;
+    }
+
+    /**
+     * @brief Add a task that runs on the queue like any other job
+     *
+     * @param name Name of the task, printed if it fails
+     * @param task Returns `false` on failure
+     * @return `CommandQueue&`
+     * @code
+     * ```cpp
+     * queue.add_task("generate version.h", []() {
+     *     return nobpp::write_file("version.h", "#define VERSION 3\n");
+     * });
+     * ```
+     * @endcode
+     */
+    CommandQueue& add_task(
+        const std::string& name, std::function<bool()> task) {
+        if (self.all_finished) {
+            std::cout << "Worker Pool disabled\n";
+            return self;
+        }
+        {
+            std::lock_guard<std::mutex> lock(self.job_mutex);
+            self.add_job(name, std::move(task), 0);
+        }
+        self.job_cv.notify_one();
+
+        return self;
+    }
+
+    /**
+     * @brief Add a command that runs without holding a worker
+     *
+     * The output of the command is printed if it fails.
+     *
+     * @param name Name of the job, printed if it fails
+     * @param command The command
+     * @param timeout The command is killed after it, `0` for no limit
+     * @return `CommandQueue&`
+     * @code
+     * ```cpp
+     * queue.add_command("lint", "clang-tidy src/main.cpp",
+     *     std::chrono::minutes(5));
      * ```
      * @endcode
      */
-    CommandBuilder& set_target_os(TargetOS os) noexcept {
-        self.target_os = os;
-        return self;
+    CommandQueue& add_command(const std::string& name,
+        const std::string& command,
+        std::chrono::milliseconds timeout = std::chrono::milliseconds(0)) {
+        {
+            std::lock_guard<std::mutex> lock(self.job_mutex);
+            if (self.all_finished) {
+                std::cout << "Worker Pool disabled\n";
+                return self;
+            }
+
+            self.add_command_job(name,
+                [command](std::string& line) {
+                    line = command;
+                    return true;
+                },
+                // `finish_job` reports the failure itself
+                [](int result, const std::string& output) {
+                    if (result != 0) {
+                        std::cout << output;
+                    }
+                    return result == 0;
+                },
+                timeout, 0);
+        }
+        self.job_cv.notify_one();
+
+        return self;
+    }
+
+private:
+    /// Job whose process is waited for by `create_process_async`
+    struct CommandJob {
+        /// Runs on a worker and sets the command, left empty if the job has
+        /// nothing more to do. Returns `false` if the job failed already.
+        std::function<bool(std::string&)> prepare;
+        /// Runs on a worker with the exit code and the output of the command
+        std::function<bool(int, const std::string&)> complete;
+        std::chrono::milliseconds timeout{0};
+        /// A compile or a link, limited to one per worker like the jobs
+        /// that hold a worker instead of by `max_commands`
+        bool build_step = false;
+    };
+
+    struct Job {
+        std::string name;
+        std::function<bool()> run;
+        /// Set instead of `run` for command jobs
+        std::shared_ptr<CommandJob> command;
+#ifndef _WIN32
+        /// Process group of a running command job, `0` if none
+        std::unique_ptr<std::atomic<pid_t>> child{new std::atomic<pid_t>(0)};
+#endif
+        std::vector<size_t> dependents;
+        /// Number of dependencies that have not finished yet
+        size_t pending = 0;
+        bool dependency_failed = false;
+        bool finished = false;
+        bool succeeded = false;
+        /// Expected duration in milliseconds
+        double estimate = 0;
+        /// Trace lane of a running command job
+        size_t lane = 0;
+        /// When a command job started, in nanoseconds since `created`
+        uint64_t start_ns = 0;
+        /// The process of a command job exited, `complete` is still to run
+        bool completing = false;
+        int exit_code = 0;
+        std::string output;
+    };
+
+    struct ReadyJob {
+        double priority;
+        /// Breaks ties in the order jobs became ready
+        uint64_t sequence;
+        size_t index;
+
+        // `std::priority_queue` starts with the largest element
+        bool operator<(const ReadyJob& other) const noexcept {
+            if (priority != other.priority) {
+                return priority < other.priority;
+            }
+            return sequence > other.sequence;
+        }
+    };
+
+    struct TraceEvent {
+        std::string name;
+        /// Worker, or lane after the workers for command jobs
+        size_t worker;
+        uint64_t start_ns;
+        uint64_t duration_ns;
+    };
+
+    /// Estimate of jobs without a recorded duration that are not compiles
+    static constexpr double UNKNOWN_DURATION_MS = 1000;
+    /// Priority of finishing a command job whose process exited
+    static constexpr double COMPLETION_PRIORITY =
+        std::numeric_limits<double>::infinity();
+
+    /// A builder across copies, and the variant it is built for
+    using TargetKey = std::pair<const CommandBuilder*, std::string>;
+    using GeneratorKey = std::pair<const CommandBuilder*, size_t>;
+    static constexpr size_t ADDING_TARGET = static_cast<size_t>(-1);
+
+    struct Timing {
+        const CommandBuilder* builder;
+        std::string source;
+        double milliseconds;
+    };
+
+    CommandQueue& self = *this;
+
+    std::vector<std::thread> workers;
+    const size_t worker_count;
+    std::deque<Job> jobs;
+    std::priority_queue<ReadyJob> queue;
+    uint64_t ready_count = 0;
+    size_t running = 0;
+    size_t max_commands;
+    size_t commands_running = 0;
+    /// Command jobs that were ready while `max_commands` were running
+    std::deque<size_t> waiting_commands;
+    /// Jobs running besides tests and `add_command`, at most one per worker
+    size_t jobs_running = 0;
+    /// Jobs that were ready while `worker_count` jobs were running
+    std::deque<size_t> waiting_jobs;
+    /// Command jobs that have started and not finished yet
+    std::unordered_set<size_t> running_commands;
+    /// Trace lanes in use by running command jobs, which outlive the worker
+    /// that started them
+    std::vector<bool> command_lanes;
+    std::vector<Timing> timings;
+    /// Builders created for the variants of added builders
+    std::vector<std::unique_ptr<CommandBuilder>> variant_builders;
+    /// Link job of every added target
+    std::map<TargetKey, size_t> targets;
+    /// Job of every custom command, by builder without variant and index
+    std::map<GeneratorKey, size_t> generators;
+
+    std::vector<std::string> remote_workers;
+    std::atomic<size_t> next_remote_worker{0};
+
+    std::mutex job_mutex;
+    std::condition_variable job_cv;
+
+    FailureMode failure_mode = FailureMode::keep_going;
+    Scheduling scheduling = Scheduling::longest_first;
+    bool cancelled = false;
+    std::vector<std::string> failed;
+    std::vector<std::string> skipped;
+    size_t reported_failures = 0;
+    size_t reported_skips = 0;
+#ifndef _WIN32
+    /// Process group of the child each worker is running, `0` if none
+    std::unique_ptr<std::atomic<pid_t>[]> job_children;
+#endif
+
+    bool all_finished = false;
+
+    std::string trace_file;
+    std::vector<TraceEvent> trace;
+    const metrics::Clock::time_point created = metrics::Clock::now();
+
+private:
+    /**
+     * @brief Add a job that becomes ready once `pending` dependencies have
+     * finished, `job_mutex` must be held
+     *
+     * @param estimate Expected duration in milliseconds
+     */
+    size_t add_job(const std::string& name, std::function<bool()> run,
+        size_t pending, double estimate = UNKNOWN_DURATION_MS) {
+        Job job;
+        job.name = name;
+        job.run = std::move(run);
+        job.pending = pending;
+        job.estimate = estimate;
+
+        self.jobs.push_back(std::move(job));
+        const size_t index = self.jobs.size() - 1;
+
+        if (pending == 0) {
+            self.make_ready(index);
+            metrics::global().set_queue_depth(
+                static_cast<int64_t>(self.queue.size()));
+        }
+
+        return index;
+    }
+
+    /**
+     * @brief Add a job running a command, `job_mutex` must be held
+     */
+    size_t add_command_job(const std::string& name,
+        std::function<bool(std::string&)> prepare,
+        std::function<bool(int, const std::string&)> complete,
+        std::chrono::milliseconds timeout, size_t pending,
+        double estimate = UNKNOWN_DURATION_MS, bool build_step = false) {
+        std::shared_ptr<CommandJob> command(new CommandJob());
+        command->prepare = std::move(prepare);
+        command->complete = std::move(complete);
+        command->timeout = timeout;
+        command->build_step = build_step;
+
+        self.jobs.push_back(Job());
+        const size_t index = self.jobs.size() - 1;
+        self.jobs[index].name = name;
+        self.jobs[index].command = std::move(command);
+        self.jobs[index].pending = pending;
+        self.jobs[index].estimate = estimate;
+
+        if (pending == 0) {
+            self.make_ready(index);
+            metrics::global().set_queue_depth(
+                static_cast<int64_t>(self.queue.size()));
+        }
+
+        return index;
+    }
+
+    /**
+     * @brief Queue a job whose dependencies have finished, `job_mutex` must
+     * be held
+     */
+    void make_ready(size_t index) {
+        const double priority = self.scheduling == Scheduling::longest_first
+                                    ? self.jobs[index].estimate
+                                    : 0;
+
+        self.queue.push(ReadyJob{priority, self.ready_count++, index});
+    }
+
+    /**
+     * @brief Estimate how long each source file of a builder takes to
+     * compile
+     *
+     * Uses the timing log, sources without a recorded duration are
+     * estimated from their size and the compile speed of the others.
+     *
+     * @return milliseconds for each file in `get_files()`
+     */
+    static std::vector<double> estimate_compiles(
+        const CommandBuilder& builder, const TimingLog& log) {
+        const std::vector<std::string>& files = builder.get_files();
+
+        std::vector<double> estimates(files.size(), -1);
+        std::vector<uint64_t> sizes(files.size(), 0);
+        double recorded_ms = 0;
+        uint64_t recorded_bytes = 0;
+
+        for (size_t i = 0; i < files.size(); ++i) {
+            FileStat stat;
+            if (stat_file(files[i], stat)) {
+                sizes[i] = stat.size;
+            }
+
+            double milliseconds = 0;
+            if (log.get(files[i], milliseconds)) {
+                estimates[i] = milliseconds;
+                recorded_ms += milliseconds;
+                recorded_bytes += sizes[i];
+            }
+        }
+
+        // About a second for 10 kB of source until something was recorded,
+        // only the order matters then
+        const double ms_per_byte = recorded_ms > 0 && recorded_bytes > 0
+                                       ? recorded_ms / recorded_bytes
+                                       : 0.1;
+
+        for (size_t i = 0; i < files.size(); ++i) {
+            if (estimates[i] < 0) {
+                estimates[i] = sizes[i] * ms_per_byte;
+            }
+        }
+
+        return estimates;
+    }
+
+    /**
+     * @brief Get the recorded duration of a job that is not a compile
+     */
+    static double estimate_job(const TimingLog& log, const std::string& name) {
+        double milliseconds = UNKNOWN_DURATION_MS;
+        log.get(name, milliseconds);
+        return milliseconds;
     }
 
     /**
-     * @brief Set the optimization level
+     * @brief Record how long a job of a builder took, for its next estimate
+     */
+    void add_timing(const CommandBuilder& builder, const std::string& name,
+        std::chrono::steady_clock::time_point start) {
+        const std::chrono::duration<double, std::milli> elapsed =
+            std::chrono::steady_clock::now() - start;
+
+        std::lock_guard<std::mutex> lock(self.job_mutex);
+        self.timings.push_back(Timing{&builder, name, elapsed.count()});
+    }
+
+    static std::string json_string(const std::string& value) {
+        std::string out = "\"";
+
+        for (const char c : value) {
+            if (c == '"' || c == '\\') {
+                out += '\\';
+                out += c;
+            } else if (static_cast<unsigned char>(c) < 0x20) {
+                out += ' ';
+            } else {
+                out += c;
+            }
+        }
+
+        return out + "\"";
+    }
+
+    /**
+     * @brief Format the recorded jobs as Chrome trace events, `job_mutex`
+     * must be held
+     */
+    std::string trace_json() const {
+        std::ostringstream out;
+        out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+
+        for (size_t i = 0; i < self.trace.size(); ++i) {
+            const TraceEvent& event = self.trace[i];
+            const std::string category =
+                event.name.substr(0, event.name.find(' '));
+
+            out << (i == 0 ? "\n" : ",\n") << "{\"name\":"
+                << json_string(event.name)
+                << ",\"cat\":" << json_string(category)
+                << ",\"ph\":\"X\",\"pid\":1,\"tid\":" << event.worker
+                << ",\"ts\":" << event.start_ns / 1000
+                << ",\"dur\":" << event.duration_ns / 1000 << "}";
+        }
+
+        out << "\n]}\n";
+        return out.str();
+    }
+
+    /**
+     * @brief Keep a builder created by the queue alive as long as the queue
+     */
+    const CommandBuilder& own(const CommandBuilder& builder) {
+        std::unique_ptr<CommandBuilder> owned(new CommandBuilder(builder));
+        const CommandBuilder& added = *owned;
+
+        std::lock_guard<std::mutex> lock(self.job_mutex);
+        self.variant_builders.push_back(std::move(owned));
+
+        return added;
+    }
+
+    /**
+     * @brief Add the jobs of a builder without variants, after the jobs of
+     * its dependencies
      *
-     * @param level `nobpp::OptimizationLevel::none`
-     *     | `nobpp::OptimizationLevel::o1`
-     *     | `nobpp::OptimizationLevel::o2`
-     *     | `nobpp::OptimizationLevel::o3`
-     *     | `nobpp::OptimizationLevel::os`,
-     *     | `nobpp::OptimizationLevel::oz`
-     * @return `nobpp::CommandBuilder&`
-     * @code
-     * ```cpp
-     * builder.set_optimization_level(nobpp::OptimizationLevel::o3);
-     * ```
-     * @endcode
+     * @return index of the link job of the builder
      */
-    CommandBuilder& set_optimization_level(OptimizationLevel level) noexcept {
-        self.optimization_level = level;
-        return self;
+    size_t add_target(const CommandBuilder& builder) {
+        const TargetKey key(&builder.get_origin(), builder.get_variant_name());
+        {
+            std::lock_guard<std::mutex> lock(self.job_mutex);
+            auto found = self.targets.find(key);
+
+            if (found != self.targets.end()) {
+                if (found->second == ADDING_TARGET) {
+                    throw std::invalid_argument(
+                        "Dependency cycle through " + builder.get_name() + ".");
+                }
+                return found->second;
+            }
+            self.targets[key] = ADDING_TARGET;
+        }
+
+        try {
+            return self.add_target_jobs(builder, key);
+        } catch (...) {
+            // Adding the target again would report a dependency cycle
+            std::lock_guard<std::mutex> lock(self.job_mutex);
+            self.targets.erase(key);
+            throw;
+        }
     }
 
     /**
-     * @brief Add an include directory
+     * @brief Add the jobs of a target `add_target` is adding
      *
-     * @param dir The directory to include
-     * @return `nobpp::CommandBuilder&`
-     * @code
-     * ```cpp
-     * builder.add_include_dir("./include");
-     * ```
-     * @endcode
+     * @return index of the link job of the builder
      */
-    CommandBuilder& add_include_dir(const char* dir) noexcept {
-        self.include_dirs.push_back(dir);
-        return self;
+    size_t add_target_jobs(
+        const CommandBuilder& builder, const TargetKey& key) {
+        builder.validate();
+
+        std::vector<size_t> dependency_links;
+        for (const CommandBuilder* dependency : builder.get_dependencies()) {
+            if (dependency->get_variants().empty()) {
+                dependency_links.push_back(self.add_target(*dependency));
+                continue;
+            }
+
+            const TargetKey dependency_key(
+                dependency, builder.get_variant_name());
+            size_t link = ADDING_TARGET;
+            {
+                std::lock_guard<std::mutex> lock(self.job_mutex);
+                auto found = self.targets.find(dependency_key);
+                if (found != self.targets.end()) {
+                    link = found->second;
+                }
+            }
+
+            dependency_links.push_back(link != ADDING_TARGET
+                                           ? link
+                                           : self.add_target(self.own(
+                                                 builder.resolve_dependency(
+                                                     *dependency))));
+        }
+
+        const std::vector<std::string>& files = builder.get_files();
+        const std::vector<Resource>& resources = builder.get_resources();
+
+        if (!builder.write_resource_header()) {
+            throw std::runtime_error(
+                "Could not write " + builder.resource_header() + ".");
+        }
+
+        const TimingLog log(builder);
+        const std::vector<double> estimates = estimate_compiles(builder, log);
+
+        std::vector<std::vector<size_t>> custom_commands_needed;
+        for (const std::string& file : files) {
+            custom_commands_needed.push_back(
+                builder.custom_commands_for(file));
+        }
+
+        size_t link = 0;
+        {
+            metrics::ScopedTimer timer(metrics::global().plan_ns);
+            std::lock_guard<std::mutex> lock(self.job_mutex);
+
+            size_t pending = files.size() + resources.size();
+            for (const size_t dependency : dependency_links) {
+                pending += self.jobs[dependency].finished ? 0 : 1;
+            }
+
+            const std::string link_name = "link " + builder.output_file();
+            std::shared_ptr<std::chrono::steady_clock::time_point> link_start(
+                new std::chrono::steady_clock::time_point());
+            link = self.add_command_job(link_name,
+                [&builder, link_start](std::string& line) {
+                    if (builder.explain_link() == "") {
+                        metrics::global().jobs_up_to_date.add();
+                        return true;
+                    }
+
+                    *link_start = std::chrono::steady_clock::now();
+                    return builder.start_link(line);
+                },
+                [this, &builder, link_name, link_start](
+                    int result, const std::string& output) {
+                    std::cerr << output;
+                    metrics::global().link_ns.add(
+                        metrics::nanoseconds_since(*link_start));
+                    if (!builder.finish_link(result)) {
+                        return false;
+                    }
+                    this->add_timing(builder, link_name, *link_start);
+                    return true;
+                },
+                std::chrono::milliseconds(0), pending,
+                estimate_job(log, link_name), true);
+
+            for (const size_t dependency : dependency_links) {
+                if (!self.jobs[dependency].finished) {
+                    self.jobs[dependency].dependents.push_back(link);
+                } else if (!self.jobs[dependency].succeeded) {
+                    self.jobs[link].dependency_failed = true;
+                }
+            }
+
+            if (builder.packages_debug_info()) {
+                const size_t package =
+                    self.add_job("package " + builder.debug_package_file(),
+                        [&builder]() {
+                            if (builder.explain_package() == "") {
+                                metrics::global().jobs_up_to_date.add();
+                                return true;
+                            }
+                            return builder.package_debug_info();
+                        },
+                        1);
+                self.jobs[link].dependents.push_back(package);
+            }
+
+            for (const Test& test : builder.get_tests()) {
+                for (unsigned shard = 0; shard < test.shards; ++shard) {
+                    const std::string name = builder.test_job_name(test, shard);
+                    std::shared_ptr<std::chrono::steady_clock::time_point>
+                        start(new std::chrono::steady_clock::time_point());
+
+                    const size_t run = self.add_command_job(name,
+                        [&builder, test, shard, start](std::string& line) {
+                            if (builder.explain_test(test, shard) == "") {
+                                metrics::global().jobs_up_to_date.add();
+                                return true;
+                            }
+                            *start = std::chrono::steady_clock::now();
+                            line = builder.create_test_command(test, shard);
+                            return true;
+                        },
+                        [this, &builder, test, shard, name, start](
+                            int result, const std::string& output) {
+                            this->add_timing(builder, name, *start);
+                            return builder.record_test_result(
+                                test, shard, result, output);
+                        },
+                        std::chrono::seconds(test.timeout_seconds), 1,
+                        estimate_job(log, name));
+                    self.jobs[link].dependents.push_back(run);
+                }
+            }
+
+            for (const Resource& resource : resources) {
+                const size_t embed = self.add_job("embed " + resource.path,
+                    [&builder, &resource]() {
+                        if (builder.explain_resource(resource) == "") {
+                            metrics::global().jobs_up_to_date.add();
+                            return true;
+                        }
+                        return builder.embed_resource(resource);
+                    },
+                    0);
+                self.jobs[embed].dependents.push_back(link);
+            }
+
+            const std::vector<CustomCommand>& commands =
+                builder.get_custom_commands();
+            std::vector<size_t> custom_command_jobs;
+            for (size_t i = 0; i < commands.size(); ++i) {
+                // Variants write the same outputs, so they share the job
+                const GeneratorKey generator(&builder.get_origin(), i);
+                auto found = self.generators.find(generator);
+                if (found != self.generators.end()) {
+                    custom_command_jobs.push_back(found->second);
+                    continue;
+                }
+
+                // The compiles waiting for the command start after it
+                double waiting_ms = 0;
+                for (size_t file = 0; file < files.size(); ++file) {
+                    const std::vector<size_t>& needed =
+                        custom_commands_needed[file];
+                    if (std::find(needed.begin(), needed.end(), i) !=
+                        needed.end()) {
+                        waiting_ms = std::max(waiting_ms, estimates[file]);
+                    }
+                }
+
+                const CustomCommand& command = commands[i];
+                const std::string name = "generate " + command.name;
+                custom_command_jobs.push_back(self.add_job(name,
+                    [this, &builder, &command, name]() {
+                        if (builder.explain_custom_command(command) == "") {
+                            metrics::global().jobs_up_to_date.add();
+                            return true;
+                        }
+
+                        const auto start = std::chrono::steady_clock::now();
+                        if (!builder.run_custom_command(command)) {
+                            return false;
+                        }
+                        this->add_timing(builder, name, start);
+                        return true;
+                    },
+                    0, estimate_job(log, name) + waiting_ms));
+                self.generators[generator] = custom_command_jobs.back();
+            }
+
+            for (size_t i = 0; i < files.size(); ++i) {
+                const std::string& file = files[i];
+
+                // A shared generator may have finished for another variant
+                std::vector<size_t> generators;
+                bool generator_failed = false;
+                for (const size_t command : custom_commands_needed[i]) {
+                    const Job& job = self.jobs[custom_command_jobs[command]];
+
+                    if (!job.finished) {
+                        generators.push_back(custom_command_jobs[command]);
+                    } else if (!job.succeeded) {
+                        generator_failed = true;
+                    }
+                }
+
+                std::shared_ptr<std::chrono::steady_clock::time_point> start(
+                    new std::chrono::steady_clock::time_point());
+                const size_t compile = self.add_command_job("compile " + file,
+                    [this, &builder, file, start](std::string& line) {
+                        if (builder.explain_compile(file) == "" ||
+                            builder.inputs_unchanged(file)) {
+                            metrics::global().jobs_up_to_date.add();
+                            return true;
+                        }
+
+                        *start = std::chrono::steady_clock::now();
+                        if (!this->compiles_in_loop(builder)) {
+                            return this->compile(builder, file, *start);
+                        }
+                        return builder.start_compile(file, line);
+                    },
+                    [this, &builder, file, start](
+                        int result, const std::string& output) {
+                        std::cerr << output;
+                        metrics::global().execute_ns.add(
+                            metrics::nanoseconds_since(*start));
+                        if (!builder.finish_compile(file, result)) {
+                            return false;
+                        }
+                        this->add_timing(builder, file, *start);
+                        return true;
+                    },
+                    std::chrono::milliseconds(0), generators.size(),
+                    estimates[i], true);
+                self.jobs[compile].dependents.push_back(link);
+                self.jobs[compile].dependency_failed = generator_failed;
+
+                for (const size_t generator : generators) {
+                    self.jobs[generator].dependents.push_back(compile);
+                }
+            }
+
+            self.targets[key] = link;
+        }
+        self.job_cv.notify_all();
+
+        return link;
     }
 
     /**
-     * @brief Add an include directory
+     * @brief Check if the compiles of a builder are single commands, which
+     * do not need a worker while the compiler runs
      *
-     * @param dir The directory to include
-     * @return `nobpp::CommandBuilder&`
-     * @code
-     * ```cpp
-     * builder.add_include_dir("./include");
-     * ```
-     * @endcode
+     * Cache transfers, remote workers and the Landlock sandbox take several
+     * steps on the calling thread.
      */
-    CommandBuilder& add_include_dir(const std::string& dir) noexcept {
-        self.include_dirs.push_back(dir);
-        return self;
+    bool compiles_in_loop(const CommandBuilder& builder) {
+        if (builder.get_cache() ||
+            builder.get_sandbox() == Sandbox::enforce) {
+            return false;
+        }
+
+        std::lock_guard<std::mutex> lock(self.job_mutex);
+        return self.remote_workers.empty();
     }
 
     /**
-     * @brief Add include directories from a list of directories
+     * @brief Compile a source file on the calling worker, recording how
+     * long the compiler took
+     */
+    bool compile(const CommandBuilder& builder, const std::string& file,
+        std::chrono::steady_clock::time_point start) {
+        metrics::ScopedTimer timer(metrics::global().execute_ns);
+        bool fetched = false;
+        if (!self.compile(builder, file, fetched)) {
+            return false;
+        }
+
+        // A fetch says nothing about the compile time
+        if (!fetched) {
+            self.add_timing(builder, file, start);
+        }
+        return true;
+    }
+
+    bool compile(const CommandBuilder& builder, const std::string& file,
+        bool& fetched) {
+#ifndef _WIN32
+        std::string socket_path;
+        {
+            std::lock_guard<std::mutex> lock(self.job_mutex);
+            if (!self.remote_workers.empty()) {
+                socket_path = self.remote_workers[self.next_remote_worker++ %
+                                                  self.remote_workers.size()];
+            }
+        }
+
+        if (socket_path != "") {
+            return remote::Client(socket_path).compile(builder, file, fetched);
+        }
+#endif
+
+        return builder.compile(file, fetched);
+    }
+
+    /**
+     * @brief Print the jobs that failed or were skipped since the last
+     * report, `job_mutex` must be held
+     */
+    void report_failures() {
+        const size_t failures = self.failed.size() - self.reported_failures;
+        const size_t skips = self.skipped.size() - self.reported_skips;
+
+        std::cout << "Build failed: " << failures << " failed, " << skips
+                  << " skipped\n";
+
+        for (size_t i = self.reported_failures; i < self.failed.size(); ++i) {
+            std::cout << "  failed:  " << self.failed[i] << "\n";
+        }
+        for (size_t i = self.reported_skips; i < self.skipped.size(); ++i) {
+            std::cout << "  skipped: " << self.skipped[i] << "\n";
+        }
+
+        self.reported_failures = self.failed.size();
+        self.reported_skips = self.skipped.size();
+    }
+
+    /**
+     * @brief Terminate the process groups of all running jobs
+     */
+    // Children the running jobs start from now on are terminated by `spawn`
+    void cancel_running() noexcept {
+#ifndef _WIN32
+        for (size_t i = 0; i < self.workers.size(); ++i) {
+            const pid_t pid =
+                self.job_children[i].exchange(details::CANCELLED_CHILD);
+            if (pid > 0) {
+                kill(-pid, SIGTERM);
+            }
+        }
+
+        for (const size_t index : self.running_commands) {
+            const pid_t pid =
+                self.jobs[index].child->exchange(details::CANCELLED_CHILD);
+            if (pid > 0) {
+                kill(-pid, SIGTERM);
+            }
+        }
+#endif
+    }
+
+    void create_worker(size_t worker) {
+#ifndef _WIN32
+        details::current_job_slot() = &self.job_children[worker];
+#endif
+        metrics::Registry& counters = metrics::global();
+        metrics::Counter& idle =
+            counters.worker_idle_ns(counters.next_worker());
+
+        while (true) {
+            std::unique_lock<std::mutex> lock(self.job_mutex);
+
+            const metrics::Clock::time_point idle_start =
+                metrics::Clock::now();
+            self.job_cv.wait(lock, [this]() {
+                return !this->queue.empty() ||
+                       (this->all_finished && this->running == 0);
+            });
+
+            if (self.queue.empty()) {
+                return;
+            }
+            idle.add(metrics::nanoseconds_since(idle_start));
+
+            const size_t index = self.queue.top().index;
+            self.queue.pop();
+            counters.set_queue_depth(static_cast<int64_t>(self.queue.size()));
+
+            const std::shared_ptr<CommandJob> command =
+                self.jobs[index].command;
+            if (self.jobs[index].completing) {
+                // Still counted in `running` since it was started
+                Job& job = self.jobs[index];
+                const int exit_code = job.exit_code;
+                const std::string output = std::move(job.output);
+                const size_t lane = self.worker_count + job.lane;
+                const uint64_t start = job.start_ns;
+                lock.unlock();
+
+                self.finish_job(index, lane, start,
+                    command->complete(exit_code, output), false);
+                continue;
+            }
+            if (command && !command->build_step) {
+                if (self.commands_running >= self.max_commands) {
+                    // Queued again once a running command finished
+                    self.waiting_commands.push_back(index);
+                    continue;
+                }
+                ++self.commands_running;
+            } else {
+                if (self.jobs_running >= self.worker_count) {
+                    // Compiles and links keep running without a worker
+                    self.waiting_jobs.push_back(index);
+                    continue;
+                }
+                ++self.jobs_running;
+            }
+            if (command) {
+#ifndef _WIN32
+                self.running_commands.insert(index);
+#endif
+                self.jobs[index].lane = self.take_command_lane();
+            }
+            const size_t lane =
+                command ? self.worker_count + self.jobs[index].lane : worker;
+
+            std::function<bool()> job = std::move(self.jobs[index].run);
+            // `add_builder` may grow `jobs` once the lock is released
+            const std::string name = self.jobs[index].name;
+            const bool skip = self.jobs[index].dependency_failed;
+            const bool cancelled = self.cancelled;
+#ifndef _WIN32
+            self.job_children[worker].store(
+                cancelled ? details::CANCELLED_CHILD : 0);
+#endif
+            ++self.running;
+            lock.unlock();
+
+            bool succeeded = false;
+            const uint64_t start = metrics::nanoseconds_since(self.created);
+            if (cancelled) {
+                // Reported once by `wait`
+            } else if (skip) {
+                std::cout << "Skipping " << name
+                          << " because a dependency failed\n";
+            } else if (command) {
+                counters.jobs_run.add();
+                self.start_command(index, lane, start, *command);
+                continue;
+            } else {
+                counters.jobs_run.add();
+                succeeded = job();
+            }
+
+            self.finish_job(index, lane, start, succeeded, skip || cancelled);
+        }
+    }
+
+    /**
+     * @brief Get the first free trace lane for a command job, `job_mutex`
+     * must be held
+     */
+    size_t take_command_lane() {
+        for (size_t lane = 0; lane < self.command_lanes.size(); ++lane) {
+            if (!self.command_lanes[lane]) {
+                self.command_lanes[lane] = true;
+                return lane;
+            }
+        }
+
+        self.command_lanes.push_back(true);
+        return self.command_lanes.size() - 1;
+    }
+
+    /**
+     * @brief Start the process of a command job
      *
-     * @param dirs A list of directories to include
-     * @return `nobpp::CommandBuilder&`
-     * @code
-     * ```cpp
-     * builder.add_include_dirs({"./include", "./src"});
-     * ```
-     * @endcode
+     * The job is finished by the thread of `create_process_async` once the
+     * process exited, the worker is free in the meantime.
      */
-    CommandBuilder& add_include_dirs(
-        std::initializer_list<std::string> dirs) noexcept {
-        self.include_dirs.reserve(self.include_dirs.size() + dirs.size());
-        self.include_dirs.insert(
-            self.include_dirs.end(), dirs.begin(), dirs.end());
-        return self;
+    void start_command(size_t index, size_t lane, uint64_t start,
+        const CommandJob& command) {
+        std::string line;
+        const bool prepared = command.prepare(line);
+
+        if (!prepared || line == "") {
+            self.finish_job(index, lane, start, prepared, false);
+            return;
+        }
+
+#ifdef _WIN32
+        std::string output;
+        const int result = create_process(line, output, command.timeout);
+        self.finish_job(index, lane, start,
+            command.complete(result, output), false);
+#else
+        std::atomic<pid_t>* child = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(self.job_mutex);
+            child = self.jobs[index].child.get();
+            self.jobs[index].start_ns = start;
+        }
+
+        const pid_t pid = details::start_process_async(line, command.timeout,
+            [this, index](int result, std::string output) {
+                this->complete_command(index, result, std::move(output));
+            },
+            child);
+
+        if (pid < 0) {
+            self.finish_job(
+                index, lane, start, command.complete(-1, ""), false);
+        }
+#endif
     }
 
     /**
-     * @brief Add include directories from a list of directories
+     * @brief Queue the completion of a command job whose process exited,
+     * called on the thread of `create_process_async`
      *
-     * @param dirs A list of directories to include
-     * @return `nobpp::CommandBuilder&`
-     * @code
-     * ```cpp
-     * builder.add_include_dirs({"./include", "./src"});
-     * ```
-     * @endcode
+     * `complete` may parse depfiles or write records, so it runs on a
+     * worker instead of holding up the other processes.
      */
-    CommandBuilder& add_include_dirs(std::vector<std::string>&& dirs) noexcept {
-        self.include_dirs.reserve(self.include_dirs.size() + dirs.size());
-        self.include_dirs.insert(
-            self.include_dirs.end(), dirs.begin(), dirs.end());
-        return self;
+    void complete_command(size_t index, int result, std::string output) {
+        {
+            std::lock_guard<std::mutex> lock(self.job_mutex);
+            Job& job = self.jobs[index];
+            job.completing = true;
+            job.exit_code = result;
+            job.output = std::move(output);
+
+            self.queue.push(
+                ReadyJob{COMPLETION_PRIORITY, self.ready_count++, index});
+        }
+        // `wait` sleeps on the same condition, a worker has to wake up
+        self.job_cv.notify_all();
+    }
+
+    /**
+     * @brief Record the result of a job and queue the dependents that are
+     * ready now
+     *
+     * @param skipped The job did not run because a dependency failed or the
+     * queue was cancelled
+     */
+    void finish_job(size_t index, size_t lane, uint64_t start,
+        bool succeeded, bool skipped) {
+        metrics::Registry& counters = metrics::global();
+        const uint64_t end = metrics::nanoseconds_since(self.created);
+
+        std::lock_guard<std::mutex> lock(self.job_mutex);
+        --self.running;
+        if (self.trace_file != "" && !skipped) {
+            self.trace.push_back(
+                TraceEvent{self.jobs[index].name, lane, start, end - start});
+        }
+        self.jobs[index].finished = true;
+        self.jobs[index].succeeded = succeeded;
+
+        if (skipped) {
+            counters.jobs_skipped.add();
+            self.skipped.push_back(self.jobs[index].name);
+        } else if (!succeeded && self.cancelled) {
+            std::cout << "Cancelled " << self.jobs[index].name << "\n";
+            counters.jobs_skipped.add();
+            self.skipped.push_back(self.jobs[index].name);
+        } else if (!succeeded) {
+            std::cout << "Failed to " << self.jobs[index].name << "\n";
+            counters.jobs_failed.add();
+            self.failed.push_back(self.jobs[index].name);
+
+            if (self.failure_mode == FailureMode::fail_fast) {
+                self.cancelled = true;
+                self.cancel_running();
+            }
+        }
+
+        const std::shared_ptr<CommandJob>& command = self.jobs[index].command;
+        if (command) {
+#ifndef _WIN32
+            self.running_commands.erase(index);
+#endif
+            self.command_lanes[self.jobs[index].lane] = false;
+        }
+        if (command && !command->build_step) {
+            --self.commands_running;
+            if (!self.waiting_commands.empty()) {
+                self.make_ready(self.waiting_commands.front());
+                self.waiting_commands.pop_front();
+            }
+        } else {
+            --self.jobs_running;
+            if (!self.waiting_jobs.empty()) {
+                self.make_ready(self.waiting_jobs.front());
+                self.waiting_jobs.pop_front();
+            }
+        }
+
+        for (const size_t dependent : self.jobs[index].dependents) {
+            if (!succeeded) {
+                self.jobs[dependent].dependency_failed = true;
+            }
+            if (--self.jobs[dependent].pending == 0) {
+                self.make_ready(dependent);
+            }
+        }
+        counters.set_queue_depth(static_cast<int64_t>(self.queue.size()));
+
+        // With the lock held, `wait` may return and the queue be destroyed
+        // as soon as the thread of a command job releases it
+        self.job_cv.notify_all();
     }
+};
 
+/**
+ * @brief Configure time feature checks, the `check_*` functions of CMake
+ *
+ * Probes are compiled concurrently as tasks of a `CommandQueue`. Results are
+ * memoised in `<cache_dir>/results`, keyed by the compiler, its version and
+ * the probe source, so repeated runs do not spawn the compiler at all.
+ * `write_header` only touches `config.h` when a value changed, so it does
+ * not trigger rebuilds.
+ *
+ * @code
+ * ```cpp
+ * nobpp::Configure configure(nobpp::Toolchain::clang());
+ * configure.check_header("HAVE_UNISTD_H", "unistd.h")
+ *     .check_symbol("HAVE_MEMFD_CREATE", "memfd_create", {"sys/mman.h"})
+ *     .check_flag("HAVE_AVX2", "-mavx2");
+ *
+ * nobpp::CommandQueue queue(8);
+ * configure.run(queue);
+ * configure.write_header("./build/config.h");
+ * ```
+ * @endcode
+ */
+class Configure {
+public:
     /**
-     * @brief Add include directories from a list of directories
+     * @brief Construct a new Configure object
      *
-     * @param dirs A list of directories to include
-     * @return `nobpp::CommandBuilder&`
-     * @code
-     * ```cpp
-     * builder.add_include_dirs({"./include", "./src"});
-     * ```
-     * @endcode
+     * @param toolchain The toolchain the probes are compiled with
+     * @param language Selects the C or the C++ compiler
      */
-    CommandBuilder& add_include_dirs(
-        const std::vector<std::string>& dirs) noexcept {
-        self.include_dirs.reserve(self.include_dirs.size() + dirs.size());
-        self.include_dirs.insert(
-            self.include_dirs.end(), dirs.begin(), dirs.end());
-        return self;
-    }
+    Configure(std::shared_ptr<Toolchain> toolchain,
+        Language language = Language::cpp)
+        : toolchain(std::move(toolchain)), language(language) {}
+    Configure(const Configure&) = delete;
+    Configure& operator=(const Configure&) = delete;
 
     /**
-     * @brief Add a source file
+     * @brief Set the directory results are cached in
      *
-     * @param file The source file to add
-     * @return `nobpp::CommandBuilder&`
-     * @code
-     * ```cpp
-     * builder.add_file("./src/main.cpp");
-     * ```
-     * @endcode
+     * @param dir The directory, `.nobpp/configure` by default
+     * @return `Configure&`
      */
-    CommandBuilder& add_file(const char* file) noexcept {
-        self.files.push_back(file);
+    Configure& set_cache_dir(const std::string& dir) {
+        self.cache_dir = dir;
         return self;
     }
 
     /**
-     * @brief Add a source file
+     * @brief Check if a header can be included
      *
-     * @param file The source file to add
-     * @return `nobpp::CommandBuilder&`
-     * @code
-     * ```cpp
-     * builder.add_file("./src/main.cpp");
-     * ```
-     * @endcode
+     * @param define Name of the macro defined in `config.h`
+     * @param header The header, e.g. `sys/mman.h`
+     * @return `Configure&`
      */
-    CommandBuilder& add_file(const std::string& file) noexcept {
-        self.files.push_back(file);
-        return self;
+    Configure& check_header(
+        const std::string& define, const std::string& header) {
+        return self.add_probe(define,
+            "#include <" + header + ">\nint main(void) { return 0; }\n", "",
+            false);
     }
 
     /**
-     * @brief Add source files from a directory
+     * @brief Check if a function, variable or macro is available after
+     * including some headers, the probe is linked
      *
-     * @param target_directory The directory to search for source files
-     * @param recursive Whether to search recursively
-     * @return `nobpp::CommandBuilder&`
-     * @code
-     * ```cpp
-     * builder.add_files("./src");
-     * ```
-     * @endcode
+     * @param define Name of the macro defined in `config.h`
+     * @param symbol The symbol
+     * @param headers Headers declaring the symbol
+     * @return `Configure&`
      */
-    CommandBuilder& add_files(
-        const char* target_directory, bool recursive = true) {
-        std::function<bool(const std::string&)> file_predicate;
+    Configure& check_symbol(const std::string& define,
+        const std::string& symbol, const std::vector<std::string>& headers) {
+        std::string source;
 
-        if (self.language == Language::c) {
-            file_predicate = is_c_file;
-        } else {
-            file_predicate = is_cpp_file;
+        for (const std::string& header : headers) {
+            source += "#include <" + header + ">\n";
         }
 
-        const std::vector<std::string> file_list =
-            readdir(target_directory, file_predicate, recursive);
-        for (const std::string& file : file_list) {
-            self.files.push_back(file);
-        }
-        return self;
+        source += "int main(int argc, char** argv) {\n"
+                  "    (void)argv;\n"
+                  "#ifndef " +
+                  symbol +
+                  "\n"
+                  "    return ((int*)(&" +
+                  symbol +
+                  "))[argc];\n"
+                  "#else\n"
+                  "    return argc;\n"
+                  "#endif\n"
+                  "}\n";
+
+        return self.add_probe(define, source, "", true);
     }
 
     /**
-     * @brief Add source files from a directory
+     * @brief Check if the compiler accepts a flag without warnings
      *
-     * @param target_directory The directory to search for source files
-     * @param recursive Whether to search recursively
-     * @return `nobpp::CommandBuilder&`
-     * @code
-     * ```cpp
-     * builder.add_files("./src");
-     * ```
-     * @endcode
+     * @param define Name of the macro defined in `config.h`
+     * @param flag The flag
+     * @return `Configure&`
      */
-    CommandBuilder& add_files(
-        const std::string& target_directory, bool recursive = true) {
-        std::function<bool(const std::string&)> file_predicate;
-
-        if (self.language == Language::c) {
-            file_predicate = is_c_file;
-        } else {
-            file_predicate = is_cpp_file;
-        }
-
-        const std::vector<std::string> file_list =
-            readdir(target_directory, file_predicate, recursive);
-        for (const std::string& file : file_list) {
-            self.files.push_back(file);
-        }
-        return self;
+    Configure& check_flag(const std::string& define, const std::string& flag) {
+        return self.add_probe(
+            define, "int main(void) { return 0; }\n", "-Werror " + flag, false);
     }
 
     /**
-     * @brief Add source files from a directory with a custom file predicate
+     * @brief Check if a source snippet compiles
      *
-     * @param target_directory The directory to search for source files
-     * @param file_predicate A function that returns true if the file should be
-     * included
-     * @param recursive Whether to search recursively
-     * @return `nobpp::CommandBuilder&`
-     * @code
-     * ```cpp
-     * builder.add_files("./src", [](const std::string& file) {
-     *     return file.find(".cpp") != std::string::npos;
-     * });
-     * ```
-     * @endcode
+     * @param define Name of the macro defined in `config.h`
+     * @param source The source code
+     * @param flags Extra flags passed to the compiler
+     * @return `Configure&`
      */
-    CommandBuilder& add_files(const char* target_directory,
-        std::function<bool(const std::string&)> file_predicate,
-        bool recursive = true) {
-        const std::vector<std::string> file_list =
-            readdir(target_directory, file_predicate, recursive);
-        for (const std::string& file : file_list) {
-            self.files.push_back(file);
-        }
-        return self;
+    Configure& check_source_compiles(const std::string& define,
+        const std::string& source, const std::string& flags = "") {
+        return self.add_probe(define, source, flags, false);
     }
 
     /**
-     * @brief Add source files from a directory with a custom file predicate
+     * @brief Define a macro with a fixed value in `config.h`
      *
-     * @param target_directory The directory to search for source files
-     * @param file_predicate A function that returns true if the file should be
-     * included
-     * @param recursive Whether to search recursively
-     * @return `nobpp::CommandBuilder&`
-     * @code
-     * ```cpp
-     * builder.add_files("./src", [](const std::string& file) {
-     *     return file.find(".cpp") != std::string::npos;
-     * });
-     * ```
-     * @endcode
+     * @param define Name of the macro
+     * @param value The value, written as is
+     * @return `Configure&`
      */
-    CommandBuilder& add_files(const std::string& target_directory,
-        std::function<bool(const std::string&)> file_predicate,
-        bool recursive = true) {
-        const std::vector<std::string> file_list =
-            readdir(target_directory, file_predicate, recursive);
-        for (const std::string& file : file_list) {
-            self.files.push_back(file);
-        }
+    Configure& set_define(const std::string& define, const std::string& value) {
+        Probe probe;
+        probe.define = define;
+        probe.value = value;
+        probe.done = true;
+        probe.result = true;
+        self.probes.push_back(probe);
         return self;
     }
 
     /**
-     * @brief Add source files from a list of files
+     * @brief Run every probe that is not cached on the queue and wait for
+     * them
      *
-     * @param files  A list of source files
-     * @return `nobpp::CommandBuilder&`
-     * @code
-     * ```cpp
-     * builder.add_files({"./src/main.cpp", "./src/utils.cpp"});
-     * ```
-     * @endcode
+     * Waits for all jobs of the queue, so run it before adding builders.
+     *
+     * @param queue The queue
      */
-    CommandBuilder& add_files(
-        std::initializer_list<std::string> files) noexcept {
-        self.files.reserve(self.files.size() + files.size());
-        self.files.insert(self.files.end(), files.begin(), files.end());
-        return self;
+    void run(CommandQueue& queue) {
+        std::map<std::string, bool> results = self.load_results();
+        const std::string compiler = self.toolchain->compiler(self.language);
+        const std::string version = self.toolchain->version(self.language);
+        size_t probed = 0;
+
+        for (Probe& probe : self.probes) {
+            if (probe.done) {
+                continue;
+            }
+
+            sha256::Hasher hasher;
+            hasher.update(compiler).update("", 1).update(version).update("", 1);
+            hasher.update(probe.link ? "link" : "compile").update("", 1);
+            hasher.update(probe.flags).update("", 1).update(probe.source);
+            probe.key = hasher.hex_digest();
+
+            auto it = results.find(probe.key);
+            if (it != results.end()) {
+                probe.result = it->second;
+                probe.done = true;
+                continue;
+            }
+
+            Probe* pending = &probe;
+            ++probed;
+            queue.add_task("configure " + probe.define, [this, pending]() {
+                pending->result = this->toolchain->try_compile(this->language,
+                    pending->source, pending->flags, pending->link,
+                    this->cache_dir + "/probes");
+                return true;
+            });
+        }
+
+        if (probed == 0) {
+            return;
+        }
+
+        queue.wait();
+
+        for (Probe& probe : self.probes) {
+            if (!probe.done) {
+                probe.done = true;
+                results[probe.key] = probe.result;
+                std::cout << "Checking " << probe.define << " - "
+                          << (probe.result ? "yes" : "no") << "\n";
+            }
+        }
+
+        self.save_results(results);
     }
 
     /**
-     * @brief Add source files from a list of files
+     * @brief Get the result of a probe, `run` must have been called
      *
-     * @param files  A list of source files
-     * @return `nobpp::CommandBuilder&`
-     * @code
-     * ```cpp
-     * std::vector<std::string> files = {"./src/main.cpp", "./src/utils.cpp"};
-     * builder.add_files({"./src/main.cpp", "./src/utils.cpp"});
-     * ```
-     * @endcode
+     * @param define Name of the macro of the probe
+     * @return `true` if the probe succeeded
      */
-    CommandBuilder& add_files(std::vector<std::string>&& files) noexcept {
-        self.files.reserve(self.files.size() + files.size());
-        self.files.insert(self.files.end(), files.begin(), files.end());
-        return self;
+    bool get(const std::string& define) const {
+        for (const Probe& probe : self.probes) {
+            if (probe.define == define) {
+                return probe.done && probe.result;
+            }
+        }
+
+        return false;
     }
 
     /**
-     * @brief Add source files from a list of files
+     * @brief Create the content of `config.h`
      *
-     * @param files  A list of source files
-     * @return `nobpp::CommandBuilder&`
-     * @code
-     * ```cpp
-     * builder.add_files({"./src/main.cpp", "./src/utils.cpp"});
-     * ```
-     * @endcode
+     * @return `std::string`
      */
-    CommandBuilder& add_files(const std::vector<std::string>& files) noexcept {
-        self.files.reserve(self.files.size() + files.size());
-        self.files.insert(self.files.end(), files.begin(), files.end());
-        return self;
+    std::string create_header() const {
+        std::string header = "/* Generated by nobpp, do not edit */\n"
+                             "#pragma once\n\n";
+
+        for (const Probe& probe : self.probes) {
+            if (probe.value != "") {
+                header += "#define " + probe.define + " " + probe.value + "\n";
+            } else if (probe.done && probe.result) {
+                header += "#define " + probe.define + " 1\n";
+            } else {
+                header += "/* #undef " + probe.define + " */\n";
+            }
+        }
+
+        return header;
     }
 
     /**
-     * @brief Add any compiler option
+     * @brief Write `config.h`, the file is left untouched if nothing changed
      *
-     * @param opt A compiler option
-     * @return `nobpp::CommandBuilder&`
-     * @code
-     * ```cpp
-     * builder.add_option("-ffast-math");
-     * ```
-     * @endcode
+     * @param path The path of the header
+     * @return `false` if the header could not be written
      */
-    CommandBuilder& add_option(const char* opt) noexcept {
-        self.options.push_back(opt);
-        return self;
+    bool write_header(const std::string& path) const {
+        create_parent_dir(path);
+        return write_file_if_changed(path, self.create_header());
     }
 
-    /**
-     * @brief Add any compiler option
-     *
-     * @param opt A compiler option
-     * @return `nobpp::CommandBuilder&`
-     * @code
-     * ```cpp
-     * builder.add_option("-ffast-math");
-     * ```
-     * @endcode
-     */
-    CommandBuilder& add_option(const std::string& opt) noexcept {
-        self.options.push_back(opt);
+private:
+    struct Probe {
+        std::string define;
+        std::string source;
+        std::string flags;
+        bool link = false;
+        std::string value;
+        std::string key;
+        bool done = false;
+        bool result = false;
+    };
+
+    Configure& self = *this;
+
+    std::shared_ptr<Toolchain> toolchain;
+    Language language;
+    std::string cache_dir = ".nobpp/configure";
+    /// Tasks keep pointers to the probes, so they must not move
+    std::deque<Probe> probes;
+
+private:
+    Configure& add_probe(const std::string& define, const std::string& source,
+        const std::string& flags, bool link) {
+        Probe probe;
+        probe.define = define;
+        probe.source = source;
+        probe.flags = flags;
+        probe.link = link;
+        self.probes.push_back(probe);
         return self;
     }
 
+    std::map<std::string, bool> load_results() const {
+        std::map<std::string, bool> results;
+        std::string content;
+
+        if (!read_file(self.cache_dir + "/results", content)) {
+            return results;
+        }
+
+        std::istringstream lines(content);
+        std::string line;
+        while (std::getline(lines, line)) {
+            const size_t tab = line.find('\t');
+            if (tab != std::string::npos) {
+                results[line.substr(0, tab)] = line.substr(tab + 1) == "1";
+            }
+        }
+
+        return results;
+    }
+
+    void save_results(const std::map<std::string, bool>& results) const {
+        std::string content;
+
+        for (const auto& result : results) {
+            content += result.first + "\t" + (result.second ? "1" : "0") + "\n";
+        }
+
+        create_parent_dir(self.cache_dir + "/results");
+        write_file_if_changed(self.cache_dir + "/results", content);
+    }
+};
+
+/**
+ * @brief Rebuild impact of every header, computed from the depfiles and the
+ * timing logs of previous builds
+ *
+ * For each header it reports how many translation units include it,
+ * directly or transitively, how many bytes it adds to their preprocessed
+ * input and how much compile time is spent in the translation units
+ * including it. Headers at the top are the best candidates for splitting or
+ * for a precompiled header.
+ *
+ * @code
+ * ```cpp
+ * nobpp::IncludeReport().add_builder(builder).print(std::cout, 20);
+ * ```
+ * @endcode
+ */
+class IncludeReport {
+public:
+    struct Header {
+        std::string path;
+        size_t translation_units = 0;
+        uint64_t size = 0;
+        /// `size` times the number of translation units including it
+        uint64_t preprocessed_bytes = 0;
+        double milliseconds = 0;
+    };
+
+    IncludeReport() = default;
+    IncludeReport(const IncludeReport&) = delete;
+    IncludeReport& operator=(const IncludeReport&) = delete;
+
     /**
-     * @brief Add any compiler options
+     * @brief Add the translation units of a builder, sources that were never
+     * compiled are ignored
      *
-     * @param opts A list of compiler options
-     * @return `nobpp::CommandBuilder&`
-     * @code
-     * ```cpp
-     * builder.add_options({"-ffast-math", "-fno-exceptions"});
-     * ```
-     * @endcode
+     * A builder with variants adds the translation units of every variant,
+     * they are compiled into the output directories of the variants.
+     *
+     * @param builder The builder
+     * @return `IncludeReport&`
      */
-    CommandBuilder& add_options(
-        std::initializer_list<std::string>&& opts) noexcept {
-        for (const std::string& opt : opts) {
-            self.options.push_back(opt);
+    IncludeReport& add_builder(const CommandBuilder& builder) {
+        if (!builder.get_variants().empty()) {
+            for (const Variant& variant : builder.get_variants()) {
+                self.add_builder(builder.with_variant(variant));
+            }
+            return self;
+        }
+
+        const TimingLog log(builder);
+
+        for (const std::string& source : builder.get_files()) {
+            std::vector<const std::string*> dependencies;
+            if (!builder.read_dependencies(source, dependencies, false)) {
+                continue;
+            }
+
+            double milliseconds = 0;
+            log.get(source, milliseconds);
+            ++self.translation_units;
+
+            // Interned, equal paths are the same string. Compilers list the
+            // source first, everything after it was included, which covers
+            // headers without an extension such as `<vector>`.
+            std::unordered_set<const std::string*> seen;
+            for (size_t i = 1; i < dependencies.size(); ++i) {
+                const std::string* entry = dependencies[i];
+                const std::string& dependency = *entry;
+                if (!seen.insert(entry).second) {
+                    continue;
+                }
+
+                Header& header = self.headers[dependency];
+                if (header.translation_units == 0) {
+                    header.path = dependency;
+                    header.size = file_size(dependency);
+                }
+
+                ++header.translation_units;
+                header.preprocessed_bytes += header.size;
+                header.milliseconds += milliseconds;
+            }
         }
+
         return self;
     }
 
     /**
-     * @brief Add any compiler options
+     * @brief Get every header, most expensive first
      *
-     * @param opts A list of compiler options
-     * @return `nobpp::CommandBuilder&`
-     * @code
-     * ```cpp
-     * builder.add_options({"-ffast-math", "-fno-exceptions"});
-     * ```
-     * @endcode
+     * @return `std::vector<IncludeReport::Header>`
      */
-    CommandBuilder& add_options(const std::vector<std::string>& opts) noexcept {
-        for (const std::string& opt : opts) {
-            self.options.push_back(opt);
+    std::vector<Header> get_headers() const {
+        std::vector<Header> sorted;
+        sorted.reserve(self.headers.size());
+
+        for (const auto& entry : self.headers) {
+            sorted.push_back(entry.second);
         }
-        return self;
+
+        std::sort(sorted.begin(), sorted.end(),
+            [](const Header& a, const Header& b) {
+                if (a.milliseconds != b.milliseconds) {
+                    return a.milliseconds > b.milliseconds;
+                }
+                if (a.translation_units != b.translation_units) {
+                    return a.translation_units > b.translation_units;
+                }
+                return a.path < b.path;
+            });
+
+        return sorted;
     }
 
     /**
-     * @brief Set the build directory
+     * @brief Print the most expensive headers as a table
      *
-     * @param dir The directory to build the output file in
-     * @return `nobpp::CommandBuilder&`
-     * @code
-     * ```cpp
-     * builder.set_build_dir("./bin");
-     * ```
-     * @endcode
+     * @param out The stream to print to
+     * @param limit Number of headers to print, `0` prints all of them
      */
-    CommandBuilder& set_build_dir(const std::string& dir) noexcept {
-        self.build_dir = dir;
-        return self;
+    void print(std::ostream& out = std::cout, size_t limit = 20) const {
+        const std::vector<Header> sorted = self.get_headers();
+        const size_t count =
+            limit == 0 ? sorted.size() : std::min(limit, sorted.size());
+
+        char line[128];
+        std::snprintf(line, sizeof(line), "%12s %8s %12s  %s\n",
+            "compile (s)", "TUs", "bytes (KiB)", "header");
+        out << line;
+
+        for (size_t i = 0; i < count; ++i) {
+            const Header& header = sorted[i];
+            std::snprintf(line, sizeof(line), "%12.2f %8zu %12.1f  ",
+                header.milliseconds / 1000.0, header.translation_units,
+                static_cast<double>(header.preprocessed_bytes) / 1024.0);
+            out << line << header.path << "\n";
+        }
+
+        out << self.headers.size() << " headers in "
+            << self.translation_units << " translation units\n";
     }
 
+private:
+    IncludeReport& self = *this;
+
+    size_t translation_units = 0;
+    std::unordered_map<std::string, Header> headers;
+};
+
+/**
+ * @brief Dry run of the jobs a `CommandQueue` would run for some builders
+ *
+ * Computes which nodes are out of date and why, from file stats, depfiles
+ * and the recorded commands, without spawning anything.
+ *
+ * @code
+ * ```cpp
+ * nobpp::BuildPlan plan;
+ * plan.add_builder(builder).print();
+ * // run      compile ./src/main.cpp: header ./src/foo.hpp newer
+ * // run      link ./bin/main: 1 object will be rebuilt
+ * // 2 of 2 nodes will run
+ * ```
+ * @endcode
+ */
+class BuildPlan {
+public:
+    struct Node {
+        /// Name of the job, as printed by `CommandQueue`
+        std::string name;
+        bool will_run = false;
+        /// Why the node runs, empty if it is up to date
+        std::string reason;
+    };
+
+    BuildPlan() = default;
+    BuildPlan(const BuildPlan&) = delete;
+    BuildPlan& operator=(const BuildPlan&) = delete;
+
     /**
-     * @brief Set the output file
+     * @brief Add the nodes of a builder, or of each of its variants
      *
-     * @param output The name of the output file
-     * @return `nobpp::CommandBuilder&`
-     * @code
-     * ```cpp
-     * builder.set_output("test");
-     * ```
-     * @endcode
+     * @param builder The builder
+     * @return `BuildPlan&`
      */
-    CommandBuilder& set_output(const std::string& output) noexcept {
-        std::string out = output;
-
-        if (self.target_os == TargetOS::windows &&
-            out.find(".exe") == std::string::npos) {
-            out += ".exe";
+    BuildPlan& add_builder(const CommandBuilder& builder) {
+        if (!builder.get_variants().empty()) {
+            for (const Variant& variant : builder.get_variants()) {
+                self.add_target(builder.with_variant(variant));
+            }
+            return self;
         }
 
-        self.output = out;
+        self.add_target(builder);
 
         return self;
     }
 
     /**
-     * @brief Create a command object
+     * @brief Get every node in the order `CommandQueue` would add them
      *
-     * @return std::string
-     * @code
-     * ```cpp
-     * std::string command = builder.create_command();
-     * ```
+     * @return `const std::vector<BuildPlan::Node>&`
      */
-    std::string create_command() const {
-        std::vector<std::string> command;
+    const std::vector<Node>& get_nodes() const noexcept {
+        return self.nodes;
+    }
 
-        switch (self.compiler) {
-            case Compiler::clang:
-                if (self.language == Language::c) {
-                    command.push_back("clang");
-                } else {
-                    command.push_back("clang++");
-                }
-                break;
-            case Compiler::gcc:
-                if (self.language == Language::c) {
-                    command.push_back("gcc");
-                } else {
-                    command.push_back("g++");
-                }
-                break;
+    /**
+     * @brief Count the nodes that will run
+     */
+    size_t count_running() const noexcept {
+        size_t count = 0;
+        for (const Node& node : self.nodes) {
+            count += node.will_run ? 1 : 0;
         }
+        return count;
+    }
 
-        switch (self.optimization_level) {
-            case OptimizationLevel::o0:
-                command.push_back("-O0");
-                break;
-            case OptimizationLevel::o1:
-                command.push_back("-O1");
-                break;
-            case OptimizationLevel::o2:
-                command.push_back("-O2");
-                break;
-            case OptimizationLevel::o3:
-                command.push_back("-O3");
-                break;
-            case OptimizationLevel::os:
-                command.push_back("-Os");
-                break;
-            case OptimizationLevel::oz:
-                command.push_back("-Oz");
-                break;
+    /**
+     * @brief Print the nodes and why they run
+     *
+     * @param out The stream to print to
+     * @param all `false` to leave out nodes that are up to date
+     */
+    void print(std::ostream& out = std::cout, bool all = true) const {
+        for (const Node& node : self.nodes) {
+            if (node.will_run) {
+                out << "run      " << node.name << ": " << node.reason << "\n";
+            } else if (all) {
+                out << "skip     " << node.name << ": up to date\n";
+            }
         }
 
-        for (const std::string& option : self.options) {
-            command.push_back(option);
-        }
+        out << self.count_running() << " of " << self.nodes.size()
+            << " nodes will run\n";
+    }
 
-        for (const std::string& file : self.files) {
-            command.push_back(file);
+private:
+    using TargetKey = std::pair<const CommandBuilder*, std::string>;
+
+    BuildPlan& self = *this;
+
+    std::vector<Node> nodes;
+    StatCache stats;
+    /// Library relinked for each added target and the targets linking it,
+    /// empty if none
+    std::map<TargetKey, std::string> targets;
+    /// Targets whose dependencies are being added
+    std::vector<TargetKey> adding;
+
+    void add_node(const std::string& name, const std::string& reason) {
+        Node node;
+        node.name = name;
+        node.will_run = reason != "";
+        node.reason = reason;
+        self.nodes.push_back(std::move(node));
+    }
+
+    /**
+     * @brief Add the nodes of a builder without variants after the nodes of
+     * its dependencies
+     *
+     * @return the library relinked for the targets linking this one, or an
+     * empty string
+     */
+    std::string add_target(const CommandBuilder& builder) {
+        const TargetKey key(&builder.get_origin(), builder.get_variant_name());
+        if (std::find(self.adding.begin(), self.adding.end(), key) !=
+            self.adding.end()) {
+            throw std::invalid_argument(
+                "Dependency cycle through " + builder.get_name() + ".");
         }
 
-        for (const std::string& include_dir : self.include_dirs) {
-            command.push_back("-I" + include_dir);
+        auto found = self.targets.find(key);
+        if (found != self.targets.end()) {
+            return found->second;
         }
 
-        if (self.build_dir != "" && self.output != "") {
-            if (!dir_exists(self.build_dir)) {
-                createDirectoryRecursively(self.build_dir);
-            }
+        builder.validate();
 
-            std::string out_file = self.build_dir + "/" + self.output;
-            command.push_back("-o");
-            command.push_back(out_file);
-        } else {
-            if (self.output != "") {
-                command.push_back("-o");
-                command.push_back(output);
+        self.adding.push_back(key);
+
+        std::string relinked_library;
+        for (const CommandBuilder* dependency : builder.get_dependencies()) {
+            const CommandBuilder resolved =
+                builder.resolve_dependency(*dependency);
+            const std::string relinked = self.add_target(
+                dependency->get_variants().empty() ? *dependency : resolved);
+
+            if (relinked != "" &&
+                resolved.get_output_type() != OutputType::executable) {
+                relinked_library = relinked;
             }
         }
+        self.adding.pop_back();
+
+        metrics::ScopedTimer timer(metrics::global().plan_ns);
+
+        const std::string cache_note =
+            builder.get_cache() ? " (cache lookup)" : "";
+        size_t rebuilt = 0;
+
+        const std::vector<CustomCommand>& commands =
+            builder.get_custom_commands();
+        std::vector<bool> regenerated;
+        for (const CustomCommand& command : commands) {
+            const std::string reason =
+                builder.explain_custom_command(command, &self.stats);
+            regenerated.push_back(reason != "");
+            self.add_node("generate " + command.name, reason);
+        }
 
-        return join(command, ' ');
-    }
+        for (const std::string& file : builder.get_files()) {
+            std::string reason = builder.explain_compile(file, &self.stats);
 
-    /**
-     * @brief Run the command
-     *
-     * @code
-     * ```cpp
-     * builder.run();
-     * ```
-     * @endcode
-     */
-    void run() const {
-        const std::string command = create_command();
-        Process process;
-        process.set_command(command);
+            for (const size_t command :
+                builder.custom_commands_for(file, &self.stats)) {
+                if (reason == "" && regenerated[command]) {
+                    reason = "generator " + commands[command].name +
+                             " will run";
+                }
+            }
+            rebuilt += reason == "" ? 0 : 1;
+            self.add_node("compile " + file,
+                reason == "" ? "" : reason + cache_note);
+        }
 
-        create_process(command);
+        for (const Resource& resource : builder.get_resources()) {
+            const std::string reason =
+                builder.explain_resource(resource, &self.stats);
+            rebuilt += reason == "" ? 0 : 1;
+            self.add_node("embed " + resource.path,
+                reason == "" ? "" : reason + cache_note);
+        }
 
-        if (self.project_name == "") {
-            std::cout << "Compile finished\n";
+        std::string link_reason;
+        if (rebuilt > 0) {
+            link_reason = std::to_string(rebuilt) +
+                          (rebuilt == 1 ? " object" : " objects") +
+                          " will be rebuilt";
+        } else if (relinked_library != "" &&
+                   builder.get_output_type() !=
+                       OutputType::static_library) {
+            link_reason = "library " + relinked_library + " will be relinked";
         } else {
-            std::cout << "Project " << self.project_name
-                      << " compile finished\n";
+            link_reason = builder.explain_link(&self.stats);
         }
-    }
+        self.add_node("link " + builder.output_file(), link_reason);
 
-private:
-    CommandBuilder& self = *this;
+        if (builder.packages_debug_info()) {
+            self.add_node("package " + builder.debug_package_file(),
+                link_reason != "" ? "output will be relinked"
+                                  : builder.explain_package());
+        }
 
-    std::string project_name = "";
-    Compiler compiler = Compiler::clang;
-    Language language = Language::cpp;
-    TargetOS target_os;
-    OptimizationLevel optimization_level = OptimizationLevel::o3;
-    std::vector<std::string> include_dirs;
-    std::vector<std::string> files;
-    std::vector<std::string> options;
-    std::string build_dir;
-    std::string output;
+        for (const Test& test : builder.get_tests()) {
+            for (unsigned shard = 0; shard < test.shards; ++shard) {
+                self.add_node(builder.test_job_name(test, shard),
+                    link_reason != ""
+                        ? "output will be relinked"
+                        : builder.explain_test(test, shard, &self.stats));
+            }
+        }
+
+        // Static libraries are linked together with their own libraries
+        std::string relinked;
+        if (link_reason != "") {
+            relinked = builder.output_file();
+        } else if (builder.get_output_type() == OutputType::static_library) {
+            relinked = relinked_library;
+        }
+
+        self.targets[key] = relinked;
+        return relinked;
+    }
 };
 
 /**
- * @brief Creates a pool of process that will be used to run multiple processes
- * at once
+ * @brief Command line front end for build scripts
  *
- */
-class ProcessPool {};
-
-/**
- * @brief Queue of commands that can run multiple commands in parallel
- * @code
- * ```cpp
- * #include "nobpp.hpp"
+ * Builds only the requested targets and their dependencies:
  *
- * int main() {
- *     const nobpp::CommandBuilder builder1 = nobpp::CommandBuilder();
- *     const nobpp::CommandBuilder builder2 = nobpp::CommandBuilder();
- *     const nobpp::CommandBuilder builder3 = nobpp::CommandBuilder();
- *     const nobpp::CommandBuilder builder4 = nobpp::CommandBuilder();
+ * ```sh
+ * ./build -j32 app tests --variant=release
+ * ./build --dry-run app
+ * ```
  *
- *     const nobpp::CommandQueue queue = nobpp::CommandQueue(4);
- *     queue.add_builder(builder1)
- *          .add_builder(builder2)
- *          .add_builder(builder3)
- *          .add_builder(builder4);
+ * Targets are named by `CommandBuilder::get_name`, all targets are built
+ * when none is requested.
+ *
+ * @code
+ * ```cpp
+ * int main(int argc, char** argv) {
+ *     return nobpp::Cli(argc, argv).add_target(core).add_target(app).run();
  * }
  * ```
  * @endcode
  */
-class CommandQueue {
+class Cli {
 public:
-    CommandQueue(size_t max_processes = 8) noexcept {
-        self.workers.reserve(max_processes);
-
-        for (size_t i = 0; i < max_processes; ++i) {
-            self.workers.emplace_back([this]() { this->create_worker(); });
+    Cli(int argc, const char* const* argv) {
+        self.program = argc > 0 ? argv[0] : "build";
+
+        const unsigned hardware = std::thread::hardware_concurrency();
+        self.jobs = hardware == 0 ? 8 : hardware;
+
+        bool options_done = false;
+        for (int i = 1; i < argc && self.error == ""; ++i) {
+            const std::string argument = argv[i];
+            const char* next = i + 1 < argc ? argv[i + 1] : nullptr;
+
+            if (options_done || argument.empty() || argument[0] != '-') {
+                self.targets.push_back(argument);
+            } else if (argument == "--") {
+                options_done = true;
+            } else if (argument == "-h" || argument == "--help") {
+                self.help = true;
+            } else if (argument == "-n" || argument == "--dry-run") {
+                self.dry_run = true;
+            } else if (argument == "-k" || argument == "--keep-going") {
+                self.failure_mode = FailureMode::keep_going;
+            } else if (argument == "--fail-fast") {
+                self.failure_mode = FailureMode::fail_fast;
+            } else if (argument == "-j" || argument == "--jobs") {
+                i += self.parse_jobs(next) ? 1 : 0;
+            } else if (argument.compare(0, 2, "-j") == 0) {
+                self.parse_jobs(argument.c_str() + 2);
+            } else if (argument.compare(0, 7, "--jobs=") == 0) {
+                self.parse_jobs(argument.c_str() + 7);
+            } else if (argument == "--variant" && next != nullptr) {
+                self.variant = next;
+                ++i;
+            } else if (argument == "--variant") {
+                self.error = "--variant needs the name of a variant";
+            } else if (argument.compare(0, 10, "--variant=") == 0) {
+                self.variant = argument.substr(10);
+            } else if (argument.compare(0, 8, "--trace=") == 0) {
+                self.trace_file = argument.substr(8);
+            } else if (argument == "--scheduling=fifo") {
+                self.scheduling = Scheduling::fifo;
+            } else if (argument == "--scheduling=longest-first") {
+                self.scheduling = Scheduling::longest_first;
+            } else {
+                self.error = "Unknown option " + argument;
+            }
         }
     }
-    CommandQueue(CommandQueue&) = delete;
-    CommandQueue& operator=(CommandQueue&) = delete;
+    Cli(const Cli&) = delete;
+    Cli& operator=(const Cli&) = delete;
 
-    ~CommandQueue() {
-        self.all_finished = true;
-        self.job_cv.notify_all();
+    /**
+     * @brief Make a builder selectable by its name
+     *
+     * The builder must outlive the call to `run`.
+     *
+     * @param builder The builder
+     * @return `Cli&`
+     */
+    Cli& add_target(const CommandBuilder& builder) {
+        self.builders.push_back(&builder);
+        return self;
+    }
 
-        for (size_t i = 0; i < self.workers.size(); ++i) {
-            self.workers[i].join();
+    size_t get_jobs() const noexcept {
+        return self.jobs;
+    }
+
+    const std::vector<std::string>& get_targets() const noexcept {
+        return self.targets;
+    }
+
+    const std::string& get_variant() const noexcept {
+        return self.variant;
+    }
+
+    bool is_dry_run() const noexcept {
+        return self.dry_run;
+    }
+
+    FailureMode get_failure_mode() const noexcept {
+        return self.failure_mode;
+    }
+
+    Scheduling get_scheduling() const noexcept {
+        return self.scheduling;
+    }
+
+    const std::string& get_trace_file() const noexcept {
+        return self.trace_file;
+    }
+
+    /**
+     * @brief Print the usage of the build script
+     */
+    void print_usage(std::ostream& out = std::cout) const {
+        out << "Usage: " << self.program << " [options] [targets...]\n"
+            << "  -j N, --jobs=N      run N jobs in parallel\n"
+            << "  --variant=NAME      build only the variant NAME\n"
+            << "  -n, --dry-run       print what would run and why\n"
+            << "  -k, --keep-going    keep going after a failure (default)\n"
+            << "  --fail-fast         stop at the first failure\n"
+            << "  --scheduling=NAME   fifo or longest-first (default)\n"
+            << "  --trace=FILE        write a Chrome trace of the jobs\n"
+            << "  -h, --help          print this help\n"
+            << "Targets:";
+
+        for (const CommandBuilder* builder : self.builders) {
+            out << " " << builder->get_name();
         }
+        out << "\n";
     }
 
     /**
-     * @brief Add job to the queue
+     * @brief Plan or build the requested targets
      *
-     * @param builder
-     * @return `CommandQueue&`
+     * @return exit code for `main`: `0` on success, `1` if a job failed or
+     * was skipped or the jobs could not be added, `2` for invalid arguments
+     * or builders
      */
-    CommandQueue& add_builder(const CommandBuilder& builder) {
-        if (self.all_finished) {
-            std::cout << "Worker Pool disabled\n";
-            return self;
+    int run() {
+        if (self.help) {
+            self.print_usage();
+            return 0;
         }
-        {
-            std::lock_guard<std::mutex> lock(self.job_mutex);
-            self.queue.push(
-                [&builder]() { create_process(builder.create_command()); });
+        if (self.error != "") {
+            std::cerr << self.error << "\n";
+            self.print_usage(std::cerr);
+            return 2;
         }
-        self.job_cv.notify_one();
 
-        return self;
-    }
+        try {
+            std::vector<std::unique_ptr<CommandBuilder>> variant_builders;
+            std::vector<const CommandBuilder*> roots;
 
-private:
-    CommandQueue& self = *this;
+            for (const CommandBuilder* builder : self.selected()) {
+                const Variant* variant = builder->find_variant(self.variant);
 
-    std::vector<std::thread> workers;
-    std::queue<std::function<void()>> queue;
+                if (self.variant == "" || builder->get_variants().empty()) {
+                    roots.push_back(builder);
+                } else if (variant != nullptr) {
+                    variant_builders.emplace_back(
+                        new CommandBuilder(builder->with_variant(*variant)));
+                    roots.push_back(variant_builders.back().get());
+                } else {
+                    throw std::invalid_argument("Target " +
+                                                builder->get_name() +
+                                                " has no variant named '" +
+                                                self.variant + "'.");
+                }
+            }
 
-    std::mutex job_mutex;
-    std::condition_variable job_cv;
+            if (self.dry_run) {
+                BuildPlan plan;
+                for (const CommandBuilder* root : roots) {
+                    plan.add_builder(*root);
+                }
+                plan.print();
+                return 0;
+            }
 
-    bool all_finished = false;
+            CommandQueue queue(self.jobs);
+            queue.set_failure_mode(self.failure_mode)
+                .set_scheduling(self.scheduling)
+                .set_trace_file(self.trace_file);
+            for (const CommandBuilder* root : roots) {
+                queue.add_builder(*root);
+            }
+            queue.wait();
+
+            return queue.get_failed().empty() && queue.get_skipped().empty()
+                       ? 0
+                       : 1;
+        } catch (const std::invalid_argument& error) {
+            std::cerr << error.what() << "\n";
+            return 2;
+        } catch (const std::exception& error) {
+            std::cerr << error.what() << "\n";
+            return 1;
+        }
+    }
 
 private:
-    void create_worker() {
-        while (true) {
-            std::unique_lock<std::mutex> lock(self.job_mutex);
+    Cli& self = *this;
+
+    std::string program;
+    size_t jobs = 8;
+    std::vector<std::string> targets;
+    std::string variant;
+    bool dry_run = false;
+    bool help = false;
+    FailureMode failure_mode = FailureMode::keep_going;
+    Scheduling scheduling = Scheduling::longest_first;
+    std::string trace_file;
+    std::string error;
+
+    std::vector<const CommandBuilder*> builders;
+
+    bool parse_jobs(const char* value) {
+        if (value == nullptr || *value < '1' || *value > '9') {
+            self.error = "-j needs a positive number of jobs";
+            return false;
+        }
 
-            self.job_cv.wait(lock,
-                [this]() { return !this->queue.empty() || self.all_finished; });
+        self.jobs = static_cast<size_t>(std::strtoul(value, nullptr, 10));
+        return true;
+    }
 
-            if (self.all_finished && self.queue.empty()) {
-                return;
-            }
+    std::vector<const CommandBuilder*> selected() const {
+        if (self.targets.empty()) {
+            return self.builders;
+        }
 
-            std::function<void()> job = std::move(self.queue.front());
-            self.queue.pop();
-            lock.unlock();
+        std::vector<const CommandBuilder*> found;
+        for (const std::string& target : self.targets) {
+            auto builder = std::find_if(self.builders.begin(),
+                self.builders.end(), [&target](const CommandBuilder* builder) {
+                    return builder->get_name() == target;
+                });
 
-            job();
+            if (builder == self.builders.end()) {
+                throw std::invalid_argument("Unknown target " + target + ".");
+            }
+            found.push_back(*builder);
         }
+
+        return found;
     }
 };
 
@@ -0,0 +1,46 @@
+/**
+ * @file build.cpp
+ * @brief Builds and runs the tests of nobpp, from the root of the repository:
+ *
+ * ```sh
+ * c++ -std=c++14 -pthread tests/build.cpp -o tests/build
+ * ./tests/build
+ * ```
+ */
+
+#include "check.hpp"
+
+int main(int argc, char** argv) {
+    const std::vector<std::string> names = {
+        "cache",
+        "cli",
+        "deps",
+        "files",
+        "hash",
+        "shard",
+        "toolchain",
+#ifndef _WIN32
+        "remote",
+#endif
+    };
+
+    std::deque<nobpp::CommandBuilder> tests;
+    nobpp::Cli cli(argc, argv);
+
+    for (const std::string& name : names) {
+        tests.emplace_back();
+        tests.back()
+            .set_project_name(name)
+            .set_compiler(check::compiler())
+            .set_language(nobpp::Language::cpp)
+            .set_mode(nobpp::Mode::debug)
+            .add_options({"-std=c++14", "-pthread"})
+            .add_file("./tests/" + name + "_test.cpp")
+            .set_build_dir("./tests/bin")
+            .set_output(name + "_test")
+            .add_test({name, {}, {}, 300, 1});
+        cli.add_target(tests.back());
+    }
+
+    return cli.run();
+}
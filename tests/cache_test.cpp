@@ -0,0 +1,288 @@
+#include "check.hpp"
+
+#include <map>
+
+#ifndef _WIN32
+    #include <arpa/inet.h>
+    #include <netinet/in.h>
+#endif
+
+namespace {
+
+void encodes_action_results() {
+    const std::string message =
+        nobpp::cache::encode_action_result("o", "ab", 3);
+    CHECK_EQ(message, std::string("\x12\x0b\x0a\x01o\x12\x06\x0a\x02"
+                                  "ab\x10\x03"));
+
+    std::string hash;
+    uint64_t size = 0;
+    CHECK(nobpp::cache::decode_action_result(message, hash, size));
+    CHECK_EQ(hash, "ab");
+    CHECK_EQ(size, 3u);
+
+    CHECK(!nobpp::cache::decode_action_result("", hash, size));
+    CHECK(!nobpp::cache::decode_action_result(
+        std::string(64, 'f'), hash, size));
+    // Truncated in the middle of the digest
+    CHECK(!nobpp::cache::decode_action_result(
+        message.substr(0, message.size() - 1), hash, size));
+}
+
+void round_trips_through_a_directory(const std::string& dir) {
+    auto backend = std::make_shared<nobpp::cache::DirectoryBackend>(dir);
+    const std::string action = nobpp::sha256::hex_digest("action");
+    const std::string blob = "object file";
+
+    {
+        nobpp::cache::Client client(backend);
+        client.store_async(action, blob);
+    }
+
+    std::string entry;
+    CHECK(backend->get(nobpp::cache::Store::ac, action, entry));
+    std::string hash;
+    uint64_t size = 0;
+    CHECK(nobpp::cache::decode_action_result(entry, hash, size));
+    CHECK_EQ(hash, nobpp::sha256::hex_digest(blob));
+    CHECK_EQ(size, blob.size());
+
+    nobpp::cache::Client client(backend);
+    std::string fetched;
+    CHECK(client.fetch(action, fetched));
+    CHECK_EQ(fetched, blob);
+
+    // A blob that does not match its address is a miss
+    backend->put(nobpp::cache::Store::cas, hash, "corrupted");
+    CHECK(!client.fetch(action, fetched));
+    CHECK(!client.fetch(nobpp::sha256::hex_digest("other"), fetched));
+}
+
+void compiles_once_and_fetches_afterwards(const std::string& dir) {
+    nobpp::write_file(dir + "/main.cpp",
+        "#include \"answer.h\"\nint main() { return ANSWER - 42; }\n");
+    nobpp::write_file(dir + "/answer.h", "#define ANSWER 42\n");
+
+    nobpp::CommandBuilder builder;
+    builder.set_compiler(check::compiler())
+        .set_language(nobpp::Language::cpp)
+        .add_file(dir + "/main.cpp")
+        .set_build_dir(dir + "/out")
+        .set_output("main")
+        .set_cache(std::make_shared<nobpp::cache::Client>(
+            std::make_shared<nobpp::cache::DirectoryBackend>(
+                dir + "/cache")));
+
+    const std::string source = dir + "/main.cpp";
+    const std::string object = builder.object_file(source);
+    nobpp::metrics::Counter& hits = nobpp::metrics::global().cache_hits;
+    const uint64_t hits_before = hits.get();
+
+    CHECK(builder.compile(source));
+    CHECK_EQ(hits.get(), hits_before);
+
+    // The preprocessor wrote the depfile, the compiler got its output
+    std::vector<const std::string*> dependencies;
+    CHECK(builder.read_dependencies(source, dependencies));
+    CHECK(std::any_of(dependencies.begin(), dependencies.end(),
+        [](const std::string* path) {
+            return path->find("answer.h") != std::string::npos;
+        }));
+    nobpp::FileStat info;
+    CHECK(!nobpp::stat_file(object + ".ii", info));
+
+    builder.set_cache(std::make_shared<nobpp::cache::Client>(
+        std::make_shared<nobpp::cache::DirectoryBackend>(dir + "/cache")));
+    std::remove(object.c_str());
+    CHECK(builder.compile(source));
+    CHECK_EQ(hits.get(), hits_before + 1);
+    CHECK(nobpp::stat_file(object, info));
+}
+
+#ifndef _WIN32
+/**
+ * @brief HTTP server keeping blobs in memory, answering with chunked
+ * bodies so the client has to decode them
+ */
+class Server {
+public:
+    Server() {
+        self.fd = ::socket(AF_INET, SOCK_STREAM, 0);
+
+        sockaddr_in address;
+        std::memset(&address, 0, sizeof(address));
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+        socklen_t length = sizeof(address);
+        ::bind(self.fd, reinterpret_cast<sockaddr*>(&address), length);
+        ::listen(self.fd, 8);
+        ::getsockname(self.fd, reinterpret_cast<sockaddr*>(&address), &length);
+        self.port = ntohs(address.sin_port);
+
+        self.thread = std::thread([this]() { this->serve(); });
+    }
+
+    ~Server() {
+        ::shutdown(self.fd, SHUT_RDWR);
+        ::close(self.fd);
+        self.thread.join();
+    }
+
+    uint16_t get_port() const {
+        return self.port;
+    }
+
+    std::map<std::string, std::string> blobs;
+    std::vector<std::string> requests;
+
+private:
+    Server& self = *this;
+
+    int fd = -1;
+    uint16_t port = 0;
+    std::thread thread;
+
+    void serve() {
+        while (true) {
+            const int client = ::accept(self.fd, nullptr, nullptr);
+            if (client < 0) {
+                return;
+            }
+
+            self.handle(client);
+            ::close(client);
+        }
+    }
+
+    void handle(int client) {
+        std::string request;
+        char chunk[4096];
+
+        while (request.find("\r\n\r\n") == std::string::npos) {
+            const ssize_t received = ::recv(client, chunk, sizeof(chunk), 0);
+            if (received <= 0) {
+                return;
+            }
+            request.append(chunk, static_cast<size_t>(received));
+        }
+
+        const size_t header_end = request.find("\r\n\r\n") + 4;
+        const std::string head = request.substr(0, header_end);
+        std::string body = request.substr(header_end);
+        const bool chunked =
+            head.find("Transfer-Encoding: chunked") != std::string::npos;
+        const size_t length_at = head.find("Content-Length: ");
+        const size_t length = length_at == std::string::npos
+                                  ? 0
+                                  : std::stoul(head.substr(length_at + 16));
+
+        while (chunked ? body.find("0\r\n\r\n") == std::string::npos
+                       : body.size() < length) {
+            const ssize_t received = ::recv(client, chunk, sizeof(chunk), 0);
+            if (received <= 0) {
+                return;
+            }
+            body.append(chunk, static_cast<size_t>(received));
+        }
+
+        const std::string method = head.substr(0, head.find(' '));
+        const size_t path_start = method.size() + 1;
+        const std::string path =
+            head.substr(path_start, head.find(' ', path_start) - path_start);
+        self.requests.push_back(
+            method + (chunked ? " chunked " : " ") + path);
+
+        std::string response;
+        if (method == "PUT") {
+            self.blobs[path] = chunked ? unchunk(body) : body;
+            response = "HTTP/1.1 201 Created\r\nContent-Length: 0\r\n\r\n";
+        } else if (self.blobs.count(path) == 0) {
+            response = "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n\r\n";
+        } else {
+            const std::string& blob = self.blobs[path];
+            const size_t half = blob.size() / 2;
+            std::ostringstream out;
+            out << "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n"
+                << std::hex << half << "\r\n"
+                << blob.substr(0, half) << "\r\n"
+                << blob.size() - half << "\r\n"
+                << blob.substr(half) << "\r\n0\r\n\r\n";
+            response = out.str();
+        }
+
+        ::send(client, response.data(), response.size(), MSG_NOSIGNAL);
+    }
+
+    static std::string unchunk(const std::string& body) {
+        std::string content;
+        size_t position = 0;
+
+        while (true) {
+            const size_t line_end = body.find("\r\n", position);
+            const size_t size =
+                std::stoul(body.substr(position, line_end - position), 0, 16);
+            if (size == 0) {
+                return content;
+            }
+            content += body.substr(line_end + 2, size);
+            position = line_end + 2 + size + 2;
+        }
+    }
+};
+
+void talks_http() {
+    Server server;
+    const std::string action = nobpp::sha256::hex_digest("http action");
+    const std::string blob(100000, 'x');
+
+    {
+        nobpp::cache::Client client(
+            std::make_shared<nobpp::cache::HttpBackend>(
+                "127.0.0.1", server.get_port(), "/prefix"));
+        client.store_async(action, blob);
+    }
+    CHECK_EQ(server.requests.size(), 2u);
+    CHECK_EQ(server.requests[0],
+        "PUT /prefix/cas/" + nobpp::sha256::hex_digest(blob));
+    CHECK_EQ(server.requests[1], "PUT /prefix/ac/" + action);
+
+    std::string fetched;
+    nobpp::cache::Client client(std::make_shared<nobpp::cache::HttpBackend>(
+        "127.0.0.1", server.get_port(), "/prefix"));
+    CHECK(client.fetch(action, fetched));
+    CHECK(fetched == blob);
+
+    const std::string chunked_action = nobpp::sha256::hex_digest("chunked");
+    {
+        auto backend = std::make_shared<nobpp::cache::HttpBackend>(
+            "127.0.0.1", server.get_port());
+        backend->set_chunk_size(4096);
+        nobpp::cache::Client chunked_client(backend);
+        chunked_client.store_async(chunked_action, blob + "y");
+    }
+    CHECK_EQ(server.requests[4],
+        "PUT chunked /cas/" + nobpp::sha256::hex_digest(blob + "y"));
+
+    nobpp::cache::Client plain_client(
+        std::make_shared<nobpp::cache::HttpBackend>(
+            "127.0.0.1", server.get_port()));
+    CHECK(plain_client.fetch(chunked_action, fetched));
+    CHECK(fetched == blob + "y");
+}
+#endif
+
+}  // namespace
+
+int main() {
+    const std::string dir = check::scratch_dir("cache");
+
+    encodes_action_results();
+    round_trips_through_a_directory(dir + "/store");
+    compiles_once_and_fetches_afterwards(dir);
+#ifndef _WIN32
+    talks_http();
+#endif
+
+    return check::result();
+}
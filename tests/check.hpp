@@ -0,0 +1,75 @@
+/**
+ * @file check.hpp
+ * @brief Minimal assertions shared by the nobpp tests
+ *
+ * Every test is a program that returns non zero if a check failed, so it can
+ * run under `CommandBuilder::add_test` without a test framework.
+ */
+
+#pragma once
+#include "../nobpp.hpp"
+
+namespace check {
+
+inline int& failures() {
+    static int count = 0;
+    return count;
+}
+
+inline void fail(const char* file, int line, const std::string& message) {
+    std::cerr << file << ":" << line << ": check failed: " << message << "\n";
+    ++failures();
+}
+
+/**
+ * @brief Compiler the tests build their fixtures with, clang if installed
+ */
+inline nobpp::Compiler compiler() {
+    return nobpp::find_executable("clang++") != "" ? nobpp::Compiler::clang
+                                                    : nobpp::Compiler::gcc;
+}
+
+/**
+ * @brief Create an empty scratch directory under `./tests/bin/tmp`
+ *
+ * @return path of the directory
+ */
+inline std::string scratch_dir(const std::string& name) {
+    const std::string dir = "./tests/bin/tmp/" + name;
+#ifdef _WIN32
+    nobpp::create_process("cmd /c rmdir /s /q \"" + dir + "\"");
+#else
+    nobpp::create_process("rm -rf '" + dir + "'");
+#endif
+    nobpp::createDirectoryRecursively(dir);
+    return dir;
+}
+
+inline int result() {
+    if (failures() != 0) {
+        std::cerr << failures() << " checks failed\n";
+        return 1;
+    }
+    return 0;
+}
+
+}  // namespace check
+
+#define CHECK(condition)                                                       \
+    do {                                                                       \
+        if (!(condition)) {                                                    \
+            check::fail(__FILE__, __LINE__, #condition);                       \
+        }                                                                      \
+    } while (false)
+
+#define CHECK_EQ(actual, expected)                                             \
+    do {                                                                       \
+        const auto& check_actual = (actual);                                   \
+        const auto& check_expected = (expected);                               \
+        if (!(check_actual == check_expected)) {                               \
+            std::ostringstream check_message;                                  \
+            check_message << #actual << " == " << #expected << " ("            \
+                          << check_actual << " != " << check_expected << ")";  \
+            check::fail(__FILE__, __LINE__, check_message.str());              \
+        }                                                                      \
+    } while (false)
@@ -0,0 +1,103 @@
+#include "check.hpp"
+
+namespace {
+
+int run(std::vector<const char*> arguments,
+    const std::vector<const nobpp::CommandBuilder*>& builders) {
+    arguments.insert(arguments.begin(), "build");
+    nobpp::Cli cli(static_cast<int>(arguments.size()), arguments.data());
+
+    for (const nobpp::CommandBuilder* builder : builders) {
+        cli.add_target(*builder);
+    }
+
+    return cli.run();
+}
+
+nobpp::CommandBuilder program(const std::string& dir,
+    const std::string& name, const std::string& source) {
+    nobpp::write_file(dir + "/" + name + ".cpp", source);
+
+    nobpp::CommandBuilder builder;
+    builder.set_project_name(name)
+        .set_compiler(check::compiler())
+        .set_language(nobpp::Language::cpp)
+        .add_file(dir + "/" + name + ".cpp")
+        .set_build_dir(dir + "/out")
+        .set_output(name);
+
+    return builder;
+}
+
+void parses_options() {
+    const char* const arguments[] = {"build", "-j3", "--variant=release",
+        "--dry-run", "--fail-fast", "app", "--", "-odd"};
+    nobpp::Cli cli(8, arguments);
+
+    CHECK_EQ(cli.get_jobs(), 3u);
+    CHECK_EQ(cli.get_variant(), "release");
+    CHECK(cli.is_dry_run());
+    CHECK(cli.get_failure_mode() == nobpp::FailureMode::fail_fast);
+    CHECK_EQ(cli.get_targets().size(), 2u);
+    CHECK_EQ(cli.get_targets().back(), "-odd");
+}
+
+void rejects_invalid_arguments(const nobpp::CommandBuilder& app) {
+    CHECK_EQ(run({"--variant"}, {&app}), 2);
+    CHECK_EQ(run({"-j"}, {&app}), 2);
+    CHECK_EQ(run({"--unknown"}, {&app}), 2);
+    CHECK_EQ(run({"missing"}, {&app}), 2);
+}
+
+void reports_the_build_result(const std::string& dir) {
+    const nobpp::CommandBuilder app =
+        program(dir, "app", "int main() { return 0; }\n");
+    const nobpp::CommandBuilder broken =
+        program(dir, "broken", "int main() { return }\n");
+
+    CHECK_EQ(run({"-n"}, {&app, &broken}), 0);
+    CHECK_EQ(run({"app"}, {&app, &broken}), 0);
+    CHECK_EQ(run({"-j1"}, {&app, &broken}), 1);
+
+    nobpp::FileStat info;
+    CHECK(nobpp::stat_file(app.output_file(), info));
+}
+
+void does_not_report_a_cycle_after_an_invalid_target(const std::string& dir) {
+    nobpp::CommandBuilder invalid =
+        program(dir, "invalid", "int main() { return 0; }\n");
+    invalid.set_compiler(nobpp::Compiler::gcc)
+        .set_sanitizers(nobpp::Sanitizer::memory);
+
+    nobpp::CommandQueue queue(1);
+    std::string first;
+    std::string second;
+    try {
+        queue.add_builder(invalid);
+    } catch (const std::invalid_argument& error) {
+        first = error.what();
+    }
+    try {
+        queue.add_builder(invalid);
+    } catch (const std::invalid_argument& error) {
+        second = error.what();
+    }
+    queue.wait();
+
+    CHECK(first != "");
+    CHECK_EQ(second, first);
+    CHECK_EQ(run({}, {&invalid}), 2);
+}
+
+}  // namespace
+
+int main() {
+    const std::string dir = check::scratch_dir("cli");
+
+    parses_options();
+    rejects_invalid_arguments(program(dir, "app", "int main() {}\n"));
+    reports_the_build_result(dir);
+    does_not_report_a_cycle_after_an_invalid_target(dir);
+
+    return check::result();
+}
@@ -0,0 +1,70 @@
+#include "check.hpp"
+
+namespace {
+
+void parses_depfiles() {
+    const std::vector<std::string> simple =
+        nobpp::parse_depfile("out/main.o: src/main.cpp include/a.h\n");
+    CHECK_EQ(simple.size(), 2u);
+    CHECK_EQ(simple[0], "src/main.cpp");
+    CHECK_EQ(simple[1], "include/a.h");
+
+    // Continuations, with and without a carriage return
+    const std::vector<std::string> continued = nobpp::parse_depfile(
+        "main.o: main.cpp \\\n  a.h \\\r\n  b.h\r\n");
+    CHECK_EQ(continued.size(), 3u);
+    CHECK_EQ(continued[2], "b.h");
+
+    const std::vector<std::string> escaped = nobpp::parse_depfile(
+        "my\\ main.o: my\\ dir/main.cpp cost$$.h a\\#b.h\n");
+    CHECK_EQ(escaped.size(), 3u);
+    CHECK_EQ(escaped[0], "my dir/main.cpp");
+    CHECK_EQ(escaped[1], "cost$.h");
+    CHECK_EQ(escaped[2], "a#b.h");
+
+    // Drive letters are not the end of the target
+    const std::vector<std::string> windows =
+        nobpp::parse_depfile("C:/out/main.o: C:/src/main.cpp\n");
+    CHECK_EQ(windows.size(), 1u);
+    CHECK_EQ(windows[0], "C:/src/main.cpp");
+
+    // `-MP` adds an empty rule for every header
+    const std::vector<std::string> phony =
+        nobpp::parse_depfile("main.o: main.cpp a.h\n\na.h:\n");
+    CHECK_EQ(phony.size(), 2u);
+
+    CHECK(nobpp::parse_depfile("").empty());
+}
+
+void logs_only_when_asked(const std::string& dir) {
+    const std::string depfile = dir + "/main.d";
+    const std::string log_path = dir + "/deps";
+    nobpp::write_file(depfile, "main.o: main.cpp a\\ b.h\n");
+
+    nobpp::DepsLog& log = nobpp::DepsLog::open(log_path);
+    std::vector<const std::string*> prerequisites;
+
+    CHECK(log.get(depfile, prerequisites, false));
+    CHECK_EQ(prerequisites.size(), 2u);
+    CHECK_EQ(*prerequisites[1], "a b.h");
+    nobpp::FileStat info;
+    CHECK(!nobpp::stat_file(log_path, info));
+
+    CHECK(log.get(depfile, prerequisites));
+    CHECK_EQ(*prerequisites[0], "main.cpp");
+    CHECK(nobpp::stat_file(log_path, info));
+
+    CHECK(!log.get(dir + "/missing.d", prerequisites));
+    CHECK(prerequisites.empty());
+}
+
+}  // namespace
+
+int main() {
+    const std::string dir = check::scratch_dir("deps");
+
+    parses_depfiles();
+    logs_only_when_asked(dir);
+
+    return check::result();
+}
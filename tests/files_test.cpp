@@ -0,0 +1,45 @@
+#include "check.hpp"
+
+namespace {
+
+bool is_cpp(const std::string& name) {
+    return name.size() > 4 && name.compare(name.size() - 4, 4, ".cpp") == 0;
+}
+
+void lists_nested_files(const std::string& dir) {
+    nobpp::createDirectoryRecursively(dir + "/src/nested");
+    nobpp::write_file(dir + "/src/main.cpp", "");
+    nobpp::write_file(dir + "/src/nested/util.cpp", "");
+    nobpp::write_file(dir + "/src/nested/util.h", "");
+
+    std::vector<std::string> files = nobpp::readdir(dir + "/src", is_cpp, true);
+    std::sort(files.begin(), files.end());
+    CHECK_EQ(files.size(), 2u);
+    CHECK_EQ(files[1], dir + "/src/nested/util.cpp");
+
+    CHECK_EQ(nobpp::readdir(dir + "/src", is_cpp, false).size(), 1u);
+}
+
+#ifndef _WIN32
+void ends_symlink_loops(const std::string& dir) {
+    // Points back at its parent, following it would never end
+    nobpp::create_process("ln -s .. '" + dir + "/src/nested/loop'");
+
+    const std::vector<std::string> files =
+        nobpp::readdir(dir + "/src", is_cpp, true);
+    CHECK_EQ(files.size(), 2u);
+}
+#endif
+
+}  // namespace
+
+int main() {
+    const std::string dir = check::scratch_dir("files");
+
+    lists_nested_files(dir);
+#ifndef _WIN32
+    ends_symlink_loops(dir);
+#endif
+
+    return check::result();
+}
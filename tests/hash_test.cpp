@@ -0,0 +1,109 @@
+#include "check.hpp"
+
+namespace {
+
+void matches_the_xxh64_reference() {
+    CHECK_EQ(nobpp::xxh64::hex_digest(""), "ef46db3751d8e999");
+    CHECK_EQ(nobpp::xxh64::hex_digest("a"), "d24ec4f1a98c6e5b");
+    CHECK_EQ(nobpp::xxh64::hex_digest("abc"), "44bc2cf5ad770999");
+    CHECK_EQ(
+        nobpp::xxh64::hex_digest("Nobody inspects the spammish repetition"),
+        "fbcea83c8a378bf1");
+}
+
+void hashes_files_with_the_chosen_digest(const std::string& dir) {
+    const std::string content(100000, 'x');
+    nobpp::write_file(dir + "/a.txt", content);
+    nobpp::write_file(dir + "/b.txt", "abc");
+
+    const std::vector<std::string> files = {
+        dir + "/a.txt", dir + "/missing.txt", dir + "/b.txt"};
+    const std::vector<std::string> fast =
+        nobpp::HashCache::open(dir + "/hashes").hash(files, 4);
+    CHECK_EQ(fast.size(), 3u);
+    CHECK_EQ(fast[0], nobpp::xxh64::hex_digest(content));
+    CHECK_EQ(fast[1], "");
+    CHECK_EQ(fast[2], "44bc2cf5ad770999");
+
+    nobpp::HashCache& secure =
+        nobpp::HashCache::open(dir + "/sha256", nobpp::Digest::sha256);
+    CHECK_EQ(secure.hash(dir + "/b.txt"), nobpp::sha256::hex_digest("abc"));
+    const std::vector<std::string> digests = secure.hash(files);
+    CHECK_EQ(digests[0], nobpp::sha256::hex_digest(content));
+
+    bool rejected = false;
+    try {
+        nobpp::HashCache::open(dir + "/sha256");
+    } catch (const std::invalid_argument&) {
+        rejected = true;
+    }
+    CHECK(rejected);
+}
+
+#ifndef _WIN32
+void compacts_the_memo_file(const std::string& dir) {
+    const std::string file = dir + "/changing.txt";
+    nobpp::HashCache& cache = nobpp::HashCache::open(dir + "/compacted");
+
+    // Old modification times, so every version is memoised
+    for (int i = 0; i < 100; ++i) {
+        nobpp::write_file(file, std::to_string(i));
+        nobpp::create_process(
+            "touch -d @" + std::to_string(1600000000 + i) + " '" + file + "'");
+        CHECK_EQ(cache.hash(file), nobpp::xxh64::hex_digest(std::to_string(i)));
+    }
+
+    std::string memo;
+    CHECK(nobpp::read_file(dir + "/compacted", memo));
+    CHECK(std::count(memo.begin(), memo.end(), '\n') <= 2 + 64);
+}
+#endif
+
+void skips_compiles_of_touched_files(const std::string& dir) {
+    nobpp::write_file(dir + "/main.cpp",
+        "#include \"answer.h\"\nint main() { return ANSWER - 42; }\n");
+    nobpp::write_file(dir + "/answer.h", "#define ANSWER 42\n");
+
+    nobpp::CommandBuilder builder;
+    builder.set_compiler(check::compiler())
+        .set_language(nobpp::Language::cpp)
+        .add_file(dir + "/main.cpp")
+        .set_build_dir(dir + "/out")
+        .set_output("main");
+    nobpp::CommandQueue(1).add_builder(builder).wait();
+
+    const std::string object = builder.object_file(dir + "/main.cpp");
+    nobpp::FileStat compiled;
+    CHECK(nobpp::stat_file(object, compiled));
+
+    // Written again with the same content, the header is only newer
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    nobpp::write_file(dir + "/answer.h", "#define ANSWER 42\n");
+    CHECK(builder.explain_compile(dir + "/main.cpp") != "");
+    CHECK(builder.inputs_unchanged(dir + "/main.cpp"));
+
+    nobpp::CommandQueue queue(1);
+    queue.add_builder(builder).wait();
+    CHECK(queue.get_failed().empty());
+    nobpp::FileStat skipped;
+    CHECK(nobpp::stat_file(object, skipped));
+    CHECK_EQ(skipped.mtime, compiled.mtime);
+
+    nobpp::write_file(dir + "/answer.h", "#define ANSWER 43\n");
+    CHECK(!builder.inputs_unchanged(dir + "/main.cpp"));
+}
+
+}  // namespace
+
+int main() {
+    const std::string dir = check::scratch_dir("hash");
+
+    matches_the_xxh64_reference();
+    hashes_files_with_the_chosen_digest(dir);
+#ifndef _WIN32
+    compacts_the_memo_file(dir);
+#endif
+    skips_compiles_of_touched_files(dir);
+
+    return check::result();
+}
@@ -0,0 +1,125 @@
+#include "check.hpp"
+
+namespace {
+
+std::string compiler_executable() {
+    return nobpp::CommandBuilder()
+        .set_compiler(check::compiler())
+        .set_language(nobpp::Language::cpp)
+        .compiler_executable();
+}
+
+bool wait_for_socket(const std::string& path) {
+    nobpp::FileStat info;
+    for (int i = 0; i < 500; ++i) {
+        if (nobpp::stat_file(path, info)) {
+            return true;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    return false;
+}
+
+void compiles_through_the_queue(
+    const std::string& dir, const std::string& socket) {
+    nobpp::write_file(dir + "/main.cpp", "int main() { return 0; }\n");
+
+    nobpp::CommandBuilder builder;
+    builder.set_compiler(check::compiler())
+        .set_language(nobpp::Language::cpp)
+        .add_file(dir + "/main.cpp")
+        .set_build_dir(dir + "/out")
+        .set_output("main");
+
+    nobpp::CommandQueue queue(2);
+    queue.add_worker(socket).add_builder(builder).wait();
+
+    CHECK(queue.get_failed().empty());
+    nobpp::FileStat info;
+    CHECK(nobpp::stat_file(builder.object_file(dir + "/main.cpp"), info));
+    CHECK(nobpp::stat_file(builder.output_file(), info));
+}
+
+void compiles_a_request(const std::string& socket) {
+    nobpp::remote::CompileRequest request;
+    request.compiler = compiler_executable();
+    request.extension = ".ii";
+    request.preprocessed_source = "int answer() { return 42; }\n";
+
+    nobpp::remote::CompileResponse response;
+    CHECK(nobpp::remote::Client(socket).send(request, response));
+    CHECK_EQ(response.exit_code, 0);
+    CHECK(!response.object.empty());
+}
+
+void refuses_unknown_compilers(const std::string& socket) {
+    nobpp::remote::CompileRequest request;
+    request.compiler = "sh";
+    request.extension = ".ii";
+    request.flags = {"-c", "exit 0"};
+
+    nobpp::remote::CompileResponse response;
+    CHECK(nobpp::remote::Client(socket).send(request, response));
+    CHECK(response.exit_code != 0);
+    CHECK(response.diagnostics.find("not allowed") != std::string::npos);
+}
+
+void passes_flags_without_a_shell(
+    const std::string& dir, const std::string& socket) {
+    const std::string marker = dir + "/shell-ran";
+
+    nobpp::remote::CompileRequest request;
+    request.compiler = compiler_executable();
+    request.extension = ".ii";
+    request.flags = {"-DVALUE=$(touch " + marker + ")"};
+    request.preprocessed_source = "int value;\n";
+
+    nobpp::remote::CompileResponse response;
+    CHECK(nobpp::remote::Client(socket).send(request, response));
+    CHECK_EQ(response.exit_code, 0);
+
+    nobpp::FileStat info;
+    CHECK(!nobpp::stat_file(marker, info));
+}
+
+void rejects_oversized_messages(const std::string& socket) {
+    const int fd = nobpp::remote::details::connect_to(socket);
+    CHECK(fd >= 0);
+    if (fd < 0) {
+        return;
+    }
+
+    std::string header;
+    nobpp::remote::details::put_u32(header, nobpp::remote::PROTOCOL_MAGIC);
+    nobpp::remote::details::put_u32(header,
+        static_cast<uint32_t>(nobpp::remote::MessageKind::compile_request));
+    nobpp::remote::details::put_u64(header, ~uint64_t(0));
+    CHECK(nobpp::remote::details::write_all(
+        fd, header.data(), header.size()));
+
+    // The worker drops the connection instead of allocating the payload
+    char byte = 0;
+    CHECK(::recv(fd, &byte, 1, 0) == 0);
+    ::close(fd);
+}
+
+}  // namespace
+
+int main() {
+    const std::string dir = check::scratch_dir("remote");
+    const std::string socket = dir + "/worker.sock";
+
+    std::thread([socket, dir]() {
+        nobpp::remote::Worker(socket, 2).set_work_dir(dir).serve();
+    }).detach();
+
+    CHECK(wait_for_socket(socket));
+
+    compiles_through_the_queue(dir, socket);
+    compiles_a_request(socket);
+    refuses_unknown_compilers(socket);
+    passes_flags_without_a_shell(dir, socket);
+    rejects_oversized_messages(socket);
+
+    return check::result();
+}
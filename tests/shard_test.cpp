@@ -0,0 +1,107 @@
+#include "check.hpp"
+
+namespace {
+
+const char* const SHARD_PROGRAM = R"(#include <cstdlib>
+#include <fstream>
+#include <string>
+
+int main(int argc, char** argv) {
+    const char* index = std::getenv("GTEST_SHARD_INDEX");
+    const char* total = std::getenv("GTEST_TOTAL_SHARDS");
+    if (argc < 2 || index == nullptr || total == nullptr) {
+        return 1;
+    }
+
+    std::ofstream(std::string(argv[1]) + "/shard" + index) << total;
+    return 0;
+}
+)";
+
+nobpp::CommandBuilder shard_program(const std::string& dir) {
+    nobpp::write_file(dir + "/shards.cpp", SHARD_PROGRAM);
+
+    nobpp::CommandBuilder builder;
+    builder.set_compiler(check::compiler())
+        .set_language(nobpp::Language::cpp)
+        .add_file(dir + "/shards.cpp")
+        .set_build_dir(dir + "/out")
+        .set_output("shards")
+        .add_test({"shards", {dir + "/ran"}, {}, 60, 3});
+
+    return builder;
+}
+
+void runs_every_shard_once(const std::string& dir) {
+    const nobpp::CommandBuilder builder = shard_program(dir);
+    nobpp::createDirectoryRecursively(dir + "/ran");
+
+    nobpp::CommandQueue(2).add_builder(builder).wait();
+
+    for (const char* shard : {"0", "1", "2"}) {
+        std::string total;
+        CHECK(nobpp::read_file(dir + "/ran/shard" + shard, total));
+        CHECK_EQ(total, "3");
+        std::remove((dir + "/ran/shard" + shard).c_str());
+    }
+
+    // Passed shards do not run again while nothing changed
+    nobpp::CommandQueue queue(2);
+    queue.add_builder(builder).wait();
+    CHECK(queue.get_failed().empty());
+
+    nobpp::FileStat info;
+    CHECK(!nobpp::stat_file(dir + "/ran/shard0", info));
+}
+
+void rejects_tests_of_static_libraries(const std::string& dir) {
+    nobpp::CommandBuilder builder = shard_program(dir);
+    builder.set_output_type(nobpp::OutputType::static_library);
+
+    bool rejected = false;
+    try {
+        builder.validate();
+    } catch (const std::invalid_argument&) {
+        rejected = true;
+    }
+    CHECK(rejected);
+}
+
+#ifndef _WIN32
+void stops_reading_when_the_command_exits() {
+    // The grandchild leaves the process group and keeps the pipe open
+    const auto start = std::chrono::steady_clock::now();
+    std::string output;
+    const int result = nobpp::create_process(
+        "setsid sleep 5 & echo done", output, std::chrono::seconds(60));
+
+    CHECK_EQ(result, 0);
+    CHECK_EQ(output, "done\n");
+    CHECK(std::chrono::steady_clock::now() - start < std::chrono::seconds(4));
+}
+
+void finishes_queued_commands_when_they_exit() {
+    const auto start = std::chrono::steady_clock::now();
+    nobpp::CommandQueue queue(1);
+    queue.add_command("detach", "setsid sleep 5 & echo done");
+    queue.wait();
+
+    CHECK(queue.get_failed().empty());
+    CHECK(std::chrono::steady_clock::now() - start < std::chrono::seconds(4));
+}
+#endif
+
+}  // namespace
+
+int main() {
+    const std::string dir = check::scratch_dir("shard");
+
+    runs_every_shard_once(dir);
+    rejects_tests_of_static_libraries(dir);
+#ifndef _WIN32
+    stops_reading_when_the_command_exits();
+    finishes_queued_commands_when_they_exit();
+#endif
+
+    return check::result();
+}
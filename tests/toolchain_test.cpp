@@ -0,0 +1,65 @@
+#include "check.hpp"
+
+namespace {
+
+void copies_drop_implicit_toolchains() {
+    nobpp::CommandBuilder builder;
+    builder.set_compiler(nobpp::Compiler::clang)
+        .set_language(nobpp::Language::cpp);
+    builder.get_toolchain();
+
+    nobpp::CommandBuilder copy(builder);
+    copy.set_compiler(nobpp::Compiler::gcc);
+    CHECK_EQ(copy.compiler_executable(), "g++");
+    CHECK_EQ(builder.compiler_executable(), "clang++");
+
+    // An explicit toolchain survives in the copy
+    builder.set_toolchain(nobpp::Toolchain::clang("-18"));
+    nobpp::CommandBuilder explicit_copy(builder);
+    explicit_copy.set_compiler(nobpp::Compiler::gcc);
+    CHECK_EQ(explicit_copy.compiler_executable(), "clang++-18");
+}
+
+#ifndef _WIN32
+void probes_a_flag_once(const std::string& dir) {
+    // Counts its runs and takes long enough for the callers to overlap
+    const std::string compiler = dir + "/compiler";
+    nobpp::write_file(
+        compiler, "#!/bin/sh\necho run >> '" + dir + "/runs'\nsleep 0.2\n");
+    nobpp::create_process("chmod +x '" + compiler + "'");
+
+    nobpp::Toolchain toolchain;
+    toolchain.set_cpp_compiler(compiler).set_cache_dir(dir + "/probes");
+
+    std::vector<std::thread> callers;
+    std::atomic<int> supported{0};
+    for (int i = 0; i < 4; ++i) {
+        callers.emplace_back([&]() {
+            if (toolchain.supports_flag(nobpp::Language::cpp, "-fflag")) {
+                ++supported;
+            }
+        });
+    }
+    for (std::thread& caller : callers) {
+        caller.join();
+    }
+
+    std::string runs;
+    CHECK(nobpp::read_file(dir + "/runs", runs));
+    CHECK_EQ(runs, "run\n");
+    CHECK_EQ(supported.load(), 4);
+}
+#endif
+
+}  // namespace
+
+int main() {
+    const std::string dir = check::scratch_dir("toolchain");
+
+    copies_drop_implicit_toolchains();
+#ifndef _WIN32
+    probes_a_flag_once(dir);
+#endif
+
+    return check::result();
+}